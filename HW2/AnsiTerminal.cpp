@@ -1,11 +1,14 @@
 
 #include "AnsiTerminal.h"
-#include <iostream>
 #include <unistd.h>   // For read()
 #include <termios.h>  // For terminal control
+#include <poll.h>     // For poll()
+#include <cerrno>     // For EINTR
 
 // Constructor: Configure terminal for non-canonical mode
-AnsiTerminal::AnsiTerminal() {
+AnsiTerminal::AnsiTerminal()
+    : inFrame(false), style(STYLE_DEFAULT), cursorRow(0), cursorCol(0),
+      hasPutBackKey(false), putBackKeyValue(0) {
     // Save the original terminal settings
     tcgetattr(STDIN_FILENO, &original_tio);
     struct termios new_tio = original_tio;
@@ -22,18 +25,95 @@ AnsiTerminal::~AnsiTerminal() {
 
 // Method to print text at a specified position
 void AnsiTerminal::printAt(int row, int col, const std::string &text) {
-    std::cout << "\033[" << row << ";" << col << "H\033[32m" << text << "\033[0m" << std::flush;
+    put(row, col, STYLE_NORMAL, text);
 }
 
 // Method to print text with inverted background at a specified position
 void AnsiTerminal::printInvertedAt(int row, int col, const std::string &text) {
-    std::cout << "\033[" << row << ";" << col << "H\033[42m\033[30m" << text << "\033[0m" << std::flush;
-    // \033[7m enables reverse video mode, \033[0m resets to normal
+    put(row, col, STYLE_INVERTED, text);
 }
 
 // Method to clear the terminal screen
 void AnsiTerminal::clearScreen() {
-    std::cout << "\033[2J\033[H" << std::flush; // Clear screen and move cursor to home
+    if (style != STYLE_DEFAULT) {
+        frame += "\033[0m"; // Reset colors, so the cleared screen has the default background
+        style = STYLE_DEFAULT;
+    }
+    frame += "\033[2J\033[H"; // Clear screen and move cursor to home
+    cursorRow = 1;
+    cursorCol = 1;
+    if (!inFrame) {
+        endFrame();
+    }
+}
+
+// Starts buffering the output of a frame
+void AnsiTerminal::beginFrame() {
+    inFrame = true;
+}
+
+// Ends the frame with the default colors and writes it out at once
+void AnsiTerminal::endFrame() {
+    if (style != STYLE_DEFAULT) {
+        frame += "\033[0m";
+        style = STYLE_DEFAULT;
+    }
+    inFrame = false;
+    flushFrame();
+    // Other output may move the cursor before the next frame
+    cursorRow = 0;
+    cursorCol = 0;
+}
+
+// Appends a print to the frame; the cursor move and the colors are only sent when they change
+void AnsiTerminal::put(int row, int col, Style textStyle, const std::string &text) {
+    // The terminal treats row and column 0 as 1
+    if (row < 1) row = 1;
+    if (col < 1) col = 1;
+    if (row != cursorRow || col != cursorCol) {
+        frame += "\033[";
+        frame += std::to_string(row);
+        frame += ';';
+        frame += std::to_string(col);
+        frame += 'H';
+    }
+    if (textStyle != style) {
+        if (textStyle == STYLE_INVERTED) {
+            frame += "\033[42m\033[30m";
+        } else {
+            // The inverted background stays until the colors are reset
+            frame += style == STYLE_INVERTED ? "\033[0m\033[32m" : "\033[32m";
+        }
+        style = textStyle;
+    }
+    frame += text;
+
+    // The cursor advances one column per character; UTF-8 continuation bytes take none
+    int width = 0;
+    for (char ch : text) {
+        if ((static_cast<unsigned char>(ch) & 0xc0) != 0x80) ++width;
+    }
+    cursorRow = row;
+    cursorCol = col + width;
+
+    // Outside a frame every print reaches the terminal right away, in the default colors
+    if (!inFrame) {
+        endFrame();
+    }
+}
+
+// Writes the whole buffer, retrying after partial writes and interruptions
+void AnsiTerminal::flushFrame() {
+    size_t written = 0;
+    while (written < frame.size()) {
+        ssize_t n = write(STDOUT_FILENO, frame.data() + written, frame.size() - written);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            break; // The terminal is gone; nothing useful can be done with the output
+        }
+        written += static_cast<size_t>(n);
+    }
+    frame.clear();
 }
 
 // Method to get a single keystroke from the terminal
@@ -52,32 +132,56 @@ char AnsiTerminal::getKeystroke() {
     return ch;  // Return the character as-is if it's a regular key
 }
 
+// Method to check for pending input without blocking longer than timeoutMs
+bool AnsiTerminal::waitForInput(int timeoutMs) {
+    if (hasPutBackKey) {
+        return true;
+    }
+    struct pollfd pfd;
+    pfd.fd = STDIN_FILENO;
+    pfd.events = POLLIN;
+    return poll(&pfd, 1, timeoutMs) > 0 && (pfd.revents & POLLIN);
+}
+
+// Reads a byte only if it arrives in time, so an incomplete sequence never blocks
+bool AnsiTerminal::readByte(char &ch, int timeoutMs) {
+    return waitForInput(timeoutMs) && read(STDIN_FILENO, &ch, 1) == 1;
+}
+
 // Method to handle arrow key sequences, Alt keys, and other special keys
-char AnsiTerminal::getSpecialKey() {
+int AnsiTerminal::getSpecialKey() {
+    if (hasPutBackKey) {
+        hasPutBackKey = false;
+        return putBackKeyValue;
+    }
+
     char ch = getKeystroke();
 
     // If it's an escape character, we might be dealing with an escape sequence
     if (ch == '\033') {
-        // Peek at the next character to see if it's an arrow key or Alt key combination
+        // A key sends its whole sequence at once, so if nothing follows soon the ESC key was pressed
         char next_ch;
-        if (read(STDIN_FILENO, &next_ch, 1) == 0) return '\033';  // If no more input, it's just ESC
+        if (!readByte(next_ch, ESCAPE_TIMEOUT_MS)) return '\033';
 
         // Arrow keys and some function keys produce sequences starting with '[' after '\033'
         if (next_ch == '[') {
-            char arrow_key;
-            if (read(STDIN_FILENO, &arrow_key, 1) == 1) {
-                switch (arrow_key) {
-                    case 'A': return 'U'; // Up arrow
-                    case 'B': return 'D'; // Down arrow
-                    case 'C': return 'R'; // Right arrow
-                    case 'D': return 'L'; // Left arrow
-                    // Add cases for other keys like Home, End, PgUp, PgDn, if needed
-                }
+            // Skip parameters such as the modifiers in "\033[1;5A" up to the final byte
+            char final_ch;
+            do {
+                if (!readByte(final_ch, ESCAPE_TIMEOUT_MS)) return '\033';
+            } while (final_ch >= 0x20 && final_ch <= 0x3f);
+
+            switch (final_ch) {
+                case 'A': return 'U'; // Up arrow
+                case 'B': return 'D'; // Down arrow
+                case 'C': return 'R'; // Right arrow
+                case 'D': return 'L'; // Left arrow
+                // Add cases for other keys like Home, End, PgUp, PgDn, if needed
             }
         } else {
             // If it's not an arrow sequence, it could be an Alt+Key combination
             // Return the second character as the key pressed with Alt
-            return next_ch | 0x80;  // Set high bit to distinguish Alt
+            return ALT_KEY + static_cast<unsigned char>(next_ch);
         }
     }
 
@@ -85,8 +189,13 @@ char AnsiTerminal::getSpecialKey() {
     return ch;
 }
 
+// Keeps a key for the next getSpecialKey() call
+void AnsiTerminal::putBackKey(int key) {
+    hasPutBackKey = true;
+    putBackKeyValue = key;
+}
 
-
-
-
-
+// Arrow keys are returned as 'U', 'D', 'L' and 'R'
+bool AnsiTerminal::isArrowKey(int key) {
+    return key == 'U' || key == 'D' || key == 'L' || key == 'R';
+}
@@ -22,17 +22,60 @@ public:
     // Clear the terminal screen
     void clearScreen();
 
+    // Starts collecting output: until endFrame() the print and clear calls only append to the
+    // frame buffer, so a whole frame reaches the terminal with a single write
+    void beginFrame();
+
+    // Writes the collected frame to the terminal and leaves the colors at their defaults
+    void endFrame();
+
     // Get a single keystroke from the terminal
     char getKeystroke();
 
+    // Waits up to timeoutMs milliseconds for input; returns true if a key can be read without blocking
+    bool waitForInput(int timeoutMs);
+
+    // Alt+key (ESC followed by the key) is returned as ALT_KEY + the key, outside the range of
+    // a byte, so it never matches a byte of typed text such as a UTF-8 continuation byte
+    static const int ALT_KEY = 0x100;
+
     // Get the arrow key or special key input ('U', 'D', 'L', 'R' for Up, Down, Left, Right),
     // or detect other key combinations such as Alt+Key, Ctrl+Key, etc.
-    char getSpecialKey();
+    // An ESC that is not followed by the rest of a sequence within ESCAPE_TIMEOUT_MS is returned alone
+    int getSpecialKey();
+
+    // Makes the next getSpecialKey() return this key, for a caller that read one key too many
+    void putBackKey(int key);
+
+    // Returns true for the keys getSpecialKey() returns for the arrow keys
+    static bool isArrowKey(int key);
 
 
 
 private:
+    // How long the rest of an escape sequence may take to arrive after the ESC
+    static const int ESCAPE_TIMEOUT_MS = 50;
+
+    // Colors selected on the terminal
+    enum Style { STYLE_DEFAULT, STYLE_NORMAL, STYLE_INVERTED };
+
     struct termios original_tio; // Holds the original terminal settings
+    std::string frame;           // Output waiting for the write; keeps its capacity between frames
+    bool inFrame;                // Between beginFrame() and endFrame()
+    Style style;                 // Style of the output so far, so it is only switched when it changes
+    int cursorRow;               // Where the last print left the cursor (0 = unknown), so an adjacent
+    int cursorCol;               // print does not move it again
+    bool hasPutBackKey;          // putBackKey() was called and the key was not read yet
+    int putBackKeyValue;
+
+    // Reads one byte if one arrives within timeoutMs; returns false otherwise
+    bool readByte(char &ch, int timeoutMs);
+
+    // Appends the cursor move, style switch and text to the frame buffer
+    void put(int row, int col, Style textStyle, const std::string &text);
+
+    // Writes the frame buffer to the terminal and empties it
+    void flushFrame();
 };
 
 #endif // ANSI_TERMINAL_H
@@ -10,6 +10,31 @@ void Cell::setPosition(int r, int c){
     col = c;
 }
 
+// Parses the displayed content; this is how formulas and aggregates see the value of any cell
+bool Cell::getNumber(double& value) const {
+    return parseNumber(getContent(), value);
+}
+
+bool Cell::parseNumber(const string& text, double& value) {
+    if (text.empty()) return false;
+    try {
+        value = stod(text);
+        return true;
+    } catch (...) {
+        return false; // Non-numeric content
+    }
+}
+
+// Falls back to the formatted content; the value cells override this with cheaper versions
+void Cell::appendContent(string& out) const {
+    out += getContent();
+}
+
+// Labels and integers look the same at any precision
+void Cell::appendFormatted(string& out, int) const {
+    appendContent(out);
+}
+
 // Returns the row index of the cell.
 int Cell::getRow() const {
     return row;
@@ -41,6 +66,11 @@ string ValueCell::getContent() const {
     return value;
 }
 
+// Appends the stored text as is
+void ValueCell::appendContent(string& out) const {
+    out += value;
+}
+
 // Sets the content of the ValueCell and syncs it with the base class content.
 void ValueCell::setContent(const string &kontent){
     value = kontent;
@@ -51,18 +81,34 @@ void ValueCell::setContent(const string &kontent){
 StringValueCell::StringValueCell(const string& initialContent) : ValueCell(initialContent) {}
 
 // Constructor for IntValueCell initializes with an integer value
-IntValueCell::IntValueCell(int initialValue) : ValueCell(to_string(initialValue)), intValue(initialValue) {}
+IntValueCell::IntValueCell(long long initialValue)
+    : ValueCell(GTUSpreadsheet::NumberFormat::integer(initialValue)), intValue(initialValue) {}
 
 // Returns the content of the IntValueCell as a string
 string IntValueCell::getContent() const{
-    return to_string(intValue);
+    return GTUSpreadsheet::NumberFormat::integer(intValue);
+}
+
+// Integers convert to double exactly, no need to go through the text
+bool IntValueCell::getNumber(double& value) const {
+    value = static_cast<double>(intValue);
+    return true;
+}
+
+// Writes the digits straight into the output
+void IntValueCell::appendContent(string& out) const {
+    GTUSpreadsheet::NumberFormat::appendInteger(out, intValue);
+}
+
+long long IntValueCell::getValue() const {
+    return intValue;
 }
 
 // Sets the content of the IntValueCell, converting from a string and validating it
 void IntValueCell::setContent(const string &content){
     try{
-        intValue = stoi(content); //Convert string to int
-        value = to_string(intValue); 
+        intValue = stoll(content); //Convert string to a 64-bit integer
+        value = GTUSpreadsheet::NumberFormat::integer(intValue);
         this->content = value; // Sync content with the base class
     }catch (const invalid_argument&){
         throw runtime_error("Invalid content for IntValueCell. Must be an integer.");
@@ -70,14 +116,38 @@ void IntValueCell::setContent(const string &content){
 }
 
 // Constructor for DoubleValueCell initializes the content with a double value
+// The raw content keeps 6 decimals, as to_string wrote it
 DoubleValueCell::DoubleValueCell(double initialValue)
-    : ValueCell(to_string(initialValue)), doubleValue(initialValue) {}
+    : ValueCell(GTUSpreadsheet::NumberFormat::fixed(initialValue, 6)), doubleValue(initialValue) {}
 
 // Returns the content of the DoubleValueCell formatted to two decimal places
 string DoubleValueCell::getContent() const {
-    ostringstream oss;
-    oss << fixed << setprecision(2) << doubleValue; // Format to 2 decimal places
-    return oss.str();
+    return GTUSpreadsheet::NumberFormat::fixed(doubleValue, GTUSpreadsheet::NumberFormat::DEFAULT_PRECISION);
+}
+
+// Formulas read the value as displayed (2 decimals); the rounding is done in a stack buffer
+// so reading a value column does not allocate a string per cell
+bool DoubleValueCell::getNumber(double& value) const {
+    return displayedNumber(doubleValue, value);
+}
+
+bool DoubleValueCell::displayedNumber(double stored, double& value) {
+    value = GTUSpreadsheet::NumberFormat::roundToPrecision(stored, GTUSpreadsheet::NumberFormat::DEFAULT_PRECISION);
+    return true;
+}
+
+// Same text as getContent(), formatted in a stack buffer
+void DoubleValueCell::appendContent(string& out) const {
+    GTUSpreadsheet::NumberFormat::appendFixed(out, doubleValue, GTUSpreadsheet::NumberFormat::DEFAULT_PRECISION);
+}
+
+// The column's precision only changes the text; the value formulas read stays the same
+void DoubleValueCell::appendFormatted(string& out, int precision) const {
+    GTUSpreadsheet::NumberFormat::appendFixed(out, doubleValue, precision);
+}
+
+double DoubleValueCell::getValue() const {
+    return doubleValue;
 }
 
 // Set the content of the cell, converting the string to a double
@@ -91,356 +161,505 @@ void DoubleValueCell::setContent(const string& content) {
     }
 }
 
-// Constructor for FormulaCell initializes with a formula and a spreadsheet reference
-FormulaCell::FormulaCell(const string& initialFormula, shared_ptr<GTUSpreadsheet::Spreadsheet> sheet) 
-    : formula(initialFormula), spreadsheet(sheet), dependencies() {
-    content = initialFormula;
-    updateDependencies(); // Identify dependencies during initialization
-    evaluate(); // Evaluate the formula immediately
+// Constructor for FormulaCell initializes with a formula, a spreadsheet reference and its position
+// In lazy mode or inside a batch the formula is only marked dirty and computed later
+FormulaCell::FormulaCell(const string& initialFormula, shared_ptr<GTUSpreadsheet::Spreadsheet> sheet,
+                         int cellRow, int cellCol)
+    : resultKind(RESULT_EMPTY), resultValue(0), dirty(true), evaluating(false), resultVersion(0) {
+    spreadsheet = sheet;
+    setPosition(cellRow, cellCol);
+    compile(initialFormula);
+    if (!spreadsheet || !spreadsheet->isEvaluationDeferred()) {
+        evaluate(); // Evaluate the formula immediately
+    }
+}
+
+// Restores a saved formula: the program is shared and the result is trusted, so the cell starts clean
+// A number is read back from its text; any other text is the raw text of a non-formula
+FormulaCell::FormulaCell(shared_ptr<const FormulaProgram> compiled, const string& cachedValue,
+                         shared_ptr<GTUSpreadsheet::Spreadsheet> sheet, int cellRow, int cellCol)
+    : resultKind(RESULT_EMPTY), resultValue(0), dirty(false), evaluating(false), resultVersion(0) {
+    spreadsheet = sheet;
+    setPosition(cellRow, cellCol);
+    adoptProgram(compiled);
+    if (cachedValue == "#ERROR") {
+        resultKind = RESULT_ERROR;
+    } else if (GTUSpreadsheet::NumberFormat::parse(cachedValue, resultValue)) {
+        resultKind = RESULT_NUMBER;
+    } else if (!cachedValue.empty()) {
+        resultKind = RESULT_TEXT;
+    }
 }
 
-// Sets new content for the FormulaCell and updates its dependencies and value
+// Looks up the shared program for the formula; cells with the same relative shape get the same one
+void FormulaCell::compile(const string& formula) {
+    if (spreadsheet) {
+        adoptProgram(spreadsheet->getProgramCache().get(formula, row, col));
+    } else {
+        adoptProgram(FormulaProgram::compile(formula, row, col));
+    }
+}
+
+// Aggregates get a running state, which starts invalid and is built by the first full scan
+void FormulaCell::adoptProgram(shared_ptr<const FormulaProgram> compiled) {
+    program = compiled;
+    if (program->getKind() == FormulaProgram::Kind::Aggregate) {
+        aggregateState = make_unique<AggregateState>();
+        aggregateState->valid = false;
+    } else {
+        aggregateState.reset();
+    }
+}
+
+// Sets new content for the FormulaCell and updates its program and value
 void FormulaCell::setContent(const string& newContent) {
-    formula = newContent;
-    content = newContent;
-    updateDependencies(); // Refresh dependencies based on the new formula
-    evaluate(); // Recalculate the formula's result
+    compile(newContent);
+    if (spreadsheet && spreadsheet->isEvaluationDeferred()) {
+        markDirty();
+    } else {
+        evaluate(); // Recalculate the formula's result
+    }
 }
 
-// Returns the computed value after evaluating the formula
+// Returns the computed value, evaluating the formula first if it is stale
 string FormulaCell::getContent() const {
-    return computedValue;
+    string text;
+    appendContent(text);
+    return text;
 }
 
-// Returns the raw formula string without computation
-string FormulaCell::getRawContent() const {
-    return formula;
+// Formats the cached result straight into the output
+void FormulaCell::appendContent(string& out) const {
+    appendFormatted(out, GTUSpreadsheet::NumberFormat::DEFAULT_PRECISION);
 }
 
-// Checks whether a given formula content represents a function
-bool FormulaCell::isFunction(const string& content) const {
-    return content.size() > 1 && content[0] == '@';
+void FormulaCell::appendFormatted(string& out, int precision) const {
+    if (dirty) {
+        computeValue();
+    }
+    appendResult(out, precision);
 }
 
-// Parses a function and range from a formula string, extracting components
-pair<string, string> FormulaCell::parseFunctionAndRange(const string& content) const {
-    size_t openParen = content.find('(');
-    size_t closeParen = content.find(')');
-    
-    if (openParen == string::npos || closeParen == string::npos) {
-        throw runtime_error("Invalid function format");
+// Numbers are rounded like the displayed text without making it; errors and empty results are not numbers
+bool FormulaCell::getNumber(double& value) const {
+    if (dirty) {
+        computeValue();
+    }
+    switch (resultKind) {
+        case RESULT_NUMBER:
+            return DoubleValueCell::displayedNumber(resultValue, value);
+        case RESULT_TEXT:
+            return parseNumber(program->decompile(row, col), value);
+        default:
+            return false;
     }
-    
-    // Extract the function name and range
-    string funcName = content.substr(1, openParen - 1);
-    string range = content.substr(openParen + 1, closeParen - openParen - 1);
-    return {funcName, range};
 }
 
-// Parses a cell range string and splits it into start and end references
-pair<string, string> FormulaCell::parseRange(const string& range) const {
-    size_t sep = range.find("..");
-    if (sep == string::npos) {
-        throw runtime_error("Invalid range format");
-    }
-    return {range.substr(0, sep), range.substr(sep + 2)};
+// Marks the cached result as stale
+void FormulaCell::markDirty() {
+    dirty = true;
+}
+
+// Returns true if the cached result must be recomputed before use
+bool FormulaCell::isDirty() const {
+    return dirty;
+}
+
+bool FormulaCell::isEvaluating() const {
+    return evaluating;
 }
 
-// Fetches numerical values from a specified range of cells
-DynamicArray<double> FormulaCell::getValuesFromRange(const string& start, const string& end) const {
+// Only the direct inputs are looked at: a formula that reads a dirty one is dirty as well
+// The range is searched from its end, which the recalculation queue usually reaches last, so
+// the search stops early while the range is still being computed
+bool FormulaCell::findDirtyInput(pair<int, int>& input) const {
+    if (!spreadsheet) return false;
     int startRow, startCol, endRow, endCol;
-    spreadsheet->parseCellReference(start, startRow, startCol);
-    spreadsheet->parseCellReference(end, endRow, endCol);
-    
-    DynamicArray<double> values;
-    // Iterate through the specified range and collect numeric values
-    for (int r = startRow; r <= endRow; ++r) {
-        for (int c = startCol; c <= endCol; ++c) {
-            auto cell = spreadsheet->getCell(r, c);
-            if (cell && !cell->getContent().empty()) {
-                try {
-                    values.pushBack(stod(cell->getContent()));
-                } catch (...) {
-                    // Skip non-numeric cells
-                }
-            }
+    if (getRange(startRow, startCol, endRow, endCol) &&
+        spreadsheet->findDirtyFormula(startRow, startCol, endRow, endCol, input)) {
+        return true;
+    }
+    const auto& offsets = program->getReferenceOffsets();
+    for (int i = 0; i < offsets.getSize(); ++i) {
+        int refRow = row + offsets[i].first, refCol = col + offsets[i].second;
+        auto formulaCell = dynamic_cast<const FormulaCell*>(spreadsheet->getCell(refRow, refCol).get());
+        if (formulaCell && formulaCell->dirty) {
+            input = make_pair(refRow, refCol);
+            return true;
         }
     }
-    return values;
+    return false;
+}
+
+// Formats the previous result so stale cells can be drawn while they wait for recalculation
+void FormulaCell::appendResult(string& out, int precision) const {
+    switch (resultKind) {
+        case RESULT_NUMBER:
+            GTUSpreadsheet::NumberFormat::appendFixed(out, resultValue, precision);
+            break;
+        case RESULT_ERROR:
+            out += "#ERROR";
+            break;
+        case RESULT_TEXT:
+            out += program->decompile(row, col);
+            break;
+        default:
+            break;
+    }
+}
+
+// The restoring constructor reads this text back into the same result
+string FormulaCell::getStoredResult() const {
+    string text;
+    if (resultKind == RESULT_NUMBER) {
+        GTUSpreadsheet::NumberFormat::appendShortest(text, resultValue);
+    } else {
+        appendResult(text, GTUSpreadsheet::NumberFormat::DEFAULT_PRECISION);
+    }
+    return text;
+}
+
+// Every new result advances the version
+unsigned FormulaCell::getResultVersion() const {
+    return resultVersion;
+}
+
+void FormulaCell::setResult(ResultKind kind, double value) const {
+    resultKind = kind;
+    resultValue = value;
+    ++resultVersion;
+}
+
+// Column kernels evaluate a whole run of cells and hand each one its result
+void FormulaCell::storeResult(double result) {
+    setResult(RESULT_NUMBER, result);
+    dirty = false;
+}
+
+void FormulaCell::storeError() {
+    setResult(RESULT_ERROR, 0);
+    dirty = false;
 }
 
-// Calculates the sum of values in the provided range
-double FormulaCell::calculateSum(const DynamicArray<double>& values) const {
-    double sum = 0;
-    for (int i = 0; i < values.getSize(); ++i) {
-        sum += values[i];
+// Checks the single-cell references first, then the function range bounds
+bool FormulaCell::dependsOn(int depRow, int depCol) const {
+    const auto& offsets = program->getReferenceOffsets();
+    for (int i = 0; i < offsets.getSize(); ++i) {
+        if (row + offsets[i].first == depRow && col + offsets[i].second == depCol) {
+            return true;
+        }
     }
-    return sum;
+    int startRow, startCol, endRow, endCol;
+    return getRange(startRow, startCol, endRow, endCol) &&
+           depRow >= startRow && depRow <= endRow && depCol >= startCol && depCol <= endCol;
 }
 
-// Calculates the average of values in the provided range
-double FormulaCell::calculateAverage(const DynamicArray<double>& values) const {
-    if (values.getSize() == 0) return 0;
-    return calculateSum(values) / values.getSize();
+// Returns the raw formula, rebuilt from the shared program for this cell's position
+string FormulaCell::getRawContent() const {
+    return program->decompile(row, col);
 }
 
-// Finds the maximum value in the provided range
-double FormulaCell::calculateMax(const DynamicArray<double>& values) const {
-    if (values.getSize() == 0) return 0;
-    double max = values[0];
-    for (int i = 1; i < values.getSize(); ++i) {
-        if (values[i] > max) max = values[i];
+// Returns the shared compiled program
+const shared_ptr<const FormulaProgram>& FormulaCell::getProgram() const {
+    return program;
+}
+
+// The copy shares the program; it is changed instead of the original while a snapshot reads that
+shared_ptr<FormulaCell> FormulaCell::clone() const {
+    auto copy = make_shared<FormulaCell>(program, "", spreadsheet, row, col);
+    copy->resultKind = resultKind;
+    copy->resultValue = resultValue;
+    copy->dirty = dirty;
+    if (aggregateState) {
+        *copy->aggregateState = *aggregateState;
     }
-    return max;
+    return copy;
 }
 
-// Finds the minimum value in the provided range
-double FormulaCell::calculateMin(const DynamicArray<double>& values) const {
-    if (values.getSize() == 0) return 0;
-    double min = values[0];
-    for (int i = 1; i < values.getSize(); ++i) {
-        if (values[i] < min) min = values[i];
+// Reads the numeric value of a cell the same way for full scans and for deltas
+// Empty and non-numeric cells are skipped by aggregates
+bool FormulaCell::readNumber(const Cell* cell, double& value) {
+    return cell && cell->getNumber(value);
+}
+
+// Scans the range once and rebuilds the running aggregate state (count, sum, mean, deviations, min, max)
+void FormulaCell::scanRange() const {
+    int startRow, startCol, endRow, endCol;
+    getRange(startRow, startCol, endRow, endCol);
+
+    AggregateState& state = *aggregateState;
+    state.count = 0;
+    state.sum = 0;
+    state.mean = 0;
+    state.squaredDeviations = 0;
+    state.deviationError = 0;
+    state.min = 0;
+    state.max = 0;
+    state.deltasSinceScan = 0;
+
+    // Iterate through the specified range and accumulate the numeric values
+    spreadsheet->scanNumbers(startRow, startCol, endRow, endCol, [this](double value) {
+        addToAggregate(value);
+    });
+    state.valid = true;
+}
+
+// Adds one value to the running aggregate state
+void FormulaCell::addToAggregate(double value) const {
+    AggregateState& state = *aggregateState;
+    if (state.count == 0 || value < state.min) state.min = value;
+    if (state.count == 0 || value > state.max) state.max = value;
+    ++state.count;
+    state.sum += value;
+    double delta = value - state.mean;
+    state.mean += delta / state.count;
+    double step = delta * (value - state.mean);
+    state.squaredDeviations += step;
+    state.deviationError += fabs(step) * DEVIATION_ROUNDING;
+}
+
+// Takes one value out of the running state; min and max are left to the caller
+void FormulaCell::removeFromAggregate(double value) const {
+    AggregateState& state = *aggregateState;
+    --state.count;
+    state.sum -= value;
+    if (state.count == 0) {
+        state.mean = 0;
+        state.squaredDeviations = 0;
+        return;
+    }
+    // Reverses the Welford step that added the value
+    double oldMean = state.mean;
+    state.mean -= (value - oldMean) / state.count;
+    double step = (value - oldMean) * (value - state.mean);
+    state.squaredDeviations -= step;
+    state.deviationError += fabs(step) * DEVIATION_ROUNDING;
+}
+
+// Computes the function result (SUM, AVER, MAX, MIN, STDDEV) from the running state
+double FormulaCell::aggregateResult() const {
+    const AggregateState& state = *aggregateState;
+    switch (program->getAggregate()) {
+        case FormulaProgram::Aggregate::Sum:
+            return state.sum;
+        case FormulaProgram::Aggregate::Average:
+            return state.count == 0 ? 0 : state.sum / state.count;
+        case FormulaProgram::Aggregate::Max:
+            return state.count == 0 ? 0 : state.max;
+        case FormulaProgram::Aggregate::Min:
+            return state.count == 0 ? 0 : state.min;
+        case FormulaProgram::Aggregate::StdDev: {
+            if (state.count <= 1) return 0;
+            // Rounding may still leave a tiny negative sum where the true one is 0
+            return sqrt(max(state.squaredDeviations, 0.0) / state.count);
+        }
+        default:
+            throw runtime_error("Unknown function");
     }
-    return min;
 }
 
+// Updates the result in O(1) when one cell inside the range changes from oldValue to newValue
+// Returns false when the state cannot be updated; the caller then recalculates the formula
+bool FormulaCell::applyDelta(bool hadOld, double oldValue, bool hasNew, double newValue) {
+    if (!aggregateState || !aggregateState->valid || dirty) return false;
+    AggregateState& state = *aggregateState;
+    FormulaProgram::Aggregate aggregate = program->getAggregate();
 
+    // Rescan from time to time so rounding errors of the running sums cannot pile up
+    if (++state.deltasSinceScan > MAX_DELTAS_BEFORE_RESCAN) {
+        state.valid = false;
+        return false;
+    }
 
-// Calculates the standard deviation of a given set of values.
-double FormulaCell::calculateStdDev(const DynamicArray<double>& values) const {
-    if (values.getSize() <= 1) return 0;
-    
-    double sum = 0, squareSum = 0;
-    for (int i = 0; i < values.getSize(); ++i) {
-        sum += values[i];
-        squareSum += values[i] * values[i];
+    if (hadOld) {
+        // Removing the current extremum needs a rescan to find the next one
+        if ((aggregate == FormulaProgram::Aggregate::Max && oldValue >= state.max) ||
+            (aggregate == FormulaProgram::Aggregate::Min && oldValue <= state.min)) {
+            state.valid = false;
+            return false;
+        }
+        removeFromAggregate(oldValue);
+    }
+    if (hasNew) {
+        addToAggregate(newValue);
     }
-    
-    double mean = sum / values.getSize();
-    return sqrt(squareSum / values.getSize() - mean * mean);
+    // Once most of the values were taken out again, what is left of the squared deviations may
+    // be rounding error (e.g. big values replaced by equal ones), so a scan computes it exactly
+    if (aggregate == FormulaProgram::Aggregate::StdDev && state.squaredDeviations <= state.deviationError) {
+        state.valid = false;
+        return false;
+    }
+
+    setResult(RESULT_NUMBER, aggregateResult());
+    return true;
+}
+
+// Reports the absolute range bounds of a function formula
+bool FormulaCell::getRange(int& startRow, int& startCol, int& endRow, int& endCol) const {
+    if (program->getKind() != FormulaProgram::Kind::Aggregate) return false;
+    program->getRangeOffsets(startRow, startCol, endRow, endCol);
+    startRow += row;
+    startCol += col;
+    endRow += row;
+    endCol += col;
+    return true;
 }
 
 // Evaluates the formula stored in the FormulaCell.
 // Supports various functions such as SUM, AVER, MAX, MIN, and STDDEV.
 // If a formula starts with '=', it will be treated as an arithmetic expression.
 void FormulaCell::evaluate() {
-    try {
-        if (formula.empty()) { // If the formula is empty, return an empty result
-            computedValue = "";
-            return;
-        }
+    computeValue();
+}
 
-        // If the formula is a function (e.g., @SUM(A1..B2)), parse and evaluate it
-        if (isFunction(formula)) {
-            auto [funcName, range] = parseFunctionAndRange(formula);
-            auto [start, end] = parseRange(range);
-            auto values = getValuesFromRange(start, end);
-            
-            double result = 0;
-            // Check for supported functions and perform the appropriate calculation
-            if (funcName == "SUM" || funcName == "Sum") {
-                result = calculateSum(values);
-            } else if (funcName == "AVER" || funcName == "Aver") {
-                result = calculateAverage(values);
-            } else if (funcName == "MAX" || funcName == "Max") {
-                result = calculateMax(values);
-            } else if (funcName == "MIN" || funcName == "Min") {
-                result = calculateMin(values);
-            } else if (funcName == "STDDEV" || funcName == "Stddev") {
-                result = calculateStdDev(values);
+// Refreshes the cached result; const so that getContent() can update a dirty cell on read
+void FormulaCell::computeValue() const {
+    // Reaching a cell that is already being evaluated means the formula refers back to itself
+    if (evaluating) {
+        throw runtime_error("Circular reference");
+    }
+    evaluating = true;
+    try {
+        computeDirtyInputs();
+    } catch (...) {
+        evaluating = false;
+        throw;
+    }
+    computeResult();
+    dirty = false;
+    evaluating = false;
+}
+
+// Walks the dirty formulas this one reads with an explicit stack, so a long chain of references
+// cannot overflow the call stack, and computes each one after its own dirty inputs
+// A formula is marked evaluating while its inputs are walked; reaching one again is a circular
+// reference, which is left for computeResult() to report as #ERROR like a recursive read would
+// Positions are kept instead of cells, so in paged mode only the walked path stays in memory
+void FormulaCell::computeDirtyInputs() const {
+    struct PendingFormula {
+        int row, col;
+        bool expanded; // Its inputs were pushed; it is computed once they are done
+    };
+    DynamicArray<PendingFormula> stack;
+    DynamicArray<pair<int, int>> inputs;
+
+    appendDirtyInputs(inputs);
+    for (int i = inputs.getSize() - 1; i >= 0; --i) {
+        stack.pushBack({inputs[i].first, inputs[i].second, false});
+    }
+    try {
+        while (stack.getSize() > 0) {
+            int top = stack.getSize() - 1;
+            PendingFormula pending = stack[top];
+            shared_ptr<Cell> cell = spreadsheet->getCell(pending.row, pending.col);
+            auto formulaCell = dynamic_cast<const FormulaCell*>(cell.get());
+            if (pending.expanded) {
+                stack.removeAt(top);
+                if (formulaCell) {
+                    formulaCell->computeResult();
+                    formulaCell->dirty = false;
+                    formulaCell->evaluating = false;
+                }
+            } else if (!formulaCell || !formulaCell->dirty || formulaCell->evaluating) {
+                stack.removeAt(top); // Already computed, or a circular reference
             } else {
-                throw runtime_error("Unknown function: " + funcName); // Error if the function is unsupported
+                stack[top].expanded = true;
+                formulaCell->evaluating = true;
+                inputs.clear();
+                formulaCell->appendDirtyInputs(inputs);
+                for (int i = inputs.getSize() - 1; i >= 0; --i) {
+                    stack.pushBack({inputs[i].first, inputs[i].second, false});
+                }
             }
-
-           // Convert the result to a formatted string with 2 decimal places 
-            ostringstream oss;
-            oss << fixed << setprecision(2) << result;
-            computedValue = oss.str();
-            return;
-        }
-
-        // If the formula starts with '=', treat it as a mathematical expression
-        if (formula[0] == '=') {
-            DynamicArray<string> tokens;
-            tokenize(formula.substr(1), tokens); // Tokenize the expression after '='
-            double result = evaluateExpression(tokens); // Evaluate the expression
-            ostringstream oss;
-            oss << fixed << setprecision(2) << result;
-            computedValue = oss.str();
-            return;
         }
-         // If it's not a formula, treat it as a plain value
-        computedValue = formula;
     } catch (...) {
-        computedValue = "#ERROR";
-    }
-}
-
-// Rest of the implementation remains the same as in the previous version: tokenize
-void FormulaCell::tokenize(const string& formula, DynamicArray<string>& tokens) const {
-    string token;
-    bool inFunction = false; // Flag to track whether the parser is inside a function call
-    
-    // Loop through each character in the formula string
-    for (size_t i = 0; i < formula.length(); ++i) {
-        char ch = formula[i];
-        
-        // If the character is '@', it signals the start of a function call
-        if (ch == '@') {
-            // If a token was already being built, push it to the token array
-            if (!token.empty()) {
-                tokens.pushBack(token);
-                token.clear();
-            }
-            inFunction = true; // Set the function flag and start collecting the function call
-            token += ch;
-            // Continue collecting characters until the closing parenthesis of the function
-        } else if (inFunction) {
-            token += ch;
-            if (ch == ')') {
-                tokens.pushBack(token);
-                token.clear();
-                inFunction = false; // Exit function parsing mode
+        // The formulas on the walked path stay dirty and can be computed again later
+        for (int i = 0; i < stack.getSize(); ++i) {
+            if (stack[i].expanded) {
+                auto formulaCell = dynamic_cast<const FormulaCell*>(spreadsheet->peekCell(stack[i].row, stack[i].col));
+                if (formulaCell) formulaCell->evaluating = false;
             }
-        // If the character is a whitespace, push the current token if it's non-empty
-        } else if (isspace(ch)) {
-            if (!token.empty()) {
-                tokens.pushBack(token);
-                token.clear();
-            }
-        // If the character is an arithmetic operator, push the current token and the operator
-        } else if (ch == '+' || ch == '-' || ch == '*' || ch == '/') {
-            if (!token.empty()) {
-                tokens.pushBack(token);
-                token.clear();
-            }
-            tokens.pushBack(string(1, ch));  // Push the operator as a separate token
-        } 
-        // For all other characters, continue building the token
-        else {
-            token += ch;
         }
-    }
-    // If there's any leftover token, push it to the token list
-    if (!token.empty()) {
-        tokens.pushBack(token);
+        throw;
     }
 }
 
-// Evaluates a mathematical expression from a sequence of tokens
-double FormulaCell::evaluateExpression(const DynamicArray<string>& tokens) const {
-    double result = 0;
-    string currentOp; // To keep track of the current operator being processed
-
-    // Iterate through each token in the provided list
-    for (int i = 0; i < tokens.getSize(); ++i) {
-        const string& token = tokens[i];
-        // If the token is an operator, store it for the next operation
-        if (isOperator(token)) {
-            currentOp = token;
-        } 
-        // If the token is a number or cell reference, evaluate its value
-        else {
-            double value = isCellReference(token) ? fetchValueFromReference(token) : stod(token);
-            // If no operator has been set yet, initialize the result with the current value
-            if (currentOp.empty()) {
-                result = value;
-            } 
-            // If there's an operator stored, apply it with the current value and result
-            else {
-                result = applyOperator(result, value, currentOp);
-            }
+// Single references and the cells of the range; cells outside the sheet are skipped
+void FormulaCell::appendDirtyInputs(DynamicArray<pair<int, int>>& inputs) const {
+    if (!spreadsheet) return;
+    const auto& offsets = program->getReferenceOffsets();
+    for (int i = 0; i < offsets.getSize(); ++i) {
+        int refRow = row + offsets[i].first, refCol = col + offsets[i].second;
+        auto formulaCell = dynamic_cast<const FormulaCell*>(spreadsheet->getCell(refRow, refCol).get());
+        if (formulaCell && formulaCell->dirty) {
+            inputs.pushBack(make_pair(refRow, refCol));
         }
     }
-
-    return result;
+    int startRow, startCol, endRow, endCol;
+    if (getRange(startRow, startCol, endRow, endCol)) {
+        spreadsheet->collectDirtyFormulas(startRow, startCol, endRow, endCol, inputs);
+    }
 }
 
-// Updates the dependencies of the current FormulaCell based on the formula content
-void FormulaCell::updateDependencies() {
-    dependencies.clear(); // Clear previous dependencies before recalculating
-    
-    // If the formula is empty or not a formula/function, skip further processing
-    if (formula.empty() || (formula[0] != '=' && formula[0] != '@')) return;
-
-    // Tokenize the formula, ignoring the first character ('=' or '@')
-    DynamicArray<string> tokens;
-    tokenize(formula.substr(1), tokens);
-
-    // Identify cell references within the tokenized formula
-    for (int i = 0; i < tokens.getSize(); ++i) {
-        if (isCellReference(tokens[i])) {
-            int row, col;
-            // Parse the cell reference and add it to the dependencies list
-            spreadsheet->parseCellReference(tokens[i], row, col);
-            dependencies.pushBack(make_pair(row, col));
+// Computes the result of the formula, or an error if it cannot be evaluated
+// The number is kept as it is; it is only turned into text when it is shown or written out
+void FormulaCell::computeResult() const {
+    if (aggregateState) {
+        aggregateState->valid = false;
+    }
+    try {
+        switch (program->getKind()) {
+            case FormulaProgram::Kind::Empty: // If the formula is empty, return an empty result
+                setResult(RESULT_EMPTY, 0);
+                break;
+            case FormulaProgram::Kind::Aggregate:
+                scanRange(); // Rebuild the running state used by later deltas
+                setResult(RESULT_NUMBER, aggregateResult());
+                break;
+            case FormulaProgram::Kind::Expression:
+                setResult(RESULT_NUMBER, evaluateExpression());
+                break;
+            case FormulaProgram::Kind::Text: // If it's not a formula, treat it as a plain value
+                setResult(RESULT_TEXT, 0);
+                break;
+            default:
+                setResult(RESULT_ERROR, 0);
+                break;
         }
+    } catch (...) {
+        setResult(RESULT_ERROR, 0);
+    }
+}
+
+// Evaluates the compiled expression left to right, without operator precedence
+double FormulaCell::evaluateExpression() const {
+    double result = 0;
+    const auto& steps = program->getSteps();
+    for (int i = 0; i < steps.getSize(); ++i) {
+        const ProgramStep& step = steps[i];
+        double value = step.isReference ? fetchValueAt(row + step.rowOffset, col + step.colOffset)
+                                        : step.constant;
+        // An operand before any operator initializes the result
+        result = step.op == '\0' ? value : FormulaProgram::applyOperator(result, value, step.op);
     }
+    return result;
 }
 
 // Fetches the numeric value from a referenced cell in the spreadsheet
-double FormulaCell::fetchValueFromReference(const string& reference) const {
-    int row, col;
-    // Parse the cell reference (e.g., "A1" -> row, col)
-    spreadsheet->parseCellReference(reference, row, col);
-    
+double FormulaCell::fetchValueAt(int refRow, int refCol) const {
     // Attempt to retrieve the referenced cell
-    auto cell = spreadsheet->getCell(row, col);
+    auto cell = spreadsheet->getCell(refRow, refCol);
     if (!cell) throw runtime_error("Invalid cell reference");
-    // Fetch the content of the cell
-    string content = cell->getContent();
     // Ensure the content can be converted to a numeric value
-    if (!isNumber(content)) throw runtime_error("Non-numeric cell content");
-    // Convert the content to a double and return the value
-    return stod(content);
-}
-
-// Checks if a given token is a mathematical operator (+, -, *, /)
-bool FormulaCell::isOperator(const string& token) const {
-    return token == "+" || token == "-" || token == "*" || token == "/";
-}
-
-// Applies the specified mathematical operator on two numeric operands
-double FormulaCell::applyOperator(double a, double b, const string& op) const {
-    if (op == "+") return a + b;
-    if (op == "-") return a - b;
-    if (op == "*") return a * b;
-    if (op == "/") {
-        if (b == 0) throw runtime_error("Division by zero");
-        return a / b;
-    }
-    throw runtime_error("Unknown operator");
-}
-
-// Returns the list of cell dependencies for the current formula
-const DynamicArray<pair<int, int>>& FormulaCell::getDependencies() const {
-    return dependencies;
-}
-
-
-// Determines if a given token is a valid cell reference (e.g., A1, B2)
-bool FormulaCell::isCellReference(const string& token) const {
-    if (token.empty()) return false;
-    
-    size_t i = 0;
-
-    // Ensure the token starts with one or more alphabetical characters
-    while (i < token.size() && isalpha(token[i])) ++i;
-    if (i == 0 || i >= token.size()) return false;
-    // Ensure the remaining part of the token consists of digits
-    while (i < token.size() && isdigit(token[i])) ++i;
-    // Return true only if the entire token was validated
-    return i == token.size();
+    double value;
+    if (!readNumber(cell.get(), value)) throw runtime_error("Non-numeric cell content");
+    return value;
 }
 
-// Checks if a string can be converted to a numeric value
-bool FormulaCell::isNumber(const string& token) const {
-    try {
-        if (token.empty()) return false;
-        stod(token); // Attempt to convert to a double
-        return true;
-    } catch (...) {
-        // Return false if conversion fails
-        return false;
+// Appends the absolute positions of the referenced cells (ranges are reported by getRange)
+void FormulaCell::getDependencies(DynamicArray<pair<int, int>>& dependencies) const {
+    const auto& offsets = program->getReferenceOffsets();
+    for (int i = 0; i < offsets.getSize(); ++i) {
+        dependencies.pushBack(make_pair(row + offsets[i].first, col + offsets[i].second));
     }
 }
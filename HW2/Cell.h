@@ -12,6 +12,8 @@
 #include<stdexcept>
 #include "Spreadsheet.h"
 #include "Custom1DArray.h"
+#include "FormulaProgram.h"
+#include "NumberFormat.h"
 
 using namespace std;
 
@@ -26,6 +28,15 @@ class Cell{
         virtual string getContent() const = 0; // Returns formatted cell content
         virtual void setContent(const string &cont) = 0; // Sets cell content
         virtual string getRawContent() const = 0; // Returns unformatted content
+        // Reads the displayed content as a number; returns false for empty or non-numeric content
+        virtual bool getNumber(double& value) const;
+        // Reads displayed content the way getNumber() does, e.g. for a label that is not a cell
+        static bool parseNumber(const string& text, double& value);
+        // Appends the displayed content to 'out' without building a temporary string
+        virtual void appendContent(string& out) const;
+        // Appends the content as a column showing 'precision' decimals displays and exports it
+        // Only decimal values and formula results depend on the precision
+        virtual void appendFormatted(string& out, int precision) const;
 
         // Position management
         void setPosition(int r, int c); // Sets cell position in spreadsheet
@@ -51,6 +62,7 @@ public:
     string getRawContent() const override { return content; }
     string getContent() const override;
     void setContent(const string &kontent) override;
+    void appendContent(string& out) const override;
 };
 
 // Specialized cell for string values
@@ -62,11 +74,14 @@ public:
 // Specialized cell for integer values
 class IntValueCell : public ValueCell {
 public:
-    explicit IntValueCell(int initialValue = 0);
+    explicit IntValueCell(long long initialValue = 0);
     void setContent(const string &content) override;
     string getContent() const override;
+    bool getNumber(double& value) const override; // Returns the integer without formatting it
+    void appendContent(string& out) const override; // Formats the integer with to_chars
+    long long getValue() const; // Returns the stored integer
 private:
-    int intValue; // Stores parsed integer value
+    long long intValue; // Stores parsed 64-bit integer value
 };
 
 // Specialized cell for floating-point values
@@ -75,55 +90,120 @@ public:
     explicit DoubleValueCell(double initialValue = 0.0);
     void setContent(const string& content) override;
     string getContent() const override;
+    bool getNumber(double& value) const override; // Returns the value rounded like getContent()
+    static bool displayedNumber(double stored, double& value); // Rounds a stored value like getNumber()
+    void appendContent(string& out) const override; // Formats 2 decimals with to_chars
+    void appendFormatted(string& out, int precision) const override; // Formats 'precision' decimals
+    double getValue() const; // Returns the stored value without rounding
 private:
     double doubleValue; // Stores parsed double value
 };
 
 
 // Complex cell type supporting formula evaluation
+// The formula itself lives in a shared FormulaProgram; the cell only keeps its position
+// (the offset the program's relative references are applied to) and its result
 class FormulaCell : public Cell {
 private:
-    string formula;  // Stores the raw formula
-    string computedValue;  // Cached computed result
-    shared_ptr<GTUSpreadsheet::Spreadsheet> spreadsheet;
-    DynamicArray<pair<int, int>> dependencies;  // Tracks cell dependencies
-
-    // Formula parsing methods
-    bool isFunction(const string& content) const; // Checks if content is a function (SUM, AVG etc)
-    pair<string, string> parseFunctionAndRange(const string& content) const; // Splits function and range
-    pair<string, string> parseRange(const string& range) const; // Parses cell range (e.g. A1:B5)
-    DynamicArray<double> getValuesFromRange(const string& start, const string& end) const; // Gets values from range
-
-    // Mathematical functions
-    double calculateSum(const DynamicArray<double>& values) const;
-    double calculateAverage(const DynamicArray<double>& values) const;
-    double calculateMax(const DynamicArray<double>& values) const;
-    double calculateMin(const DynamicArray<double>& values) const;
-    double calculateStdDev(const DynamicArray<double>& values) const;
+    shared_ptr<const FormulaProgram> program; // Compiled formula, shared by cells of the same shape
+
+    // Kind of the last result; only a number is stored, the text is made when it is shown
+    enum ResultKind : unsigned char {
+        RESULT_EMPTY,   // Empty formula
+        RESULT_NUMBER,  // resultValue
+        RESULT_ERROR,   // #ERROR
+        RESULT_TEXT     // Not a formula: the raw text is shown
+    };
+    mutable ResultKind resultKind; // Kind of the cached result
+    mutable double resultValue;    // Cached result of a numeric formula, not rounded
+    mutable bool dirty;       // True when the cached result is stale and must be recomputed on read
+    mutable bool evaluating;  // Guards against circular references during evaluation
+    mutable unsigned resultVersion; // Changes with every new result, so text made from an older one is known stale
+
+    // Aggregate functions keep a running state so that one changed input costs O(1)
+    // Only allocated for '@' formulas
+    struct AggregateState {
+        bool valid;           // True when the running state matches the range
+        int count;            // Number of numeric cells in the range
+        int deltasSinceScan;  // Deltas applied since the last full scan
+        double sum, min, max;
+        // Welford's running mean and sum of squared deviations from it, for STDDEV
+        // They stay accurate under deltas, where sum of squares minus squared mean cancels out
+        double mean, squaredDeviations;
+        double deviationError; // Bound of the rounding error in squaredDeviations
+    };
+    static const int MAX_DELTAS_BEFORE_RESCAN = 4096; // Bounds the rounding drift of the running sums
+    static constexpr double DEVIATION_ROUNDING = 1e-14; // Rounding error of one Welford step, relative to its size
+    mutable unique_ptr<AggregateState> aggregateState;
+
+    void compile(const string& formula); // Fetches the shared program for the formula at this position
+    void adoptProgram(shared_ptr<const FormulaProgram> compiled); // Uses the program and sets up its state
+    void computeValue() const; // Evaluates the formula into the cached result and clears the dirty flag
+    void computeDirtyInputs() const; // Computes the dirty formulas this one reads, inputs first, without recursion
+    void appendDirtyInputs(DynamicArray<pair<int, int>>& inputs) const; // Positions of the dirty formulas it reads
+    void computeResult() const; // Sets the cached result to the formula's value or to an error
+    void setResult(ResultKind kind, double value) const; // Stores a result and advances the version
+
+    void scanRange() const; // Rebuilds the running state from the range
+    void addToAggregate(double value) const; // Adds one value to the running state
+    void removeFromAggregate(double value) const; // Takes one value out of the running state
+    double aggregateResult() const; // Computes SUM, AVER, MAX, MIN or STDDEV from the running state
 
     // Expression evaluation helpers
-    void tokenize(const string& formula, DynamicArray<string>& tokens) const; // Splits formula into tokens
-    double evaluateExpression(const DynamicArray<string>& tokens) const; // Evaluates expression
-    double fetchValueFromReference(const string& reference) const; // Gets value from cell reference
-    bool isOperator(const string& token) const; // Checks if token is an operator
-    bool isCellReference(const string& token) const; // Checks if token is cell reference
-    bool isNumber(const string& token) const; // Checks if token is numeric
-    double applyOperator(double a, double b, const string& op) const; // Applies arithmetic operator
+    double evaluateExpression() const; // Runs the steps of the program left to right
+    double fetchValueAt(int refRow, int refCol) const; // Gets the numeric value of a referenced cell
 
 public:
-    // Constructs a formula cell with initial formula and reference to parent spreadsheet
-    FormulaCell(const string& formula, shared_ptr<GTUSpreadsheet::Spreadsheet> spreadsheet);
+    // Constructs a formula cell at (row, col) with initial formula and reference to parent spreadsheet
+    FormulaCell(const string& formula, shared_ptr<GTUSpreadsheet::Spreadsheet> spreadsheet, int row, int col);
+    // Restores a formula cell from an already compiled program and its saved result (as written by
+    // getStoredResult, or the displayed text of older files), without evaluating
+    FormulaCell(shared_ptr<const FormulaProgram> program, const string& cachedValue,
+                shared_ptr<GTUSpreadsheet::Spreadsheet> spreadsheet, int row, int col);
     string getContent() const override; // Returns computed result
+    void appendContent(string& out) const override; // Appends the computed result, evaluating it if stale
+    void appendFormatted(string& out, int precision) const override; // Same with 'precision' decimals
+    bool getNumber(double& value) const override; // Returns the result rounded like getContent(), without text
     string getRawContent() const override; // Returns raw formula
     void setContent(const string& content) override; // Sets a new formula and triggers recalculation
     // Evaluates the formula and updates the computed value
     // Called when formula or dependent cells change
     void evaluate();
-    // Returns array of cell coordinates (row,col) that this formula depends on
-    const DynamicArray<pair<int, int>>& getDependencies() const;
-    // Analyzes formula and updates the dependency tracking information
-    // Called when formula changes or during initialization
-    void updateDependencies();
+    // Marks the cached result as stale; it is recomputed on the next getContent()
+    void markDirty();
+    // Returns true if the cached result is stale
+    bool isDirty() const;
+    // Returns true while the formula is being computed
+    bool isEvaluating() const;
+    // Returns true if a formula this one reads, directly or in its range, is dirty, and sets
+    // 'input' to the position of one of them
+    bool findDirtyInput(pair<int, int>& input) const;
+    // Appends the last computed result without evaluating, even if it is stale
+    void appendResult(string& out, int precision) const;
+    // Returns the last result as text that restores it exactly (shortest round-trip digits for a
+    // number), for the page file and workbooks; does not evaluate
+    string getStoredResult() const;
+    // Returns a number that changes whenever the result changes
+    unsigned getResultVersion() const;
+    // Stores a result computed outside the cell (by a column kernel) and clears the dirty flag
+    void storeResult(double result);
+    // Stores #ERROR as the result and clears the dirty flag
+    void storeError();
+    // Returns true if the formula reads the cell at (row, col), directly or through its range
+    bool dependsOn(int row, int col) const;
+    // Returns the bounds of the range read by a function formula, or false if there is none
+    bool getRange(int& startRow, int& startCol, int& endRow, int& endCol) const;
+    // Applies the change of one cell in the range (old value -> new value) to an aggregate formula
+    // Returns false if the formula must be recalculated instead (e.g. the MAX was removed)
+    bool applyDelta(bool hadOld, double oldValue, bool hasNew, double newValue);
+    // Reads the numeric value of a cell as the aggregate functions see it
+    static bool readNumber(const Cell* cell, double& value);
+    // Appends the cells (row,col) referenced by this formula, computed from the program's template
+    void getDependencies(DynamicArray<pair<int, int>>& dependencies) const;
+    // Returns the shared compiled program
+    const shared_ptr<const FormulaProgram>& getProgram() const;
+    // Returns a copy with the same program, result, dirty flag and running state
+    shared_ptr<FormulaCell> clone() const;
 };
 
 #endif // CELL_H
@@ -0,0 +1,24 @@
+#ifndef CELLEDITOBSERVER_H
+#define CELLEDITOBSERVER_H
+
+#include <string>
+
+namespace GTUSpreadsheet {
+
+// Interface for objects that follow the edits of a spreadsheet (e.g. the edit journal)
+// Only content entered through setCellContent and the decimals set for a column are reported;
+// loading a file is not an edit
+class CellEditObserver {
+public:
+    virtual ~CellEditObserver() = default;
+
+    // Called after the content of (row, col) was replaced; an empty content clears the cell
+    virtual void onCellEdited(int row, int col, const std::string& content) = 0;
+
+    // Called after the decimals shown for a column changed
+    virtual void onColumnPrecisionChanged(int col) = 0;
+};
+
+} // namespace GTUSpreadsheet
+
+#endif // CELLEDITOBSERVER_H
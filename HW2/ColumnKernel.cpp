@@ -0,0 +1,73 @@
+#include "ColumnKernel.h"
+
+// Allocates the result, operand and state arrays; every lane starts at 0 like evaluateExpression()
+ColumnKernel::ColumnKernel(int runLength)
+    : length(runLength),
+      results(new double[runLength]()),
+      operands(new double[runLength]()),
+      states(new unsigned char[runLength]()) {}
+
+// Only arithmetic expressions with at least one operand are evaluated as columns
+bool ColumnKernel::supports(const FormulaProgram& program) {
+    return program.getKind() == FormulaProgram::Kind::Expression && program.getSteps().getSize() > 0;
+}
+
+double* ColumnKernel::operandBuffer() {
+    return operands.get();
+}
+
+// States are flags so that a deferred lane is never reported as an error
+void ColumnKernel::setLaneState(int lane, LaneState state) {
+    states[lane] |= state;
+}
+
+void ColumnKernel::fillConstant(double value) {
+    double* operand = operands.get();
+    for (int i = 0; i < length; ++i) {
+        operand[i] = value;
+    }
+}
+
+// Each case is a straight loop over contiguous arrays with no branches in its body,
+// so it vectorizes; a division by zero only flags the lane, the quotient is ignored
+void ColumnKernel::applyOperand(char op) {
+    double* result = results.get();
+    const double* operand = operands.get();
+    unsigned char* state = states.get();
+
+    switch (op) {
+        case '\0':
+            for (int i = 0; i < length; ++i) result[i] = operand[i];
+            break;
+        case '+':
+            for (int i = 0; i < length; ++i) result[i] += operand[i];
+            break;
+        case '-':
+            for (int i = 0; i < length; ++i) result[i] -= operand[i];
+            break;
+        case '*':
+            for (int i = 0; i < length; ++i) result[i] *= operand[i];
+            break;
+        case '/':
+            for (int i = 0; i < length; ++i) state[i] |= (operand[i] == 0) ? LANE_ERROR : LANE_OK;
+            for (int i = 0; i < length; ++i) result[i] /= operand[i];
+            break;
+        default:
+            for (int i = 0; i < length; ++i) state[i] |= LANE_ERROR;
+            break;
+    }
+}
+
+int ColumnKernel::getLength() const {
+    return length;
+}
+
+double ColumnKernel::getResult(int lane) const {
+    return results[lane];
+}
+
+// Deferred wins over error: the scalar evaluator decides once the inputs are ready
+ColumnKernel::LaneState ColumnKernel::getLaneState(int lane) const {
+    if (states[lane] & LANE_DEFERRED) return LANE_DEFERRED;
+    return (states[lane] & LANE_ERROR) ? LANE_ERROR : LANE_OK;
+}
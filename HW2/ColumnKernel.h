@@ -0,0 +1,55 @@
+#ifndef COLUMNKERNEL_H
+#define COLUMNKERNEL_H
+
+// Evaluates one arithmetic program over a run of rows at once
+// The operands of every lane are stored in plain double arrays and each operator is applied
+// in a single loop over the whole run, which the compiler turns into SIMD instructions
+
+#include <memory>
+#include "FormulaProgram.h"
+
+using namespace std;
+
+class ColumnKernel {
+public:
+    // Outcome of one lane (one row of the run)
+    enum LaneState : unsigned char {
+        LANE_OK = 0,       // The result is valid
+        LANE_ERROR = 1,    // The formula evaluates to #ERROR (missing input or division by zero)
+        LANE_DEFERRED = 2  // An input is not computed yet; the cell is left to the scalar evaluator
+    };
+
+    // Runs shorter than this are cheaper to evaluate cell by cell
+    static const int MIN_RUN = 8;
+
+    // Creates a kernel for a run of 'length' rows
+    explicit ColumnKernel(int length);
+
+    // Returns true if the program is an arithmetic expression the kernel can evaluate
+    static bool supports(const FormulaProgram& program);
+
+    // Buffer the caller fills with the operand of every lane before applyOperand()
+    double* operandBuffer();
+
+    // Marks a lane as failed; a deferred lane stays deferred
+    void setLaneState(int lane, LaneState state);
+
+    // Fills the operand buffer with the same constant for every lane
+    void fillConstant(double value);
+
+    // Combines the running results with the operands: result = result op operand
+    // '\0' replaces the running result, like the first operand of an expression
+    void applyOperand(char op);
+
+    int getLength() const;
+    double getResult(int lane) const;
+    LaneState getLaneState(int lane) const;
+
+private:
+    int length;
+    unique_ptr<double[]> results;
+    unique_ptr<double[]> operands;
+    unique_ptr<unsigned char[]> states; // Bit set of LaneState flags
+};
+
+#endif // COLUMNKERNEL_H
@@ -0,0 +1,187 @@
+#include "CsvTokenizer.h"
+#include <algorithm>
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace Utils {
+
+// Starts before the first block; nextField() scans it on demand
+CsvTokenizer::CsvTokenizer(std::string_view csv)
+    : text(csv), blockStart(0), boundaries(0), quoteCarry(0), fieldStart(0),
+      started(false), inRecord(false), finished(false) {}
+
+// Compares 64 bytes against one character, 16 at a time with SSE2
+std::uint64_t CsvTokenizer::matchMask(const char* block, char ch) {
+#if defined(__SSE2__)
+    const __m128i pattern = _mm_set1_epi8(ch);
+    std::uint64_t mask = 0;
+    for (int i = 0; i < 4; ++i) {
+        __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block + 16 * i));
+        std::uint64_t bits = static_cast<std::uint16_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, pattern)));
+        mask |= bits << (16 * i);
+    }
+    return mask;
+#else
+    std::uint64_t mask = 0;
+    for (std::size_t i = 0; i < BLOCK_SIZE; ++i) {
+        mask |= static_cast<std::uint64_t>(block[i] == ch) << i;
+    }
+    return mask;
+#endif
+}
+
+// Finds the commas and line breaks of the block that are outside quoted fields
+// The last block is copied into a zero-padded buffer so every block is read as 64 bytes
+void CsvTokenizer::scanBlock() {
+    const char* block = text.data() + blockStart;
+    char padded[BLOCK_SIZE];
+    if (text.size() - blockStart < BLOCK_SIZE) {
+        std::memset(padded, 0, BLOCK_SIZE);
+        std::memcpy(padded, block, text.size() - blockStart);
+        block = padded;
+    }
+
+    std::uint64_t quotes = matchMask(block, '"');
+    std::uint64_t separators = matchMask(block, ',') | matchMask(block, '\n');
+
+    std::uint64_t inside = insideQuotes(quotes, quoteCarry);
+    quoteCarry = 0 - (inside >> 63); // Carry the state of the last byte into the next block
+
+    boundaries = separators & ~inside;
+}
+
+// Prefix XOR: bit i is the parity of the quotes at positions <= i, i.e. "inside quotes"
+std::uint64_t CsvTokenizer::insideQuotes(std::uint64_t quotes, std::uint64_t carry) {
+    std::uint64_t inside = quotes;
+    inside ^= inside << 1;
+    inside ^= inside << 2;
+    inside ^= inside << 4;
+    inside ^= inside << 8;
+    inside ^= inside << 16;
+    inside ^= inside << 32;
+    return inside ^ carry;
+}
+
+// Same classification as scanBlock, with only the line breaks kept
+// A call that fills 'ends' in the middle of a block resumes after the last line break it stored,
+// which is outside quotes by definition
+std::size_t CsvTokenizer::findRecordEnds(std::string_view text, std::size_t& from, bool& inQuotes,
+                                         std::size_t* ends, std::size_t maxEnds) {
+    std::size_t found = 0;
+    std::uint64_t carry = inQuotes ? ~0ull : 0;
+    while (from < text.size() && found < maxEnds) {
+        const char* block = text.data() + from;
+        char padded[BLOCK_SIZE];
+        if (text.size() - from < BLOCK_SIZE) {
+            std::memset(padded, 0, BLOCK_SIZE);
+            std::memcpy(padded, block, text.size() - from);
+            block = padded;
+        }
+
+        std::uint64_t inside = insideQuotes(matchMask(block, '"'), carry);
+        std::uint64_t breaks = matchMask(block, '\n') & ~inside;
+        while (breaks != 0 && found < maxEnds) {
+            ends[found++] = from + __builtin_ctzll(breaks) + 1;
+            breaks &= breaks - 1;
+        }
+        if (breaks != 0) {
+            from = ends[found - 1];
+            inQuotes = false;
+            return found;
+        }
+        carry = 0 - (inside >> 63);
+        from = std::min(from + BLOCK_SIZE, text.size());
+    }
+    inQuotes = carry != 0;
+    return found;
+}
+
+// Returns the text up to the next boundary; the last field may end at the end of the text
+bool CsvTokenizer::nextField(std::string_view& field, bool& endOfRecord) {
+    while (boundaries == 0) {
+        if (started) {
+            blockStart += BLOCK_SIZE;
+        }
+        started = true;
+        if (blockStart >= text.size()) {
+            // Text that does not end with a line break still has a last field,
+            // which is empty if the text ends with a comma
+            if (finished || (fieldStart >= text.size() && !inRecord)) {
+                finished = true;
+                return false;
+            }
+            field = text.substr(fieldStart);
+            endOfRecord = true;
+            fieldStart = text.size();
+            finished = true;
+            return true;
+        }
+        scanBlock();
+    }
+
+    std::size_t position = blockStart + __builtin_ctzll(boundaries);
+    boundaries &= boundaries - 1; // Consume the lowest boundary
+    field = text.substr(fieldStart, position - fieldStart);
+    endOfRecord = text[position] == '\n';
+    inRecord = !endOfRecord;
+    fieldStart = position + 1;
+    return true;
+}
+
+// Quoted fields are taken as written between the quotes; the closing quote may only be followed
+// by the trimmed whitespace, and anything after a stray quote is kept as text
+std::string_view CsvTokenizer::decodeField(std::string_view raw, std::string& scratch, bool& quoted) {
+    while (!raw.empty() && (raw.back() == ' ' || raw.back() == '\r')) {
+        raw.remove_suffix(1);
+    }
+    quoted = !raw.empty() && raw.front() == '"';
+    if (!quoted) {
+        return raw;
+    }
+
+    // Common case: "text" with no quotes inside
+    std::string_view inner = raw.substr(1);
+    if (!inner.empty() && inner.back() == '"' && inner.find('"') == inner.size() - 1) {
+        inner.remove_suffix(1);
+        return inner;
+    }
+
+    // Collapse "" into " and drop the closing quote
+    scratch.clear();
+    for (std::size_t i = 0; i < inner.size(); ++i) {
+        if (inner[i] == '"') {
+            if (i + 1 < inner.size() && inner[i + 1] == '"') {
+                scratch += '"';
+                ++i;
+            }
+            continue;
+        }
+        scratch += inner[i];
+    }
+    return scratch;
+}
+
+// A value needs quotes if it contains a delimiter, a quote or a line break, or if the reader
+// would trim it (trailing space)
+bool CsvTokenizer::needsQuotes(std::string_view value) {
+    return value.find_first_of(",\"\r\n") != std::string_view::npos ||
+           (!value.empty() && value.back() == ' ');
+}
+
+// Doubles the quotes inside a quoted value
+void CsvTokenizer::appendField(std::string& line, std::string_view value) {
+    if (!needsQuotes(value)) {
+        line.append(value.data(), value.size());
+        return;
+    }
+    line += '"';
+    for (char ch : value) {
+        if (ch == '"') line += '"';
+        line += ch;
+    }
+    line += '"';
+}
+}
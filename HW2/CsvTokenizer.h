@@ -0,0 +1,64 @@
+#ifndef CSVTOKENIZER_H
+#define CSVTOKENIZER_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace Utils {
+
+// Splits CSV text (RFC 4180) into fields
+// The text is classified 64 bytes at a time: bitmasks of the quotes, commas and line breaks of a
+// block are built with SIMD compares, a prefix XOR of the quote mask marks the bytes inside quotes,
+// and the remaining commas and line breaks are the field boundaries. Fields are views into the text
+class CsvTokenizer {
+private:
+    static const std::size_t BLOCK_SIZE = 64;
+
+    std::string_view text;
+    std::size_t blockStart;     // Offset of the block the boundary mask belongs to
+    std::uint64_t boundaries;   // Unconsumed field boundaries of the current block, one bit per byte
+    std::uint64_t quoteCarry;   // All ones if the previous block ended inside a quoted field
+    std::size_t fieldStart;     // Offset of the next field
+    bool started;               // False until the first block has been scanned
+    bool inRecord;              // True if the last field returned was followed by a comma
+    bool finished;              // True once the last field has been returned
+
+    // Builds the boundary mask of the block at blockStart
+    void scanBlock();
+
+    // Sets one bit per byte of the block that equals the character (SSE2 or scalar)
+    static std::uint64_t matchMask(const char* block, char ch);
+
+    // Returns the mask of the bytes inside quotes, given the quote mask of the block and
+    // whether the previous block ended inside quotes (all ones or zero)
+    static std::uint64_t insideQuotes(std::uint64_t quotes, std::uint64_t carry);
+
+public:
+    // Creates a tokenizer over the text; the text must outlive the tokenizer
+    explicit CsvTokenizer(std::string_view csv);
+
+    // Returns the next raw field (quotes still in place) and whether it ends its record
+    // Returns false when the text is exhausted
+    bool nextField(std::string_view& field, bool& endOfRecord);
+
+    // Finds the line breaks outside quoted fields, 64 bytes at a time, starting at 'from' inside
+    // quotes or not; stores the offset just past each one in 'ends' (at most maxEnds of them)
+    // 'from' and 'inQuotes' are advanced so the next call continues where this one stopped
+    // Returns the number of offsets stored; 0 once the text is exhausted
+    static std::size_t findRecordEnds(std::string_view text, std::size_t& from, bool& inQuotes,
+                                      std::size_t* ends, std::size_t maxEnds);
+
+    // Turns a raw field into its value: trailing spaces and carriage returns are trimmed, and a quoted
+    // field loses its quotes and has doubled quotes collapsed (into 'scratch' if needed)
+    static std::string_view decodeField(std::string_view raw, std::string& scratch, bool& quoted);
+
+    // Returns true if the value would not read back as the same text without quotes
+    static bool needsQuotes(std::string_view value);
+
+    // Appends a field to a CSV line, quoting it if needed
+    static void appendField(std::string& line, std::string_view value);
+};
+}
+
+#endif // CSVTOKENIZER_H
@@ -2,6 +2,7 @@
 #define DYNAMIC1DARRAY_H
 
 #include <stdexcept>
+#include <utility>
 
 // Template class for a dynamic array
 template <class T>
@@ -18,14 +19,30 @@ public:
     // Constructor with an optional initial capacity
     DynamicArray(int initialCapacity = 10);
 
+    // Copy constructor (deep copy of the elements)
+    DynamicArray(const DynamicArray& other);
+
+    // Move constructor (takes over the buffer of the other array)
+    DynamicArray(DynamicArray&& other) noexcept;
+
+    // Copy assignment operator
+    DynamicArray& operator=(const DynamicArray& other);
+
+    // Move assignment operator
+    DynamicArray& operator=(DynamicArray&& other) noexcept;
+
     // Destructor to clean up the allocated memory
     ~DynamicArray();
 
     // Adds a new element to the end of the array
     void pushBack(const T& value);
 
+    // Removes the element at the given index, shifting the following elements left
+    void removeAt(int index);
+
     // Overloaded subscript operator to access elements
     const T& operator[](int index) const;
+    T& operator[](int index);
 
     // Returns the current size of the array
     int getSize() const;
@@ -49,6 +66,50 @@ DynamicArray<T>::DynamicArray(int initialCapacity)
     data = new T[capacity];
 }
 
+// Copy constructor allocates its own buffer and copies every element
+template <class T>
+DynamicArray<T>::DynamicArray(const DynamicArray& other)
+    : capacity(other.capacity), size(other.size) {
+    data = new T[capacity];
+    for (int i = 0; i < size; ++i) {
+        data[i] = other.data[i];
+    }
+}
+
+// Move constructor leaves the other array empty but usable
+template <class T>
+DynamicArray<T>::DynamicArray(DynamicArray&& other) noexcept
+    : data(other.data), capacity(other.capacity), size(other.size) {
+    other.data = nullptr;
+    other.capacity = 0;
+    other.size = 0;
+}
+
+// Copy assignment operator
+template <class T>
+DynamicArray<T>& DynamicArray<T>::operator=(const DynamicArray& other) {
+    if (this != &other) {
+        DynamicArray temp(other);
+        *this = std::move(temp);
+    }
+    return *this;
+}
+
+// Move assignment operator
+template <class T>
+DynamicArray<T>& DynamicArray<T>::operator=(DynamicArray&& other) noexcept {
+    if (this != &other) {
+        delete[] data;
+        data = other.data;
+        capacity = other.capacity;
+        size = other.size;
+        other.data = nullptr;
+        other.capacity = 0;
+        other.size = 0;
+    }
+    return *this;
+}
+
 // Destructor to delete the allocated array
 template <class T>
 DynamicArray<T>::~DynamicArray() {
@@ -71,11 +132,23 @@ void DynamicArray<T>::resize(int newCapacity) {
 template <class T>
 void DynamicArray<T>::pushBack(const T& value) {
     if (size == capacity) {
-        resize(capacity * 2);
+        resize(capacity > 0 ? capacity * 2 : 10);
     }
     data[size++] = value;
 }
 
+// Removes the element at the given index and keeps the order of the rest
+template <class T>
+void DynamicArray<T>::removeAt(int index) {
+    if (index < 0 || index >= size) {
+        throw std::out_of_range("Index out of range");
+    }
+    for (int i = index; i < size - 1; ++i) {
+        data[i] = data[i + 1];
+    }
+    --size;
+}
+
 // Overloaded subscript operator to access elements with bounds checking
 template <class T>
 const T& DynamicArray<T>::operator[](int index) const {
@@ -85,6 +158,15 @@ const T& DynamicArray<T>::operator[](int index) const {
     return data[index];
 }
 
+// Non-const subscript operator with the same bounds checking
+template <class T>
+T& DynamicArray<T>::operator[](int index) {
+    if (index < 0 || index >= size) {
+        throw std::out_of_range("Index out of range");
+    }
+    return data[index];
+}
+
 // Returns the current size of the array
 template <class T>
 int DynamicArray<T>::getSize() const {
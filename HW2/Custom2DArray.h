@@ -3,21 +3,46 @@
 
 #include <memory>
 #include <stdexcept>
+#include <algorithm>
 
 template <typename T>
 class Dynamic2DVector {
 private:
-    std::unique_ptr<std::unique_ptr<T[]>[]> data;
+    // Rows are kept in blocks of BLOCK_ROWS. A copy of the vector shares the blocks, and a block is
+    // copied the first time it is written through a vector that shares it (copy-on-write), so
+    // copying a large grid (e.g. for a snapshot) costs one pointer per block
+    static const int BLOCK_ROWS = 64;
+
+    std::unique_ptr<std::shared_ptr<T[]>[]> blocks;
     int rows;
     int cols;
-    
+
+    static int blockCount(int rowCount) {
+        return (rowCount + BLOCK_ROWS - 1) / BLOCK_ROWS;
+    }
+
+    static std::shared_ptr<T[]> newBlock(int blockCols) {
+        return std::shared_ptr<T[]>(new T[BLOCK_ROWS * blockCols]());
+    }
+
     void allocate(int newRows, int newCols) {
-        data = std::make_unique<std::unique_ptr<T[]>[]>(newRows);
-        for (int i = 0; i < newRows; ++i) {
-            data[i] = std::make_unique<T[]>(newCols);
+        int count = blockCount(newRows);
+        blocks = std::make_unique<std::shared_ptr<T[]>[]>(count > 0 ? count : 1);
+        for (int i = 0; i < count; ++i) {
+            blocks[i] = newBlock(newCols);
         }
     }
 
+    // Returns the block for writing, copying it first if another vector shares it
+    T* writableBlock(int block) {
+        if (blocks[block].use_count() > 1) {
+            std::shared_ptr<T[]> copy = newBlock(cols);
+            std::copy(blocks[block].get(), blocks[block].get() + BLOCK_ROWS * cols, copy.get());
+            blocks[block] = std::move(copy);
+        }
+        return blocks[block].get();
+    }
+
 public:
     // Constructor
     Dynamic2DVector(int initialRows = 21, int initialCols = 8) 
@@ -25,20 +50,19 @@ public:
         allocate(rows, cols);
     }
 
-    // Copy constructor
+    // Copy constructor: shares the blocks until one of the two vectors writes to them
     Dynamic2DVector(const Dynamic2DVector& other) 
         : rows(other.rows), cols(other.cols) {
-        allocate(rows, cols);
-        for (int i = 0; i < rows; ++i) {
-            for (int j = 0; j < cols; ++j) {
-                data[i][j] = other.data[i][j];
-            }
+        int count = blockCount(rows);
+        blocks = std::make_unique<std::shared_ptr<T[]>[]>(count > 0 ? count : 1);
+        for (int i = 0; i < count; ++i) {
+            blocks[i] = other.blocks[i];
         }
     }
 
     // Move constructor
     Dynamic2DVector(Dynamic2DVector&& other) noexcept
-        : data(std::move(other.data)), rows(other.rows), cols(other.cols) {
+        : blocks(std::move(other.blocks)), rows(other.rows), cols(other.cols) {
         other.rows = 0;
         other.cols = 0;
     }
@@ -55,7 +79,7 @@ public:
     // Move assignment operator
     Dynamic2DVector& operator=(Dynamic2DVector&& other) noexcept {
         if (this != &other) {
-            data = std::move(other.data);
+            blocks = std::move(other.blocks);
             rows = other.rows;
             cols = other.cols;
             other.rows = 0;
@@ -75,13 +99,44 @@ public:
             return;
         }
 
+        // Never shrink a dimension: growing only the rows must keep every column
+        newRows = std::max(newRows, rows);
+        newCols = std::max(newCols, cols);
+
+        // Added rows only need new blocks; the existing ones are kept as they are
+        if (newCols == cols) {
+            int oldCount = blockCount(rows);
+            int newCount = blockCount(newRows);
+            if (newCount > oldCount) {
+                auto grown = std::make_unique<std::shared_ptr<T[]>[]>(newCount);
+                for (int i = 0; i < oldCount; ++i) {
+                    grown[i] = std::move(blocks[i]);
+                }
+                for (int i = oldCount; i < newCount; ++i) {
+                    grown[i] = newBlock(cols);
+                }
+                blocks = std::move(grown);
+            }
+            rows = newRows;
+            return;
+        }
+
         // Create new array with expanded dimensions
         Dynamic2DVector<T> temp(newRows, newCols);
 
-        // Copy existing data
-        for (int i = 0; i < rows; ++i) {
-            for (int j = 0; j < cols; ++j) {
-                temp.data[i][j] = std::move(data[i][j]);
+        // Copy existing data; elements of blocks that no other vector shares are moved
+        for (int b = 0; b < blockCount(rows); ++b) {
+            bool shared = blocks[b].use_count() > 1;
+            T* source = blocks[b].get();
+            T* target = temp.blocks[b].get();
+            for (int r = 0; r < BLOCK_ROWS && b * BLOCK_ROWS + r < rows; ++r) {
+                for (int j = 0; j < cols; ++j) {
+                    if (shared) {
+                        target[r * newCols + j] = source[r * cols + j];
+                    } else {
+                        target[r * newCols + j] = std::move(source[r * cols + j]);
+                    }
+                }
             }
         }
 
@@ -96,14 +151,14 @@ public:
             int newCols = std::max(cols, col + 5);   // Add 5 extra columns
             resize(newRows, newCols);
         }
-        return data[row][col];
+        return writableBlock(row / BLOCK_ROWS)[(row % BLOCK_ROWS) * cols + col];
     }
 
     const T& at(int row, int col) const {
         if (row >= rows || col >= cols) {
             throw std::out_of_range("Index out of bounds");
         }
-        return data[row][col];
+        return blocks[row / BLOCK_ROWS][(row % BLOCK_ROWS) * cols + col];
     }
 
     int getRows() const { return rows; }
@@ -0,0 +1,152 @@
+#include "DependencyGraph.h"
+#include "Cell.h"
+
+namespace GTUSpreadsheet {
+
+// Removes all edges, used before the graph is rebuilt in bulk
+void DependencyGraph::clear() {
+    cellEdges.clear();
+    rangeEdges.clear();
+    freeRangeSlots.clear();
+    rangeSlots.clear();
+    rangeBuckets.clear();
+    wideRanges.clear();
+}
+
+// Row in the high 32 bits, column in the low 32 bits
+long long DependencyGraph::key(int row, int col) {
+    return (static_cast<long long>(row) << 32) | static_cast<unsigned int>(col);
+}
+
+// Adds one edge per referenced cell and one range edge for function formulas
+void DependencyGraph::addFormula(int row, int col, const FormulaCell& formula) {
+    DynamicArray<pair<int, int>> deps;
+    formula.getDependencies(deps);
+    for (int i = 0; i < deps.getSize(); ++i) {
+        cellEdges[key(deps[i].first, deps[i].second)].pushBack(make_pair(row, col));
+    }
+
+    RangeEdge edge;
+    if (!formula.getRange(edge.startRow, edge.startCol, edge.endRow, edge.endCol)) return;
+    edge.row = row;
+    edge.col = col;
+
+    auto found = rangeSlots.find(key(row, col));
+    if (found != rangeSlots.end()) {
+        removeRange(found->second); // Added again without being removed
+    }
+    int slot;
+    if (freeRangeSlots.getSize() > 0) {
+        slot = freeRangeSlots[freeRangeSlots.getSize() - 1];
+        freeRangeSlots.removeAt(freeRangeSlots.getSize() - 1);
+        rangeEdges[slot] = edge;
+    } else {
+        slot = rangeEdges.getSize();
+        rangeEdges.pushBack(edge);
+    }
+    rangeSlots[key(row, col)] = slot;
+
+    if (isWide(edge)) {
+        wideRanges.pushBack(slot);
+        return;
+    }
+    for (int block = edge.startRow / RANGE_BLOCK_ROWS; block <= edge.endRow / RANGE_BLOCK_ROWS; ++block) {
+        for (int c = edge.startCol; c <= edge.endCol; ++c) {
+            rangeBuckets[key(block, c)].pushBack(slot);
+        }
+    }
+}
+
+// Reversed ranges cover no cell and get no bucket
+bool DependencyGraph::isWide(const RangeEdge& edge) {
+    if (edge.startRow > edge.endRow || edge.startCol > edge.endCol) return false;
+    long long blocks = edge.endRow / RANGE_BLOCK_ROWS - edge.startRow / RANGE_BLOCK_ROWS + 1;
+    return blocks * (edge.endCol - edge.startCol + 1) > MAX_RANGE_BUCKETS;
+}
+
+// Swaps the last slot into the place of the removed one
+void DependencyGraph::removeSlot(DynamicArray<int>& slots, int slot) {
+    int last = slots.getSize() - 1;
+    for (int i = 0; i <= last; ++i) {
+        if (slots[i] == slot) {
+            slots[i] = slots[last];
+            slots.removeAt(last);
+            return;
+        }
+    }
+}
+
+void DependencyGraph::removeRange(int slot) {
+    const RangeEdge& edge = rangeEdges[slot];
+    if (isWide(edge)) {
+        removeSlot(wideRanges, slot);
+    } else {
+        for (int block = edge.startRow / RANGE_BLOCK_ROWS; block <= edge.endRow / RANGE_BLOCK_ROWS; ++block) {
+            for (int c = edge.startCol; c <= edge.endCol; ++c) {
+                auto bucket = rangeBuckets.find(key(block, c));
+                if (bucket == rangeBuckets.end()) continue;
+                removeSlot(bucket->second, slot);
+                if (bucket->second.getSize() == 0) {
+                    rangeBuckets.erase(bucket);
+                }
+            }
+        }
+    }
+    rangeSlots.erase(key(edge.row, edge.col));
+    freeRangeSlots.pushBack(slot);
+}
+
+// Removes the edges of a formula that is being replaced or cleared
+void DependencyGraph::removeFormula(int row, int col, const FormulaCell& formula) {
+    DynamicArray<pair<int, int>> deps;
+    formula.getDependencies(deps);
+    for (int i = 0; i < deps.getSize(); ++i) {
+        auto it = cellEdges.find(key(deps[i].first, deps[i].second));
+        if (it == cellEdges.end()) continue;
+
+        DynamicArray<pair<int, int>>& readers = it->second;
+        for (int j = 0; j < readers.getSize(); ++j) {
+            if (readers[j].first == row && readers[j].second == col) {
+                readers.removeAt(j);
+                break;
+            }
+        }
+        if (readers.getSize() == 0) {
+            cellEdges.erase(it);
+        }
+    }
+
+    auto found = rangeSlots.find(key(row, col));
+    if (found != rangeSlots.end()) {
+        removeRange(found->second);
+    }
+}
+
+// Collects the formulas reading (row, col) through a reference or a range
+void DependencyGraph::getDependents(int row, int col, DynamicArray<pair<int, int>>& dependents) const {
+    auto it = cellEdges.find(key(row, col));
+    if (it != cellEdges.end()) {
+        for (int i = 0; i < it->second.getSize(); ++i) {
+            dependents.pushBack(it->second[i]);
+        }
+    }
+
+    // Only the ranges over the cell's block are checked, plus the few that are too wide for buckets
+    auto bucket = rangeBuckets.find(key(row / RANGE_BLOCK_ROWS, col));
+    if (bucket != rangeBuckets.end()) {
+        appendCovering(bucket->second, row, col, dependents);
+    }
+    appendCovering(wideRanges, row, col, dependents);
+}
+
+void DependencyGraph::appendCovering(const DynamicArray<int>& slots, int row, int col,
+                                     DynamicArray<pair<int, int>>& dependents) const {
+    for (int i = 0; i < slots.getSize(); ++i) {
+        const RangeEdge& edge = rangeEdges[slots[i]];
+        if (row >= edge.startRow && row <= edge.endRow && col >= edge.startCol && col <= edge.endCol) {
+            dependents.pushBack(make_pair(edge.row, edge.col));
+        }
+    }
+}
+
+} // namespace GTUSpreadsheet
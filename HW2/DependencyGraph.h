@@ -0,0 +1,75 @@
+#ifndef DEPENDENCYGRAPH_H
+#define DEPENDENCYGRAPH_H
+
+// Reverse dependency index of the spreadsheet: for a given cell it answers
+// which formulas read it, without scanning the whole grid
+
+#include <unordered_map>
+#include <utility>
+#include "Custom1DArray.h"
+
+using namespace std;
+
+class FormulaCell;
+
+namespace GTUSpreadsheet {
+
+class DependencyGraph {
+public:
+    // Removes every edge
+    void clear();
+
+    // Registers the references and the range of the formula stored at (row, col)
+    void addFormula(int row, int col, const FormulaCell& formula);
+
+    // Removes the edges that were added for the formula stored at (row, col)
+    void removeFormula(int row, int col, const FormulaCell& formula);
+
+    // Appends the positions of the formulas that read (row, col) to the output array
+    void getDependents(int row, int col, DynamicArray<pair<int, int>>& dependents) const;
+
+    // Packs a cell position into a single hash key
+    static long long key(int row, int col);
+
+private:
+    // A function formula at (row, col) reading every cell inside the bounds
+    struct RangeEdge {
+        int startRow, startCol, endRow, endCol;
+        int row, col;
+    };
+
+    // A range is listed in the bucket of every block of RANGE_BLOCK_ROWS rows of every column it
+    // covers, so a lookup only visits the ranges over that block
+    static const int RANGE_BLOCK_ROWS = 1024;
+    // Ranges that would need more buckets than this are kept in wideRanges, checked on every lookup
+    static const long long MAX_RANGE_BUCKETS = 16384;
+
+    // Single-cell references: referenced cell -> formulas reading it
+    unordered_map<long long, DynamicArray<pair<int, int>>> cellEdges;
+    // Ranges are kept as bounds so a large @SUM does not create one edge per cell
+    // Slots of removed ranges are reused; buckets refer to the ranges by slot
+    DynamicArray<RangeEdge> rangeEdges;
+    DynamicArray<int> freeRangeSlots;
+    // Position of a function formula -> slot of its range, so it is removed without a search
+    unordered_map<long long, int> rangeSlots;
+    // Block of a column (key of the block number and the column) -> slots of the ranges over it
+    unordered_map<long long, DynamicArray<int>> rangeBuckets;
+    DynamicArray<int> wideRanges;
+
+    // Returns true if the range is listed in wideRanges instead of in buckets
+    static bool isWide(const RangeEdge& edge);
+
+    // Removes a slot from a bucket or from wideRanges; the order of the others does not matter
+    static void removeSlot(DynamicArray<int>& slots, int slot);
+
+    // Takes the range out of the index and frees its slot
+    void removeRange(int slot);
+
+    // Appends the formulas of the listed ranges that cover (row, col)
+    void appendCovering(const DynamicArray<int>& slots, int row, int col,
+                        DynamicArray<pair<int, int>>& dependents) const;
+};
+
+} // namespace GTUSpreadsheet
+
+#endif // DEPENDENCYGRAPH_H
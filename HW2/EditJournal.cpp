@@ -0,0 +1,291 @@
+#include "EditJournal.h"
+#include "Spreadsheet.h"
+#include "Cell.h"
+#include "MappedFile.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>     // For open()
+#include <unistd.h>    // For write(), fdatasync(), ftruncate()
+#include <sys/stat.h>  // For stat()
+
+namespace Utils {
+
+namespace {
+const char MAGIC[4] = {'G', 'T', 'U', 'J'};
+const std::size_t RECORD_HEAD_BYTES = 3 * sizeof(std::uint32_t);
+
+template <typename T>
+void put(std::string& out, T value) {
+    char bytes[sizeof(T)];
+    std::memcpy(bytes, &value, sizeof(T));
+    out.append(bytes, sizeof(T));
+}
+
+template <typename T>
+T read(std::string_view data, std::size_t offset) {
+    T value;
+    std::memcpy(&value, data.data() + offset, sizeof(T));
+    return value;
+}
+
+// Writes the whole buffer, retrying short and interrupted writes
+bool writeAll(int fd, const char* data, std::size_t length) {
+    while (length > 0) {
+        ssize_t written = ::write(fd, data, length);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        data += written;
+        length -= static_cast<std::size_t>(written);
+    }
+    return true;
+}
+}
+
+// Only the file's identity is read here; the journal itself is untouched
+EditJournal::EditJournal(const std::string& baseFileName, bool keepsFormulas)
+    : baseName(baseFileName), fileName(journalName(baseFileName)), fd(-1),
+      validOnDisk(false), committed(0), keepsFormulas(keepsFormulas), rewriteNeeded(false) {
+    identify(baseName, base);
+}
+
+EditJournal::~EditJournal() {
+    if (fd >= 0) {
+        ::close(fd);
+    }
+}
+
+std::string EditJournal::journalName(const std::string& baseFileName) {
+    return baseFileName + ".journal";
+}
+
+// Directory entries are flushed separately from file data on Linux
+void EditJournal::syncDirectoryOf(const std::string& path) {
+    std::size_t slash = path.find_last_of('/');
+    std::string directory = slash == std::string::npos ? "." : (slash == 0 ? "/" : path.substr(0, slash));
+    int dirFd = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY);
+    if (dirFd >= 0) {
+        ::fsync(dirFd);
+        ::close(dirFd);
+    }
+}
+
+bool EditJournal::identify(const std::string& name, BaseIdentity& identity) {
+    struct stat info;
+    if (::stat(name.c_str(), &info) != 0) {
+        identity = BaseIdentity();
+        return false;
+    }
+    identity.device = static_cast<std::uint64_t>(info.st_dev);
+    identity.inode = static_cast<std::uint64_t>(info.st_ino);
+    identity.size = static_cast<std::uint64_t>(info.st_size);
+    identity.mtimeNs = static_cast<std::int64_t>(info.st_mtim.tv_sec) * 1000000000 + info.st_mtim.tv_nsec;
+    return true;
+}
+
+std::string EditJournal::encodeHeader(const BaseIdentity& identity) {
+    std::string header(MAGIC, sizeof(MAGIC));
+    put<std::uint32_t>(header, VERSION);
+    put<std::uint64_t>(header, identity.device);
+    put<std::uint64_t>(header, identity.inode);
+    put<std::uint64_t>(header, identity.size);
+    put<std::int64_t>(header, identity.mtimeNs);
+    return header;
+}
+
+std::uint32_t EditJournal::checksum(std::int32_t row, std::int32_t col, std::string_view content) {
+    std::uint32_t hash = 2166136261u;
+    auto mix = [&hash](const char* bytes, std::size_t length) {
+        for (std::size_t i = 0; i < length; ++i) {
+            hash ^= static_cast<unsigned char>(bytes[i]);
+            hash *= 16777619u;
+        }
+    };
+    mix(reinterpret_cast<const char*>(&row), sizeof(row));
+    mix(reinterpret_cast<const char*>(&col), sizeof(col));
+    mix(content.data(), content.size());
+    return hash;
+}
+
+// A workbook edit is encoded right away; a CSV edit only remembers the cell, because its
+// value and the values of its dependents are only final when the save happens
+void EditJournal::onCellEdited(int row, int col, const std::string& content) {
+    if (keepsFormulas) {
+        appendRecord(row, col, content);
+    } else {
+        editedCells.pushBack({row, col});
+    }
+}
+
+void EditJournal::appendRecord(int row, int col, std::string_view content) {
+    put<std::uint32_t>(pending, static_cast<std::uint32_t>(content.size()));
+    put<std::int32_t>(pending, row);
+    put<std::int32_t>(pending, col);
+    pending.append(content.data(), content.size());
+    put<std::uint32_t>(pending, checksum(row, col, content));
+}
+
+// The records are scanned once to find the last whole record and the size the grid needs,
+// then applied in one batch so every affected formula is recalculated once
+int EditJournal::replay(GTUSpreadsheet::Spreadsheet& sheet) {
+    validOnDisk = false;
+    committed = 0;
+    identify(baseName, base);
+
+    struct stat info;
+    if (::stat(fileName.c_str(), &info) != 0) {
+        return 0; // No journal: nothing was saved since the file was written
+    }
+    MappedFile file(fileName);
+    std::string_view data = file.contents();
+    if (data.size() < HEADER_BYTES || data.substr(0, HEADER_BYTES) != encodeHeader(base)) {
+        return 0; // Left over from an older version of the file
+    }
+
+    std::size_t end = HEADER_BYTES;
+    int rows = sheet.getTotalRows(), cols = sheet.getTotalCols();
+    while (data.size() - end >= RECORD_HEAD_BYTES) {
+        std::uint32_t length = read<std::uint32_t>(data, end);
+        std::int32_t row = read<std::int32_t>(data, end + 4);
+        std::int32_t col = read<std::int32_t>(data, end + 8);
+        if (length > data.size() - end - RECORD_HEAD_BYTES ||
+            data.size() - end - RECORD_HEAD_BYTES - length < sizeof(std::uint32_t)) {
+            break; // Cut short
+        }
+        std::string_view content = data.substr(end + RECORD_HEAD_BYTES, length);
+        if (row < 0 || col < 0 ||
+            read<std::uint32_t>(data, end + RECORD_HEAD_BYTES + length) != checksum(row, col, content)) {
+            break;
+        }
+        rows = std::max(rows, row + 1);
+        cols = std::max(cols, col + 1);
+        end += RECORD_HEAD_BYTES + length + sizeof(std::uint32_t);
+    }
+
+    if (rows > sheet.getTotalRows() || cols > sheet.getTotalCols()) {
+        sheet.resizeGrid(rows, cols);
+    }
+
+    int applied = 0;
+    sheet.beginBatch();
+    try {
+        for (std::size_t offset = HEADER_BYTES; offset < end; ++applied) {
+            std::uint32_t length = read<std::uint32_t>(data, offset);
+            std::int32_t row = read<std::int32_t>(data, offset + 4);
+            std::int32_t col = read<std::int32_t>(data, offset + 8);
+            sheet.setCellContent(row, col, std::string(data.substr(offset + RECORD_HEAD_BYTES, length)));
+            offset += RECORD_HEAD_BYTES + length + sizeof(std::uint32_t);
+        }
+    } catch (...) {
+        sheet.commit();
+        throw;
+    }
+    sheet.commit();
+
+    // A torn tail is cut off by the next commit()
+    committed = end;
+    validOnDisk = true;
+    return applied;
+}
+
+void EditJournal::openForAppend() {
+    if (fd >= 0) return;
+
+    if (validOnDisk) {
+        fd = ::open(fileName.c_str(), O_WRONLY);
+        if (fd >= 0 && ::ftruncate(fd, static_cast<off_t>(committed)) == 0 &&
+            ::lseek(fd, static_cast<off_t>(committed), SEEK_SET) >= 0) {
+            return;
+        }
+        if (fd >= 0) {
+            ::close(fd);
+            fd = -1;
+        }
+        // Starting over would throw away the committed edits
+        throw std::runtime_error("Error: Could not open journal for appending: " + fileName);
+    }
+
+    // Missing or stale: start over for the file as it is now
+    identify(baseName, base);
+    fd = ::open(fileName.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        throw std::runtime_error("Error: Could not open journal for writing: " + fileName);
+    }
+    std::string header = encodeHeader(base);
+    if (!writeAll(fd, header.data(), header.size())) {
+        ::close(fd);
+        fd = -1;
+        throw std::runtime_error("Error: Could not write journal header: " + fileName);
+    }
+    syncDirectoryOf(fileName);
+    committed = HEADER_BYTES;
+    validOnDisk = true;
+}
+
+// All edits since the last save share one fdatasync (group commit)
+void EditJournal::commit(const GTUSpreadsheet::Spreadsheet& sheet) {
+    if (editedCells.getSize() > 0) {
+        DynamicArray<std::pair<int, int>> affected;
+        sheet.collectAffected(editedCells, affected);
+        std::string value;
+        for (int i = 0; i < affected.getSize(); ++i) {
+            value.clear();
+            if (const Cell* cell = sheet.peekCell(affected[i].first, affected[i].second)) {
+                cell->appendFormatted(value, sheet.getColumnPrecision(affected[i].second));
+            }
+            appendRecord(affected[i].first, affected[i].second, value);
+        }
+        editedCells.clear();
+    }
+    if (pending.empty()) return;
+    openForAppend();
+
+    if (!writeAll(fd, pending.data(), pending.size()) || ::fdatasync(fd) != 0) {
+        std::string reason = std::strerror(errno);
+        // The next commit reopens the journal and cuts off the partial append
+        ::close(fd);
+        fd = -1;
+        throw std::runtime_error("Error while writing to journal: " + reason);
+    }
+    committed += pending.size();
+    pending.clear();
+}
+
+void EditJournal::reset() {
+    if (fd >= 0) {
+        ::close(fd);
+        fd = -1;
+    }
+    ::unlink(fileName.c_str());
+    pending.clear();
+    editedCells.clear();
+    rewriteNeeded = false;
+    validOnDisk = false;
+    committed = 0;
+    identify(baseName, base);
+}
+
+bool EditJournal::hasPending() const {
+    return !pending.empty() || editedCells.getSize() > 0 || rewriteNeeded;
+}
+
+// Records hold cell contents only, so the new precision reaches the file through a rewrite
+void EditJournal::onColumnPrecisionChanged(int) {
+    rewriteNeeded = true;
+}
+
+bool EditJournal::needsRewrite() const {
+    return rewriteNeeded;
+}
+
+std::size_t EditJournal::committedBytes() const {
+    return committed;
+}
+
+std::size_t EditJournal::baseFileBytes() const {
+    return static_cast<std::size_t>(base.size);
+}
+}
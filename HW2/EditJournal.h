@@ -0,0 +1,120 @@
+#ifndef EDITJOURNAL_H
+#define EDITJOURNAL_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include "CellEditObserver.h"
+#include "Custom1DArray.h"
+
+namespace GTUSpreadsheet {
+class Spreadsheet;
+}
+
+namespace Utils {
+
+// Append-only log of cell edits kept next to a saved file ("<file>.journal")
+// Saving appends the edits made since the last save instead of rewriting the file;
+// loading replays them on top of the file. The header records which version of the
+// file the edits belong to, so a journal left over from an older file is ignored.
+//
+// A workbook keeps its formulas, so the entered text of each edited cell is logged and the
+// replay recalculates the rest. A CSV file only holds displayed values: for it the journal logs,
+// at commit time, the displayed value of each edited cell and of every formula that depends on
+// it, formatted with the decimals of its column, which is exactly what rewriting the CSV would
+// have changed. A change of a column's decimals is not logged: the next save rewrites the file.
+//
+// Layout (little-endian):
+//   header  magic "GTUJ", version, device, inode, size and mtime (ns) of the file
+//   record  content length (uint32), row (int32), col (int32), content bytes, checksum (uint32)
+// A record cut short by a crash fails its checksum; it and anything after it are dropped.
+class EditJournal : public GTUSpreadsheet::CellEditObserver {
+public:
+    static const std::uint32_t VERSION = 1;
+
+    // Journal for the given file; the journal file is not touched until replay(), commit() or reset()
+    // keepsFormulas tells whether the file stores formulas (workbook) or only their values (CSV)
+    EditJournal(const std::string& baseFileName, bool keepsFormulas);
+
+    // Closes the journal; edits that were not committed are dropped
+    ~EditJournal() override;
+
+    EditJournal(const EditJournal&) = delete;
+    EditJournal& operator=(const EditJournal&) = delete;
+
+    // Returns the journal file name used for a file
+    static std::string journalName(const std::string& baseFileName);
+
+    // Makes a newly created or renamed file in the directory survive a crash
+    static void syncDirectoryOf(const std::string& path);
+
+    // Queues the edit in memory; it is written by the next commit()
+    void onCellEdited(int row, int col, const std::string& content) override;
+
+    // Marks the file for a full rewrite, see needsRewrite()
+    void onColumnPrecisionChanged(int col) override;
+
+    // Applies the committed edits that belong to the current file, growing the grid if needed
+    // Returns the number of edits applied
+    int replay(GTUSpreadsheet::Spreadsheet& sheet);
+
+    // Appends the queued edits with one write and one fdatasync
+    // For a CSV file the values are read from the sheet now
+    // Throws std::runtime_error if the journal cannot be written
+    void commit(const GTUSpreadsheet::Spreadsheet& sheet);
+
+    // Forgets all edits and removes the journal file; called after the file was rewritten
+    void reset();
+
+    // Returns true if edits are waiting for commit() or the file needs a rewrite
+    bool hasPending() const;
+
+    // Returns true if a change since the last rewrite cannot be appended to the journal
+    bool needsRewrite() const;
+
+    // Returns the committed size of the journal in bytes
+    std::size_t committedBytes() const;
+
+    // Returns the size of the file the journal belongs to (when it was opened or created)
+    std::size_t baseFileBytes() const;
+
+private:
+    // Identifies one version of the file: rewriting it (through a rename) changes the inode
+    struct BaseIdentity {
+        std::uint64_t device = 0;
+        std::uint64_t inode = 0;
+        std::uint64_t size = 0;
+        std::int64_t mtimeNs = 0;
+    };
+
+    std::string baseName;      // The saved file
+    std::string fileName;      // The journal file
+    int fd;                    // Open for appending, -1 until the first commit()
+    bool validOnDisk;          // True if the file on disk has our header and ends at committed
+    std::size_t committed;     // Bytes of header and whole records on disk
+    BaseIdentity base;         // Identity written to (or read from) the header
+    bool keepsFormulas;        // Log entered text (workbook) instead of displayed values (CSV)
+    std::string pending;       // Encoded records waiting for commit()
+    DynamicArray<std::pair<int, int>> editedCells; // CSV: cells edited since the last commit()
+    bool rewriteNeeded;        // A column's decimals changed since the file was written
+
+    static const std::size_t HEADER_BYTES = 4 + 4 + 8 * 4;
+
+    // Reads the identity of the file; returns false if it does not exist
+    static bool identify(const std::string& name, BaseIdentity& identity);
+
+    // Encodes the header for the identity
+    static std::string encodeHeader(const BaseIdentity& identity);
+
+    // FNV-1a over the position and the content of a record
+    static std::uint32_t checksum(std::int32_t row, std::int32_t col, std::string_view content);
+
+    // Encodes one record into pending
+    void appendRecord(int row, int col, std::string_view content);
+
+    // Opens the journal for appending, creating it with a new header if it is missing or stale
+    void openForAppend();
+};
+}
+
+#endif // EDITJOURNAL_H
@@ -0,0 +1,493 @@
+#include "EncodedTile.h"
+#include "Cell.h"
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include <unordered_map>
+
+namespace GTUSpreadsheet {
+
+namespace {
+template <typename T>
+void put(string& out, T value) {
+    char bytes[sizeof(T)];
+    memcpy(bytes, &value, sizeof(T));
+    out.append(bytes, sizeof(T));
+}
+
+// Reads from an encoded tile; a short tile means the page file is damaged
+template <typename T>
+T take(const string& data, size_t& offset) {
+    if (data.size() < sizeof(T) || offset > data.size() - sizeof(T)) {
+        throw runtime_error("Corrupt encoded tile");
+    }
+    T value;
+    memcpy(&value, data.data() + offset, sizeof(T));
+    offset += sizeof(T);
+    return value;
+}
+
+size_t packedWords(int count, int width) {
+    return (static_cast<size_t>(count) * width + 63) / 64;
+}
+}
+
+// Header: rows, columns and the offset of each column segment
+shared_ptr<const EncodedTile> EncodedTile::encode(const shared_ptr<Cell>* cells, int rows, int cols) {
+    for (int i = 0; i < rows * cols; ++i) {
+        if (dynamic_cast<const FormulaCell*>(cells[i].get())) {
+            return nullptr; // Formulas keep a program and a result that may still change
+        }
+    }
+    shared_ptr<EncodedTile> tile(new EncodedTile());
+    tile->rows = rows;
+    tile->cols = cols;
+    string& out = tile->data;
+    put<uint16_t>(out, static_cast<uint16_t>(rows));
+    put<uint16_t>(out, static_cast<uint16_t>(cols));
+    size_t offsets = out.size();
+    out.append(cols * sizeof(uint32_t), '\0');
+    for (int c = 0; c < cols; ++c) {
+        uint32_t start = static_cast<uint32_t>(out.size());
+        memcpy(&out[offsets + c * sizeof(uint32_t)], &start, sizeof(start));
+        encodeColumn(out, cells, rows, cols, c);
+    }
+    out.shrink_to_fit();
+    return tile;
+}
+
+shared_ptr<const EncodedTile> EncodedTile::fromBytes(string bytes) {
+    shared_ptr<EncodedTile> tile(new EncodedTile());
+    size_t offset = 0;
+    tile->rows = take<uint16_t>(bytes, offset);
+    tile->cols = take<uint16_t>(bytes, offset);
+    for (int c = 0; c < tile->cols; ++c) {
+        if (take<uint32_t>(bytes, offset) > bytes.size()) {
+            throw runtime_error("Corrupt encoded tile");
+        }
+    }
+    tile->data = std::move(bytes);
+    return tile;
+}
+
+// Segment: the kinds of the rows, then the integers, the decimals and the labels
+void EncodedTile::encodeColumn(string& out, const shared_ptr<Cell>* cells, int rows, int cols, int col) {
+    unique_ptr<uint8_t[]> kinds(new uint8_t[rows]);
+    unique_ptr<int64_t[]> ints(new int64_t[rows]);
+    unique_ptr<double[]> doubles(new double[rows]);
+    unique_ptr<int64_t[]> codes(new int64_t[rows]);
+    int intCount = 0, doubleCount = 0, labelCount = 0;
+    unordered_map<string, int64_t> labelCodes;
+    string dictionary; // The texts in code order, each with its length
+    string label;
+
+    for (int r = 0; r < rows; ++r) {
+        const Cell* cell = cells[r * cols + col].get();
+        kinds[r] = KIND_EMPTY;
+        if (!cell) continue;
+        if (auto intCell = dynamic_cast<const IntValueCell*>(cell)) {
+            kinds[r] = KIND_INT;
+            ints[intCount++] = intCell->getValue();
+        } else if (auto doubleCell = dynamic_cast<const DoubleValueCell*>(cell)) {
+            kinds[r] = KIND_DOUBLE;
+            doubles[doubleCount++] = doubleCell->getValue();
+        } else {
+            label.clear();
+            cell->appendContent(label);
+            if (label.empty()) continue; // Placeholder cell, stored as empty like in the page file
+            auto found = labelCodes.emplace(label, static_cast<int64_t>(labelCodes.size()));
+            if (found.second) {
+                put<uint32_t>(dictionary, static_cast<uint32_t>(label.size()));
+                dictionary += label;
+            }
+            kinds[r] = KIND_LABEL;
+            codes[labelCount++] = found.first->second;
+        }
+    }
+
+    // Kinds as runs, or 2 bits per row when there are many short runs
+    int runs = 1;
+    for (int r = 1; r < rows; ++r) {
+        if (kinds[r] != kinds[r - 1]) ++runs;
+    }
+    if (sizeof(uint16_t) + runs * 3 <= static_cast<size_t>((rows * 2 + 7) / 8)) {
+        put<uint8_t>(out, KINDS_RUNS);
+        put<uint16_t>(out, static_cast<uint16_t>(runs));
+        int start = 0;
+        for (int r = 1; r <= rows; ++r) {
+            if (r == rows || kinds[r] != kinds[start]) {
+                put<uint8_t>(out, kinds[start]);
+                put<uint16_t>(out, static_cast<uint16_t>(r - start));
+                start = r;
+            }
+        }
+    } else {
+        put<uint8_t>(out, KINDS_PACKED);
+        string packed((rows * 2 + 7) / 8, '\0');
+        for (int r = 0; r < rows; ++r) {
+            packed[r / 4] = static_cast<char>(packed[r / 4] | (kinds[r] << (r % 4 * 2)));
+        }
+        out += packed;
+    }
+
+    if (intCount > 0) {
+        encodeSequence(out, ints.get(), intCount);
+    }
+    if (doubleCount > 0) {
+        // The fewest decimals that give back every value exactly, e.g. 2 for prices read from text
+        unique_ptr<int64_t[]> units(new int64_t[doubleCount]);
+        uint8_t decimals = DECIMALS_RAW;
+        double scale = 1;
+        for (int d = 0; d <= MAX_DECIMALS && decimals == DECIMALS_RAW; ++d, scale *= 10) {
+            bool exact = true;
+            for (int i = 0; i < doubleCount && exact; ++i) {
+                double scaled = doubles[i] * scale;
+                if (!(fabs(scaled) < 1e15)) { // Also rejects NaN and infinities
+                    exact = false;
+                    break;
+                }
+                int64_t scaledUnits = llround(scaled);
+                double back = static_cast<double>(scaledUnits) / scale;
+                exact = memcmp(&back, &doubles[i], sizeof(double)) == 0; // Keeps -0.0 apart from 0.0
+                units[i] = scaledUnits;
+            }
+            if (exact) decimals = static_cast<uint8_t>(d);
+        }
+        if (decimals == DECIMALS_RAW) {
+            for (int i = 0; i < doubleCount; ++i) {
+                memcpy(&units[i], &doubles[i], sizeof(double));
+            }
+        }
+        put<uint8_t>(out, decimals);
+        encodeSequence(out, units.get(), doubleCount);
+    }
+    if (labelCount > 0) {
+        put<uint32_t>(out, static_cast<uint32_t>(labelCodes.size()));
+        out += dictionary;
+        encodeSequence(out, codes.get(), labelCount);
+    }
+}
+
+void EncodedTile::decodeColumn(int col, Column& column) const {
+    if (col < 0 || col >= cols) {
+        throw out_of_range("Column out of range");
+    }
+    size_t offset = sizeof(uint16_t) * 2 + col * sizeof(uint32_t);
+    offset = take<uint32_t>(data, offset);
+
+    column.kinds.reset(new uint8_t[rows]);
+    uint8_t method = take<uint8_t>(data, offset);
+    if (method == KINDS_RUNS) {
+        int runs = take<uint16_t>(data, offset);
+        int r = 0;
+        for (int i = 0; i < runs; ++i) {
+            uint8_t kind = take<uint8_t>(data, offset);
+            int length = take<uint16_t>(data, offset);
+            if (kind > KIND_LABEL || length > rows - r) {
+                throw runtime_error("Corrupt encoded tile");
+            }
+            memset(column.kinds.get() + r, kind, length);
+            r += length;
+        }
+        if (r != rows) {
+            throw runtime_error("Corrupt encoded tile");
+        }
+    } else if (method == KINDS_PACKED) {
+        for (int r = 0; r < rows; r += 4) {
+            uint8_t packed = take<uint8_t>(data, offset);
+            for (int i = 0; i < 4 && r + i < rows; ++i) {
+                column.kinds[r + i] = (packed >> (i * 2)) & 3;
+            }
+        }
+    } else {
+        throw runtime_error("Corrupt encoded tile");
+    }
+    for (int r = 0; r < rows; ++r) {
+        ++column.counts[column.kinds[r]];
+    }
+
+    int intCount = column.counts[KIND_INT];
+    if (intCount > 0) {
+        column.ints.reset(new int64_t[intCount]);
+        decodeSequence(data, offset, column.ints.get(), intCount);
+    }
+    int doubleCount = column.counts[KIND_DOUBLE];
+    if (doubleCount > 0) {
+        uint8_t decimals = take<uint8_t>(data, offset);
+        if (decimals != DECIMALS_RAW && decimals > MAX_DECIMALS) {
+            throw runtime_error("Corrupt encoded tile");
+        }
+        unique_ptr<int64_t[]> units(new int64_t[doubleCount]);
+        decodeSequence(data, offset, units.get(), doubleCount);
+        column.doubles.reset(new double[doubleCount]);
+        double scale = 1;
+        for (int d = 0; decimals != DECIMALS_RAW && d < decimals; ++d) {
+            scale *= 10;
+        }
+        for (int i = 0; i < doubleCount; ++i) {
+            if (decimals == DECIMALS_RAW) {
+                memcpy(&column.doubles[i], &units[i], sizeof(double));
+            } else {
+                column.doubles[i] = static_cast<double>(units[i]) / scale;
+            }
+        }
+    }
+    int labelCount = column.counts[KIND_LABEL];
+    if (labelCount > 0) {
+        uint32_t size = take<uint32_t>(data, offset);
+        if (size > static_cast<uint32_t>(labelCount)) {
+            throw runtime_error("Corrupt encoded tile");
+        }
+        column.dictionarySize = static_cast<int>(size);
+        column.dictionary.reset(new string[size]);
+        for (uint32_t i = 0; i < size; ++i) {
+            uint32_t length = take<uint32_t>(data, offset);
+            if (length > data.size() - offset) {
+                throw runtime_error("Corrupt encoded tile");
+            }
+            column.dictionary[i].assign(data, offset, length);
+            offset += length;
+        }
+        column.codes.reset(new int64_t[labelCount]);
+        decodeSequence(data, offset, column.codes.get(), labelCount);
+        for (int i = 0; i < labelCount; ++i) {
+            if (column.codes[i] < 0 || column.codes[i] >= column.dictionarySize) {
+                throw runtime_error("Corrupt encoded tile");
+            }
+        }
+    }
+}
+
+// Cells are built the same way as when a tile record is read from the page file
+void EncodedTile::decode(shared_ptr<Cell>* cells, int firstRow, int firstCol) const {
+    Column column;
+    for (int c = 0; c < cols; ++c) {
+        column = Column();
+        decodeColumn(c, column);
+        int next[4] = {0, 0, 0, 0};
+        for (int r = 0; r < rows; ++r) {
+            shared_ptr<Cell> cell;
+            switch (column.kinds[r]) {
+                case KIND_INT:
+                    cell = make_shared<IntValueCell>(column.ints[next[KIND_INT]++]);
+                    break;
+                case KIND_DOUBLE:
+                    cell = make_shared<DoubleValueCell>(column.doubles[next[KIND_DOUBLE]++]);
+                    break;
+                case KIND_LABEL:
+                    cell = make_shared<StringValueCell>(column.dictionary[column.codes[next[KIND_LABEL]++]]);
+                    break;
+                default:
+                    continue;
+            }
+            cell->setPosition(firstRow + r, firstCol + c);
+            cells[r * cols + c] = std::move(cell);
+        }
+    }
+}
+
+// The labels of the dictionary are parsed once instead of once per row
+void EncodedTile::readNumbers(int col, double* values, bool* present) const {
+    Column column;
+    decodeColumn(col, column);
+    unique_ptr<double[]> labelValues(new double[column.dictionarySize]);
+    unique_ptr<bool[]> labelNumeric(new bool[column.dictionarySize]);
+    for (int i = 0; i < column.dictionarySize; ++i) {
+        labelNumeric[i] = Cell::parseNumber(column.dictionary[i], labelValues[i]);
+    }
+
+    int next[4] = {0, 0, 0, 0};
+    for (int r = 0; r < rows; ++r) {
+        present[r] = false;
+        switch (column.kinds[r]) {
+            case KIND_INT:
+                values[r] = static_cast<double>(column.ints[next[KIND_INT]++]);
+                present[r] = true;
+                break;
+            case KIND_DOUBLE:
+                present[r] = DoubleValueCell::displayedNumber(column.doubles[next[KIND_DOUBLE]++], values[r]);
+                break;
+            case KIND_LABEL: {
+                int64_t code = column.codes[next[KIND_LABEL]++];
+                present[r] = labelNumeric[code];
+                values[r] = labelValues[code];
+                break;
+            }
+            default:
+                break;
+        }
+    }
+}
+
+// Runs: count, then value and length of each run
+// Frame of reference: the smallest value and the bit width, then the packed offsets from it
+// Delta: the first value, then the differences between neighbours as a frame of reference
+void EncodedTile::encodeSequence(string& out, const int64_t* values, int count) {
+    int runs = 1;
+    int64_t minValue = values[0];
+    for (int i = 1; i < count; ++i) {
+        if (values[i] != values[i - 1]) ++runs;
+        if (values[i] < minValue) minValue = values[i];
+    }
+    unique_ptr<uint64_t[]> offsets(new uint64_t[count]);
+    uint64_t maxOffset = 0;
+    for (int i = 0; i < count; ++i) {
+        offsets[i] = static_cast<uint64_t>(values[i]) - static_cast<uint64_t>(minValue);
+        if (offsets[i] > maxOffset) maxOffset = offsets[i];
+    }
+    int frameWidth = bitWidth(maxOffset);
+
+    // Differences wrap around like the offsets, so any sequence can be given back
+    unique_ptr<int64_t[]> deltas(new int64_t[count]);
+    int64_t minDelta = 0;
+    for (int i = 1; i < count; ++i) {
+        deltas[i] = static_cast<int64_t>(static_cast<uint64_t>(values[i]) - static_cast<uint64_t>(values[i - 1]));
+        if (i == 1 || deltas[i] < minDelta) minDelta = deltas[i];
+    }
+    uint64_t maxDeltaOffset = 0;
+    for (int i = 1; i < count; ++i) {
+        deltas[i] = static_cast<int64_t>(static_cast<uint64_t>(deltas[i]) - static_cast<uint64_t>(minDelta));
+        if (static_cast<uint64_t>(deltas[i]) > maxDeltaOffset) maxDeltaOffset = static_cast<uint64_t>(deltas[i]);
+    }
+    int deltaWidth = bitWidth(maxDeltaOffset);
+
+    size_t runBytes = sizeof(uint16_t) + runs * (sizeof(int64_t) + sizeof(uint16_t));
+    size_t frameBytes = sizeof(int64_t) + 1 + packedWords(count, frameWidth) * sizeof(uint64_t);
+    size_t deltaBytes = 2 * sizeof(int64_t) + 1 + packedWords(count - 1, deltaWidth) * sizeof(uint64_t);
+
+    if (runBytes <= frameBytes && runBytes <= deltaBytes) {
+        put<uint8_t>(out, SEQUENCE_RUNS);
+        put<uint16_t>(out, static_cast<uint16_t>(runs));
+        int start = 0;
+        for (int i = 1; i <= count; ++i) {
+            if (i == count || values[i] != values[start]) {
+                put<int64_t>(out, values[start]);
+                put<uint16_t>(out, static_cast<uint16_t>(i - start));
+                start = i;
+            }
+        }
+    } else if (frameBytes <= deltaBytes) {
+        put<uint8_t>(out, SEQUENCE_FRAME);
+        put<int64_t>(out, minValue);
+        put<uint8_t>(out, static_cast<uint8_t>(frameWidth));
+        packBits(out, offsets.get(), count, frameWidth);
+    } else {
+        put<uint8_t>(out, SEQUENCE_DELTA);
+        put<int64_t>(out, values[0]);
+        put<int64_t>(out, minDelta);
+        put<uint8_t>(out, static_cast<uint8_t>(deltaWidth));
+        packBits(out, reinterpret_cast<const uint64_t*>(deltas.get()) + 1, count - 1, deltaWidth);
+    }
+}
+
+void EncodedTile::decodeSequence(const string& data, size_t& offset, int64_t* values, int count) {
+    uint8_t method = take<uint8_t>(data, offset);
+    if (method == SEQUENCE_RUNS) {
+        int runs = take<uint16_t>(data, offset);
+        int i = 0;
+        for (int run = 0; run < runs; ++run) {
+            int64_t value = take<int64_t>(data, offset);
+            int length = take<uint16_t>(data, offset);
+            if (length > count - i) {
+                throw runtime_error("Corrupt encoded tile");
+            }
+            for (int end = i + length; i < end; ++i) {
+                values[i] = value;
+            }
+        }
+        if (i != count) {
+            throw runtime_error("Corrupt encoded tile");
+        }
+    } else if (method == SEQUENCE_FRAME) {
+        uint64_t base = static_cast<uint64_t>(take<int64_t>(data, offset));
+        int width = take<uint8_t>(data, offset);
+        unique_ptr<uint64_t[]> offsets(new uint64_t[count]);
+        unpackBits(data, offset, offsets.get(), count, width);
+        for (int i = 0; i < count; ++i) {
+            values[i] = static_cast<int64_t>(base + offsets[i]);
+        }
+    } else if (method == SEQUENCE_DELTA) {
+        values[0] = take<int64_t>(data, offset);
+        uint64_t base = static_cast<uint64_t>(take<int64_t>(data, offset));
+        int width = take<uint8_t>(data, offset);
+        unique_ptr<uint64_t[]> deltas(new uint64_t[count]);
+        unpackBits(data, offset, deltas.get(), count - 1, width);
+        for (int i = 1; i < count; ++i) {
+            values[i] = static_cast<int64_t>(static_cast<uint64_t>(values[i - 1]) + base + deltas[i - 1]);
+        }
+    } else {
+        throw runtime_error("Corrupt encoded tile");
+    }
+}
+
+void EncodedTile::packBits(string& out, const uint64_t* values, int count, int width) {
+    unique_ptr<uint64_t[]> words(new uint64_t[packedWords(count, width) + 1]());
+    for (int i = 0; i < count && width > 0; ++i) {
+        size_t bit = static_cast<size_t>(i) * width;
+        size_t word = bit / 64;
+        int shift = static_cast<int>(bit % 64);
+        words[word] |= values[i] << shift;
+        if (shift + width > 64) {
+            words[word + 1] |= values[i] >> (64 - shift);
+        }
+    }
+    for (size_t i = 0; i < packedWords(count, width); ++i) {
+        put<uint64_t>(out, words[i]);
+    }
+}
+
+void EncodedTile::unpackBits(const string& data, size_t& offset, uint64_t* values, int count, int width) {
+    if (width > 64) {
+        throw runtime_error("Corrupt encoded tile");
+    }
+    size_t wordCount = packedWords(count, width);
+    if (wordCount * sizeof(uint64_t) > data.size() - offset) {
+        throw runtime_error("Corrupt encoded tile");
+    }
+    unique_ptr<uint64_t[]> words(new uint64_t[wordCount + 1]());
+    memcpy(words.get(), data.data() + offset, wordCount * sizeof(uint64_t));
+    offset += wordCount * sizeof(uint64_t);
+
+    uint64_t mask = width == 64 ? ~0ull : (1ull << width) - 1;
+    for (int i = 0; i < count; ++i) {
+        if (width == 0) {
+            values[i] = 0;
+            continue;
+        }
+        size_t bit = static_cast<size_t>(i) * width;
+        size_t word = bit / 64;
+        int shift = static_cast<int>(bit % 64);
+        uint64_t value = words[word] >> shift;
+        if (shift + width > 64) {
+            value |= words[word + 1] << (64 - shift);
+        }
+        values[i] = value & mask;
+    }
+}
+
+int EncodedTile::bitWidth(uint64_t value) {
+    int width = 0;
+    while (value) {
+        ++width;
+        value >>= 1;
+    }
+    return width;
+}
+
+const string& EncodedTile::getBytes() const {
+    return data;
+}
+
+size_t EncodedTile::getMemoryBytes() const {
+    return sizeof(EncodedTile) + data.capacity() + 32; // 32 for the control block of the shared pointer
+}
+
+int EncodedTile::getRows() const {
+    return rows;
+}
+
+int EncodedTile::getCols() const {
+    return cols;
+}
+
+} // namespace GTUSpreadsheet
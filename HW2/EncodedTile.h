@@ -0,0 +1,106 @@
+#ifndef ENCODEDTILE_H
+#define ENCODEDTILE_H
+
+// Compact column-wise encoding of a tile of value cells, used by PagedGrid for tiles that have
+// not been accessed for a while (cold tiles)
+// Each column of the tile is stored on its own: the kind of every row (empty, integer, decimal
+// or label) as runs, then the values of each kind in row order:
+//  - integers as runs of equal values, as offsets from the smallest value packed into as few
+//    bits as they need (frame of reference), or as packed differences between neighbours (delta),
+//    whichever is smallest
+//  - decimals that are exactly a number of hundredths (or tenths, ...) as those integers,
+//    the others as their bit patterns
+//  - labels as a dictionary of the distinct texts and the packed index of each row
+// The encoded bytes are also the record the tile is stored as in the page file.
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+using namespace std;
+
+class Cell;
+
+namespace GTUSpreadsheet {
+
+class EncodedTile {
+public:
+    // Encodes the rows x cols cells (row-major); returns nullptr if one of them is a formula
+    static shared_ptr<const EncodedTile> encode(const shared_ptr<Cell>* cells, int rows, int cols);
+
+    // Takes over the bytes of an encoded tile, e.g. read back from the page file
+    // Throws runtime_error if the header does not match
+    static shared_ptr<const EncodedTile> fromBytes(string bytes);
+
+    // Builds the cells again (rows x cols, row-major), at the position of the tile's first cell
+    void decode(shared_ptr<Cell>* cells, int firstRow, int firstCol) const;
+
+    // Reads the numbers of one column as aggregates see them (FormulaCell::readNumber) without
+    // building cells; 'present' is false for rows that are empty or not numeric
+    void readNumbers(int col, double* values, bool* present) const;
+
+    // The encoded form, as written to the page file
+    const string& getBytes() const;
+
+    // Memory held by the encoded tile
+    size_t getMemoryBytes() const;
+
+    int getRows() const;
+    int getCols() const;
+
+private:
+    EncodedTile() = default;
+
+    // Kind of a row of a column
+    enum Kind : uint8_t { KIND_EMPTY = 0, KIND_INT = 1, KIND_DOUBLE = 2, KIND_LABEL = 3 };
+
+    // How a sequence of 64-bit integers is stored
+    enum SequenceMethod : uint8_t { SEQUENCE_RUNS = 0, SEQUENCE_FRAME = 1, SEQUENCE_DELTA = 2 };
+
+    // How the kinds of the rows are stored
+    enum KindMethod : uint8_t { KINDS_RUNS = 0, KINDS_PACKED = 1 };
+
+    // Decimals with more digits than this are stored as bit patterns
+    static const int MAX_DECIMALS = 6;
+    static const uint8_t DECIMALS_RAW = 0xff;
+
+    // The values of one column, decoded from its segment
+    struct Column {
+        unique_ptr<uint8_t[]> kinds;      // Kind of each row
+        unique_ptr<int64_t[]> ints;       // Integers, in row order
+        unique_ptr<double[]> doubles;     // Decimals, in row order
+        unique_ptr<int64_t[]> codes;      // Dictionary index of each label, in row order
+        unique_ptr<string[]> dictionary;  // Distinct labels
+        int dictionarySize = 0;
+        int counts[4] = {0, 0, 0, 0};     // Rows of each kind
+    };
+
+    int rows = 0;
+    int cols = 0;
+    string data; // Header with the offset of each column segment, then the segments
+
+    // Appends one column segment
+    static void encodeColumn(string& out, const shared_ptr<Cell>* cells, int rows, int cols, int col);
+
+    // Decodes the segment of one column
+    void decodeColumn(int col, Column& column) const;
+
+    // Appends a sequence of integers with the smallest of the three methods
+    static void encodeSequence(string& out, const int64_t* values, int count);
+
+    // Reads a sequence of 'count' integers
+    static void decodeSequence(const string& data, size_t& offset, int64_t* values, int count);
+
+    // Appends the values packed into 'width' bits each, lowest bits first
+    static void packBits(string& out, const uint64_t* values, int count, int width);
+
+    // Reads 'count' values of 'width' bits
+    static void unpackBits(const string& data, size_t& offset, uint64_t* values, int count, int width);
+
+    // Number of bits needed for the value
+    static int bitWidth(uint64_t value);
+};
+
+} // namespace GTUSpreadsheet
+
+#endif // ENCODEDTILE_H
@@ -1,163 +1,884 @@
 #include "FileManager.h"
 #include "Spreadsheet.h"
+#include "Cell.h"
+#include "MappedFile.h"
+#include "CsvTokenizer.h"
+#include "WorkbookFile.h"
+#include "EditJournal.h"
+#include "LazyCsvFile.h"
+#include "SheetSnapshot.h"
+#include "CellEditObserver.h"
 #include <fstream>
-#include <sstream>
 #include <iostream>
 #include <stdexcept>
+#include <string_view>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <cstdio>      // For rename()
+#include <fcntl.h>     // For open()
+#include <unistd.h>    // For fsync(), unlink(), sysconf()
+#include <sys/stat.h>  // For stat()
 
 namespace Utils{
 
+// While the write runs, the save is the sheet's edit observer: the edits still reach the journal
+// of the current file, which stays valid if the write fails, and are kept for the journal of the
+// written file, which only starts once the file is in place
+struct FileManager::BackgroundSave : public GTUSpreadsheet::CellEditObserver {
+    struct Edit {
+        int row = 0;
+        int col = 0;
+        std::string content;
+    };
+
+    std::string fileName;
+    std::unique_ptr<GTUSpreadsheet::SheetSnapshot> snapshot; // Only read by the worker until it finishes
+    EditJournal* previousJournal = nullptr;                   // Journal of the current file, if any
+    DynamicArray<Edit> edits;                                 // Edits made since the snapshot
+    DynamicArray<int> precisionChanges;                       // Columns whose decimals changed since the snapshot
+    std::thread worker;
+    std::atomic<bool> finished{false};
+    std::string error;                                        // Set by the worker if the write failed
+
+    void onCellEdited(int row, int col, const std::string& content) override {
+        if (previousJournal) {
+            previousJournal->onCellEdited(row, col, content);
+        }
+        Edit edit;
+        edit.row = row;
+        edit.col = col;
+        edit.content = content;
+        edits.pushBack(edit);
+    }
+
+    void onColumnPrecisionChanged(int col) override {
+        if (previousJournal) {
+            previousJournal->onColumnPrecisionChanged(col);
+        }
+        precisionChanges.pushBack(col);
+    }
+};
+
 // Constructor: Initializes FileManager with a reference to the spreadsheet and no current file name
 FileManager::FileManager(std::shared_ptr<GTUSpreadsheet::Spreadsheet> sheet)
-    : spreadsheet(sheet), currentFileName("") {}
+    : spreadsheet(sheet), currentFileName(""), importThreads(0), exportThreads(0), pagedMemoryBudget(defaultPagedMemoryBudget()),
+      encodedMemoryBudget(0) {}
+
+// The sheet must not keep a pointer to the journal that is destroyed with the FileManager
+FileManager::~FileManager() {
+    waitForSave();
+    detachJournal();
+    detachLazyFile();
+}
 
 // Create a new file by clearing the spreadsheet and resetting the file name
 void FileManager::makeNewFile() {
     if (!spreadsheet) {
         throw std::runtime_error("Spreadsheet instance is not initialized.");
     }
+    waitForSave();
+    detachJournal();       // A new file has nothing to journal yet
+    detachLazyFile();
     spreadsheet->clear();  // Clears all content in the spreadsheet
     currentFileName = "";  // Resets the current file name
 }
 
 // Save the spreadsheet to the current file if a file name is specified
+// Only the edits since the last save are appended to the journal, with one fdatasync for all of
+// them. Once the journal has outgrown a quarter of the file (and JOURNAL_COMPACT_MIN_BYTES) the
+// whole file is rewritten instead, which empties the journal; the cost of a save stays
+// proportional to the edits, amortized
 void FileManager::saveFile() {
     if (currentFileName.empty()) {
         throw std::runtime_error("No file name specified. Use 'Save As' to set a file name.");
     }
-    saveFileAs(currentFileName); // Call saveFileAs with the current file name
+    waitForSave();
+    if (journalHasRoom()) {
+        journal->commit(*spreadsheet);
+        return;
+    }
+    saveFileAs(currentFileName); // Compaction: rewrite the file with the current file name
+}
+
+// A change the journal cannot hold (a column's decimals) also forces the rewrite
+bool FileManager::journalHasRoom() const {
+    if (!journal || journal->needsRewrite()) return false;
+    std::size_t limit = journal->baseFileBytes() / 4;
+    if (limit < JOURNAL_COMPACT_MIN_BYTES) {
+        limit = JOURNAL_COMPACT_MIN_BYTES;
+    }
+    return journal->committedBytes() <= limit;
 }
 
-// Save the spreadsheet to a specified file (CSV format)
+// Stops recording edits, e.g. before the sheet is replaced by a load
+void FileManager::detachJournal() {
+    if (journal && spreadsheet) {
+        spreadsheet->setEditObserver(nullptr);
+    }
+    journal.reset();
+}
+
+// Save the spreadsheet to a specified file (CSV format, or the binary workbook for ".gtuw" names)
+// The file is written from a snapshot of the sheet, like a background save, on this thread
 void FileManager::saveFileAs(const std::string& fileName) {
     if (!spreadsheet) {
         throw std::runtime_error("Spreadsheet instance is not initialized.");
     }
+    waitForSave();
+    finishLazyFile(); // Every row is written, so every row must be read first
+
+    std::unique_ptr<GTUSpreadsheet::SheetSnapshot> snapshot = spreadsheet->takeSnapshot();
+    try {
+        writeSnapshot(*snapshot, fileName, exportThreads);
+    } catch (...) {
+        spreadsheet->releaseSnapshot(std::move(snapshot));
+        throw;
+    }
+    spreadsheet->releaseSnapshot(std::move(snapshot));
+    startJournal(fileName);
+}
+
+// The contents are written to "<file>.tmp", flushed to disk and renamed over the file, so a crash
+// leaves either the old or the new file
+void FileManager::writeSnapshot(const GTUSpreadsheet::SheetSnapshot& sheet, const std::string& fileName, int threads) {
+    std::string tempName = fileName + ".tmp";
+    try {
+        if (WorkbookFile::isWorkbookName(fileName)) {
+            WorkbookFile::save(sheet, tempName);
+        } else {
+            writeCsv(sheet, tempName, threads);
+        }
+        syncToDisk(tempName);
+    } catch (...) {
+        ::unlink(tempName.c_str());
+        throw;
+    }
+    if (std::rename(tempName.c_str(), fileName.c_str()) != 0) {
+        ::unlink(tempName.c_str());
+        throw std::runtime_error("Error: Could not replace file: " + fileName);
+    }
+    EditJournal::syncDirectoryOf(fileName);
+}
+
+// The rename gives the file a new identity, which makes the journal of the old file stale;
+// it is removed and a new one starts empty
+void FileManager::startJournal(const std::string& fileName) {
+    detachJournal();
+    journal.reset(new EditJournal(fileName, WorkbookFile::isWorkbookName(fileName)));
+    journal->reset();
+    spreadsheet->setEditObserver(journal.get());
+    currentFileName = fileName; // Set the current file name to the specified file name
+}
+
+// Only the snapshot is taken on this thread: pending formulas are computed and the blocks of
+// the grid are shared, which costs far less than formatting and writing the cells
+// A lazily opened file is still read in completely first, since every row is written
+void FileManager::saveInBackground(const std::string& fileName) {
+    if (!spreadsheet) {
+        throw std::runtime_error("Spreadsheet instance is not initialized.");
+    }
+    // Waiting for a running write here would block the UI until it finished
+    if (backgroundSave && !pollSave()) {
+        spreadsheet->setStatusMessage("Save in progress: " + backgroundSave->fileName);
+        return;
+    }
+    if (fileName == currentFileName && journalHasRoom()) {
+        journal->commit(*spreadsheet);
+        spreadsheet->setStatusMessage("Saved " + fileName);
+        return;
+    }
+    finishLazyFile();
+
+    std::unique_ptr<BackgroundSave> save(new BackgroundSave());
+    save->fileName = fileName;
+    save->previousJournal = journal.get();
+    save->snapshot = spreadsheet->takeSnapshot();
+    BackgroundSave* running = save.get();
+    int threads = exportThreads;
+    try {
+        save->worker = std::thread([running, threads]() {
+            try {
+                writeSnapshot(*running->snapshot, running->fileName, threads);
+            } catch (const std::exception& e) {
+                running->error = e.what();
+            }
+            running->finished = true;
+        });
+    } catch (...) {
+        spreadsheet->releaseSnapshot(std::move(save->snapshot));
+        throw;
+    }
+    spreadsheet->setEditObserver(running);
+    backgroundSave = std::move(save);
+    spreadsheet->setStatusMessage("Saving " + fileName + "...");
+}
+
+// Autosave only rewrites the file when the journal has to be compacted; usually it appends
+void FileManager::autosave() {
+    if (currentFileName.empty() || isSaving() || !hasUnsavedEdits()) {
+        return;
+    }
+    saveInBackground(currentFileName);
+}
+
+bool FileManager::hasUnsavedEdits() const {
+    if (backgroundSave) {
+        return backgroundSave->edits.getSize() > 0 || backgroundSave->precisionChanges.getSize() > 0;
+    }
+    return journal && journal->hasPending();
+}
+
+bool FileManager::isSaving() const {
+    return backgroundSave != nullptr;
+}
+
+bool FileManager::pollSave() {
+    if (!backgroundSave || !backgroundSave->finished) {
+        return false;
+    }
+    completeSave();
+    return true;
+}
+
+void FileManager::waitForSave() {
+    if (backgroundSave) {
+        completeSave();
+    }
+}
 
-    std::ofstream file(fileName);
+// The edits made during the write are handed to the new journal, as if they were made after the save
+void FileManager::completeSave() {
+    std::unique_ptr<BackgroundSave> save = std::move(backgroundSave);
+    save->worker.join();
+    spreadsheet->releaseSnapshot(std::move(save->snapshot));
+
+    if (!save->error.empty()) {
+        // The journal of the current file received every edit, so nothing is lost
+        spreadsheet->setEditObserver(journal.get());
+        spreadsheet->setStatusMessage("Save failed: " + save->error);
+        return;
+    }
+    startJournal(save->fileName);
+    for (int i = 0; i < save->edits.getSize(); ++i) {
+        const BackgroundSave::Edit& edit = save->edits[i];
+        journal->onCellEdited(edit.row, edit.col, edit.content);
+    }
+    for (int i = 0; i < save->precisionChanges.getSize(); ++i) {
+        journal->onColumnPrecisionChanged(save->precisionChanges[i]);
+    }
+    spreadsheet->setStatusMessage("Saved " + save->fileName);
+}
+
+// Writes the sheet as CSV
+// Only the used area is visited, and each row stops at its last non-empty cell. Empty rows in the
+// middle are written as "," so they keep their place, empty rows at the end are not written.
+// Formatting the numbers costs more than writing them, so blocks of rows are formatted on worker
+// threads into their own buffers while this thread writes the finished blocks in row order.
+// The blocks are formatted the same way on any thread, so the file does not depend on the count.
+void FileManager::writeCsv(const GTUSpreadsheet::SheetSnapshot& sheet, const std::string& fileName, int threads) {
+    std::ofstream file(fileName, std::ios::binary);
     if (!file.is_open()) {
         throw std::runtime_error("Error: Could not open file for writing.");
     }
 
+    int usedRows = sheet.getUsedRows();
+    int blockCount = (usedRows + EXPORT_BLOCK_ROWS - 1) / EXPORT_BLOCK_ROWS;
+    if (threads <= 0) {
+        threads = static_cast<int>(std::thread::hardware_concurrency());
+    }
+    threads = std::min(threads, blockCount / 2); // Small sheets are formatted on this thread
+
+    int pendingEmptyRows = 0; // Empty rows not written yet; dropped if nothing follows them
+    auto writeRows = [&](const FormattedRows& rows) {
+        if (rows.contentEnd == 0) {
+            pendingEmptyRows += rows.trailingEmptyRows;
+            return;
+        }
+        std::string emptyRows;
+        for (; pendingEmptyRows > 0; --pendingEmptyRows) {
+            emptyRows += ",\n";
+        }
+        file.write(emptyRows.data(), emptyRows.size());
+        file.write(rows.text.data(), rows.contentEnd);
+        pendingEmptyRows = rows.trailingEmptyRows;
+        if (!file) {
+            throw std::runtime_error("write failed");
+        }
+    };
+
     try {
-        // Iterate through each cell in the spreadsheet and write its content to the file
-        for (int i = 0; i < spreadsheet->getTotalRows(); ++i) {
-            for (int j = 0; j < spreadsheet->getTotalCols(); ++j) {
-                auto cell = spreadsheet->getCell(i, j);
-                if (cell) {
-                    file << cell->getContent(); // Write the content of the cell
+        if (threads <= 1) {
+            FormattedRows rows;
+            for (int block = 0; block < blockCount; ++block) {
+                int firstRow = block * EXPORT_BLOCK_ROWS;
+                formatRows(sheet, firstRow, std::min(firstRow + EXPORT_BLOCK_ROWS, usedRows), rows);
+                writeRows(rows);
+            }
+        } else {
+            // A worker takes the next block once the block that used its buffer was written, so
+            // at most 'ringSize' blocks are held in memory however far the writer falls behind
+            int ringSize = 2 * threads;
+            std::unique_ptr<FormattedRows[]> ring(new FormattedRows[ringSize]);
+            std::unique_ptr<bool[]> ready(new bool[ringSize]());
+            std::mutex mutex;
+            std::condition_variable changed;
+            int nextBlock = 0;
+            int writtenBlocks = 0;
+            bool stop = false;
+            std::exception_ptr error;
+
+            auto work = [&]() {
+                for (;;) {
+                    int block;
+                    {
+                        std::unique_lock<std::mutex> lock(mutex);
+                        changed.wait(lock, [&]() {
+                            return stop || nextBlock >= blockCount || nextBlock < writtenBlocks + ringSize;
+                        });
+                        if (stop || nextBlock >= blockCount) return;
+                        block = nextBlock++;
+                    }
+                    int firstRow = block * EXPORT_BLOCK_ROWS;
+                    try {
+                        formatRows(sheet, firstRow, std::min(firstRow + EXPORT_BLOCK_ROWS, usedRows), ring[block % ringSize]);
+                    } catch (...) {
+                        std::lock_guard<std::mutex> lock(mutex);
+                        if (!error) error = std::current_exception();
+                        stop = true;
+                        changed.notify_all();
+                        return;
+                    }
+                    {
+                        std::lock_guard<std::mutex> lock(mutex);
+                        ready[block % ringSize] = true;
+                    }
+                    changed.notify_all();
+                }
+            };
+
+            std::unique_ptr<std::thread[]> workers(new std::thread[threads]);
+            int started = 0;
+            try {
+                for (; started < threads; ++started) {
+                    workers[started] = std::thread(work);
                 }
-                if (j < spreadsheet->getTotalCols() - 1) {
-                    file << ",";  // Add a comma between cell values
+                for (int block = 0; block < blockCount; ++block) {
+                    int slot = block % ringSize;
+                    {
+                        std::unique_lock<std::mutex> lock(mutex);
+                        changed.wait(lock, [&]() { return stop || ready[slot]; });
+                        if (stop) break;
+                    }
+                    writeRows(ring[slot]);
+                    {
+                        std::lock_guard<std::mutex> lock(mutex);
+                        ready[slot] = false;
+                        ++writtenBlocks;
+                    }
+                    changed.notify_all();
                 }
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (!error) error = std::current_exception();
+                stop = true;
+                changed.notify_all();
+            }
+            for (int i = 0; i < started; ++i) {
+                workers[i].join();
+            }
+            if (error) {
+                std::rethrow_exception(error);
             }
-            file << "\n";  // Add a newline after each row
         }
     } catch (const std::exception& e) {
         file.close();
         throw std::runtime_error("Error while writing to file: " + std::string(e.what()));
     }
 
+    // The last buffered block is only written by close(); if that fails the file is cut short
     file.close();
-    currentFileName = fileName; // Set the current file name to the specified file name
+    if (!file) {
+        throw std::runtime_error("Error while writing to file: close failed");
+    }
+}
+
+// Cells format themselves into the buffer of the block, which keeps its memory from block to block
+void FileManager::formatRows(const GTUSpreadsheet::SheetSnapshot& sheet, int firstRow, int lastRow, FormattedRows& rows) {
+    GTUSpreadsheet::SheetSnapshot::Reader reader(sheet);
+    std::string& buffer = rows.text;
+    std::string quoted; // Values that need quoting are copied here first
+    int usedCols = sheet.getUsedCols();
+    buffer.clear();
+    rows.contentEnd = 0;
+    rows.trailingEmptyRows = 0;
+
+    for (int i = firstRow; i < lastRow; ++i) {
+        std::size_t rowStart = buffer.size();
+        std::size_t rowEnd = rowStart; // End of the last non-empty field of the row
+        for (int j = 0; j < usedCols; ++j) {
+            if (j > 0) {
+                buffer += ',';  // Add a comma between cell values
+            }
+            const Cell* cell = reader.peekCell(i, j);
+            if (!cell) continue;
+
+            std::size_t fieldStart = buffer.size();
+            cell->appendFormatted(buffer, sheet.getColumnPrecision(j)); // Write the content of the cell
+            if (buffer.size() == fieldStart) continue;
+
+            // Values that contain commas, quotes or line breaks are quoted so they load back unchanged
+            std::string_view value(buffer.data() + fieldStart, buffer.size() - fieldStart);
+            if (CsvTokenizer::needsQuotes(value)) {
+                quoted.assign(value.data(), value.size());
+                buffer.resize(fieldStart);
+                CsvTokenizer::appendField(buffer, quoted);
+            }
+            rowEnd = buffer.size();
+        }
+        buffer.resize(rowEnd); // Drop the trailing empty columns
+
+        if (rowEnd == rowStart) {
+            buffer += ",\n";
+            ++rows.trailingEmptyRows;
+            continue;
+        }
+        buffer += '\n';  // Add a newline after each row
+        rows.contentEnd = buffer.size();
+        rows.trailingEmptyRows = 0;
+    }
 }
 
-// Load a spreadsheet from a specified file (CSV format)
-// Load a spreadsheet from a specified file (CSV format) with proper resizing
+// ofstream cannot fsync, so the finished file is reopened for it
+void FileManager::syncToDisk(const std::string& fileName) {
+    int fd = ::open(fileName.c_str(), O_RDONLY);
+    if (fd < 0 || ::fsync(fd) != 0) {
+        if (fd >= 0) ::close(fd);
+        throw std::runtime_error("Error: Could not flush file to disk: " + fileName);
+    }
+    ::close(fd);
+}
+
+// Load a spreadsheet from a specified file (CSV format, or the binary workbook for ".gtuw" names)
+// The file is memory-mapped and split at line breaks into chunks, one per import thread.
+// Each worker parses its chunk into a ParsedChunk; the main thread then sizes the grid once,
+// stitches the chunks in file order and commits, which evaluates every formula once.
+// In paged mode this is done for one window of the file at a time.
 void FileManager::loadFile(const std::string& fileName) {
+    loadFile(fileName, ImportSchema());
+}
+
+// Same as loadFile, with every field converted according to the schema
+void FileManager::loadFile(const std::string& fileName, const ImportSchema& schema) {
     if (!spreadsheet) {
         throw std::runtime_error("Spreadsheet instance is not initialized.");
     }
 
-    std::ifstream file(fileName);
-    if (!file.is_open()) {
-        throw std::runtime_error("Error: Could not open file for reading: " + fileName);
+    waitForSave();
+    detachJournal(); // Loading is not an edit
+    detachLazyFile();
+
+    if (WorkbookFile::isWorkbookName(fileName)) {
+        struct stat info;
+        if (::stat(fileName.c_str(), &info) == 0) {
+            enablePagingIfLarge(fileName, static_cast<std::size_t>(info.st_size));
+        }
+        WorkbookFile::load(spreadsheet, fileName);
+        openJournal(fileName);
+        return;
+    }
+
+    MappedFile file(fileName);
+    std::string_view text = file.contents();
+
+    enablePagingIfLarge(fileName, text.size());
+    // A paged load parses one window at a time so the parsed cells never hold the whole file
+    std::size_t windowBytes = spreadsheet->isPaged() ? PAGED_LOAD_WINDOW_BYTES : text.size();
+
+    int threads = importThreads > 0 ? importThreads : static_cast<int>(std::thread::hardware_concurrency());
+    if (threads < 1 || text.size() < PARALLEL_IMPORT_MIN_BYTES) {
+        threads = 1;
     }
 
     try {
-        std::cout << "Starting to load file: " << fileName << std::endl;
         spreadsheet->clear();
 
-        std::string line;
-        int maxRow = 0, maxCol = 0;
-
-        // First pass - Determine grid dimensions
-        while (std::getline(file, line)) {
-            // Trim any trailing whitespace or carriage returns
-            while (!line.empty() && (line.back() == '\r' || line.back() == ' ')) {
-                line.pop_back();
-            }
-            
-            if (line.empty()) continue;
-
-            std::istringstream ss(line);
-            std::string cellContent;
-            int col = 0;
-            
-            while (std::getline(ss, cellContent, ',')) {
-                // Trim any whitespace from the cell content
-                while (!cellContent.empty() && (cellContent.back() == ' ' || cellContent.back() == '\r')) {
-                    cellContent.pop_back();
-                }
-                col++;
+        // The cells are queued in a batch so the dependency graph is built once
+        // and every formula is evaluated once at the end
+        spreadsheet->beginBatch();
+        int firstRow = 0, maxCol = 0;
+        std::size_t windowStart = 0;
+        while (windowStart < text.size()) {
+            // Windows start at record boundaries, so the quote parity at the cut is local to the window
+            std::size_t windowEnd = text.size();
+            if (text.size() - windowStart > windowBytes) {
+                std::size_t cut = windowStart + windowBytes;
+                bool inQuotes = std::count(text.begin() + windowStart, text.begin() + cut, '"') % 2 == 1;
+                windowEnd = findRecordEnd(text, cut, inQuotes);
             }
-            maxRow++;
-            maxCol = std::max(maxCol, col);
-        }
+            std::string_view window = text.substr(windowStart, windowEnd - windowStart);
 
-        std::cout << "Detected dimensions: " << maxRow << " rows x " << maxCol << " columns" << std::endl;
-        
-        // Reset file pointer and clear any error flags
-        file.clear();
-        file.seekg(0);
+            std::unique_ptr<std::string_view[]> chunkTexts;
+            int chunkCount = splitIntoChunks(window, threads, chunkTexts);
+            std::unique_ptr<ParsedChunk[]> chunks(new ParsedChunk[chunkCount]);
 
-        // Resize the grid
-        spreadsheet->resizeGrid(maxRow, maxCol);
+            if (chunkCount == 1) {
+                parseChunk(chunkTexts[0], chunks[0], schema);
+            } else {
+                runOnThreads(chunkCount, [&](int i) { parseChunk(chunkTexts[i], chunks[i], schema); });
+            }
 
-        // Second pass - Load the data
-        int row = 0;
-        while (std::getline(file, line)) {
-            // Trim trailing whitespace or carriage returns
-            while (!line.empty() && (line.back() == '\r' || line.back() == ' ')) {
-                line.pop_back();
-            }
-            
-            if (line.empty()) continue;
-
-            std::istringstream ss(line);
-            std::string cellContent;
-            int col = 0;
-
-            while (std::getline(ss, cellContent, ',')) {
-                // Trim whitespace
-                while (!cellContent.empty() && (cellContent.back() == ' ' || cellContent.back() == '\r')) {
-                    cellContent.pop_back();
-                }
-                
-                if (!cellContent.empty() && row < maxRow && col < maxCol) {
+            // The sheet takes the dimensions of the file, growing once per window
+            int windowRows = 0;
+            for (int i = 0; i < chunkCount; ++i) {
+                windowRows += chunks[i].rowCount;
+                maxCol = std::max(maxCol, chunks[i].maxCol);
+            }
+            if (windowRows > 0) {
+                spreadsheet->resizeGrid(firstRow + windowRows, maxCol);
+            }
+
+            for (int i = 0; i < chunkCount; ++i) {
+                ParsedChunk& chunk = chunks[i];
+                int formulaIndex = 0;
+                for (int f = 0; f < chunk.cells.getSize(); ++f) {
+                    int row = firstRow + chunk.rows[f];
+                    int col = chunk.cols[f];
                     try {
-                        spreadsheet->setCellContent(row, col, cellContent);
+                        if (chunk.cells[f]) {
+                            // Values are final; only the formulas need to go through the batch
+                            spreadsheet->restoreCell(row, col, chunk.cells[f]);
+                        } else {
+                            spreadsheet->setCellContent(row, col, chunk.formulas[formulaIndex++]);
+                        }
                     } catch (const std::exception& e) {
-                        std::cerr << "Warning: Failed to set content at (" << row << "," << col 
-                                << "): " << e.what() << std::endl;
+                        std::cerr << "Warning: Failed to set content at (" << row << "," << col
+                                  << "): " << e.what() << std::endl;
                     }
                 }
-                col++;
+                firstRow += chunk.rowCount;
+                chunk = ParsedChunk(); // Release the buffers of the stitched chunk
             }
-            row++;
-        }
 
-        std::cout << "File loaded successfully" << std::endl;
+            windowStart = windowEnd;
+            if (spreadsheet->isPaged()) {
+                file.release(windowStart); // The cells now live in the page file
+            }
+        }
+        spreadsheet->commit();
 
     } catch (const std::exception& e) {
-        file.close();
+        if (spreadsheet->isBatching()) {
+            spreadsheet->commit(); // Keep whatever was loaded consistent
+        }
         throw std::runtime_error("Error while reading from file: " + std::string(e.what()));
     }
 
-    file.close();
+    if (schema.hasSkippedColumns()) {
+        // Saving this sheet over the file would drop the skipped columns, and the journal's
+        // positions are those of the whole file
+        currentFileName = "";
+        return;
+    }
+    openJournal(fileName);
+}
+
+// A file that does not fit the memory budget is loaded into a page file next to it
+// The sheet stays paged afterwards, also for smaller files
+void FileManager::enablePagingIfLarge(const std::string& fileName, std::size_t fileBytes) {
+    if (pagedMemoryBudget == 0 || spreadsheet->isPaged() || fileBytes <= pagedMemoryBudget) {
+        return;
+    }
+    spreadsheet->clear();
+    spreadsheet->enablePaging(fileName + ".pages", pagedMemoryBudget, encodedMemoryBudget);
+}
+
+// The sheet is paged, so only the rows in use take memory; the first rows are indexed and
+// parsed right away so the first frame can be drawn, the rest is indexed while the user is idle
+void FileManager::openFile(const std::string& fileName) {
+    if (!spreadsheet) {
+        throw std::runtime_error("Spreadsheet instance is not initialized.");
+    }
+
+    waitForSave();
+    detachJournal(); // Loading is not an edit
+    detachLazyFile();
+
+    std::unique_ptr<LazyCsvFile> opened(new LazyCsvFile(*spreadsheet, fileName));
+    spreadsheet->clear();
+    if (!spreadsheet->isPaged()) {
+        spreadsheet->enablePaging(fileName + ".pages",
+                                  pagedMemoryBudget > 0 ? pagedMemoryBudget : defaultPagedMemoryBudget(),
+                                  encodedMemoryBudget);
+    }
+
+    // The sheet takes the dimensions of the rows found so far; the first block sets the columns
+    opened->indexRows(2 * LazyCsvFile::BLOCK_ROWS);
+    if (opened->getIndexedRows() > 0) {
+        spreadsheet->resizeGrid(opened->getIndexedRows(), 1);
+    }
+    lazyFile = std::move(opened);
+    spreadsheet->setRowSource(lazyFile.get());
+    spreadsheet->peekCell(0, 0);
+
+    openJournal(fileName);
+}
+
+bool FileManager::isIndexing() const {
+    return lazyFile && !lazyFile->isIndexed();
+}
+
+void FileManager::runIndexSlice(int budgetMs) {
+    if (lazyFile) {
+        lazyFile->indexSlice(budgetMs);
+    }
+}
+
+void FileManager::finishLazyFile() {
+    if (!lazyFile) return;
+    lazyFile->loadAll();
+    detachLazyFile();
+}
+
+void FileManager::detachLazyFile() {
+    if (lazyFile && spreadsheet) {
+        spreadsheet->setRowSource(nullptr);
+    }
+    lazyFile.reset();
+}
+
+// Replays the edits saved to the journal after the file was last written, then records new ones
+void FileManager::openJournal(const std::string& fileName) {
+    std::unique_ptr<EditJournal> opened(new EditJournal(fileName, WorkbookFile::isWorkbookName(fileName)));
+    try {
+        opened->replay(*spreadsheet);
+    } catch (const std::exception& e) {
+        throw std::runtime_error("Error while replaying journal: " + std::string(e.what()));
+    }
+    journal = std::move(opened);
+    spreadsheet->setEditObserver(journal.get());
     currentFileName = fileName;
 }
 
+// Scans forward from pos, which is inside quotes if inQuotes is set
+// Returns the offset just past the first line break outside quotes, or the end of the text
+std::size_t FileManager::findRecordEnd(std::string_view text, std::size_t pos, bool inQuotes) {
+    for (; pos < text.size(); ++pos) {
+        if (text[pos] == '"') {
+            inQuotes = !inQuotes;
+        } else if (text[pos] == '\n' && !inQuotes) {
+            return pos + 1;
+        }
+    }
+    return text.size();
+}
+
+// A thread that is still joinable when it is destroyed ends the program, so every started thread
+// is joined before an exception leaves; the tasks hand their exceptions over the same way
+void FileManager::runOnThreads(int count, const std::function<void(int)>& task) {
+    std::unique_ptr<std::thread[]> workers(new std::thread[count]);
+    std::unique_ptr<std::exception_ptr[]> errors(new std::exception_ptr[count]);
+    std::exception_ptr startError;
+    int started = 0;
+    try {
+        for (; started < count; ++started) {
+            workers[started] = std::thread([&task, &errors](int i) {
+                try {
+                    task(i);
+                } catch (...) {
+                    errors[i] = std::current_exception();
+                }
+            }, started);
+        }
+    } catch (...) {
+        startError = std::current_exception();
+    }
+    for (int i = 0; i < started; ++i) {
+        workers[i].join();
+    }
+    if (startError) {
+        std::rethrow_exception(startError);
+    }
+    for (int i = 0; i < count; ++i) {
+        if (errors[i]) {
+            std::rethrow_exception(errors[i]);
+        }
+    }
+}
+
+// Cuts the text near every 1/count of its size, moving each cut forward to the next line break
+// that is not inside a quoted field. The quote parity at each nominal cut comes from
+// counting the quotes of the preceding pieces, which is done on one thread per piece
+int FileManager::splitIntoChunks(std::string_view text, int count, std::unique_ptr<std::string_view[]>& chunks) {
+    if (count < 1 || text.size() < static_cast<std::size_t>(count)) {
+        count = 1;
+    }
+    std::unique_ptr<std::size_t[]> nominal(new std::size_t[count + 1]);
+    for (int i = 0; i <= count; ++i) {
+        nominal[i] = text.size() / count * i;
+    }
+    nominal[count] = text.size();
+
+    std::unique_ptr<std::size_t[]> quotes(new std::size_t[count]());
+    if (count > 1) {
+        runOnThreads(count, [&](int i) {
+            quotes[i] = std::count(text.begin() + nominal[i], text.begin() + nominal[i + 1], '"');
+        });
+    }
+
+    chunks.reset(new std::string_view[count]);
+    int chunkCount = 0;
+    std::size_t start = 0;
+    std::size_t quotesBefore = 0; // Quotes in the pieces before nominal[i]
+    for (int i = 1; i <= count && start < text.size(); ++i) {
+        std::size_t end = text.size();
+        if (i < count) {
+            quotesBefore += quotes[i - 1];
+            // A cut that starts before the previous chunk ended continues from there, outside quotes
+            std::size_t pos = std::max(nominal[i], start);
+            bool inQuotes = pos == nominal[i] ? (quotesBefore % 2 == 1) : false;
+            end = findRecordEnd(text, pos, inQuotes);
+        }
+        chunks[chunkCount++] = text.substr(start, end - start);
+        start = end;
+    }
+    if (chunkCount == 0) {
+        chunks[chunkCount++] = std::string_view();
+    }
+    return chunkCount;
+}
+
+// Splits the chunk into records and fields with the CSV tokenizer
+// Blank lines are skipped, unquoted fields are trimmed on the right,
+// and a trailing comma does not start another field
+// Fields of skipped columns are stepped over without being decoded
+void FileManager::parseChunk(std::string_view text, ParsedChunk& chunk, const ImportSchema& schema) {
+    CsvTokenizer tokenizer(text);
+    std::string scratch; // Holds quoted fields whose doubled quotes were collapsed
+    std::string_view raw;
+    bool endOfRecord;
+    int col = 0;
+    bool lastFieldEmpty = false; // Last field of the record so far was empty and unquoted
+
+    while (tokenizer.nextField(raw, endOfRecord)) {
+        int target = schema.getTargetColumn(col);
+        if (target >= 0) {
+            bool quoted;
+            std::string_view field = CsvTokenizer::decodeField(raw, scratch, quoted);
+            lastFieldEmpty = field.empty() && !quoted;
+            if (!field.empty()) {
+                addField(chunk, target, field, schema.getColumnType(col));
+            }
+        } else {
+            // Whether a skipped field is blank only matters for blank-line detection
+            lastFieldEmpty = raw.find_first_not_of(" \r") == std::string_view::npos;
+        }
+        col++;
+
+        if (endOfRecord) {
+            // A record made of one empty field is a blank line
+            if (col == 1 && lastFieldEmpty) {
+                col = 0;
+                continue;
+            }
+            int fieldCount = (lastFieldEmpty && col > 1) ? col - 1 : col;
+            chunk.maxCol = std::max(chunk.maxCol, schema.countTargetColumns(fieldCount));
+            chunk.rowCount++;
+            col = 0;
+        }
+    }
+}
+
+// Declared columns are converted directly; a value that does not match its declared type
+// (e.g. "n/a" in an integer column) is classified like an undeclared field instead of being lost
+void FileManager::addField(ParsedChunk& chunk, int col, std::string_view field, ImportSchema::ColumnType type) {
+    std::shared_ptr<Cell> cell;
+    long long intValue;
+    double doubleValue;
+    switch (type) {
+        case ImportSchema::ColumnType::Int64:
+            if (GTUSpreadsheet::Spreadsheet::parseInteger(field, intValue)) {
+                cell = std::make_shared<IntValueCell>(intValue);
+            }
+            break;
+        case ImportSchema::ColumnType::Double:
+            if (GTUSpreadsheet::Spreadsheet::parseDecimal(field, doubleValue)) {
+                cell = std::make_shared<DoubleValueCell>(doubleValue);
+            }
+            break;
+        case ImportSchema::ColumnType::Label:
+            cell = std::make_shared<StringValueCell>(std::string(field));
+            break;
+        case ImportSchema::ColumnType::Formula:
+            chunk.rows.pushBack(chunk.rowCount);
+            chunk.cols.pushBack(col);
+            chunk.cells.pushBack(nullptr);
+            chunk.formulas.pushBack(std::string(field));
+            return;
+        default:
+            break;
+    }
+
+    chunk.rows.pushBack(chunk.rowCount);
+    chunk.cols.pushBack(col);
+    if (cell) {
+        chunk.cells.pushBack(cell);
+    } else if (GTUSpreadsheet::Spreadsheet::isFormulaText(field)) {
+        chunk.cells.pushBack(nullptr);
+        chunk.formulas.pushBack(std::string(field));
+    } else {
+        chunk.cells.pushBack(GTUSpreadsheet::Spreadsheet::makeValueCell(field));
+    }
+}
+
+// Sets the number of parser threads; 0 picks one per core
+void FileManager::setImportThreads(int threads) {
+    importThreads = threads < 0 ? 0 : threads;
+}
+
+// Returns the configured number of parser threads
+int FileManager::getImportThreads() const {
+    return importThreads;
+}
+
+// Sets the number of export threads; 0 picks one per core
+void FileManager::setExportThreads(int threads) {
+    exportThreads = threads < 0 ? 0 : threads;
+}
+
+int FileManager::getExportThreads() const {
+    return exportThreads;
+}
+
+void FileManager::setPagedMemoryBudget(std::size_t bytes) {
+    pagedMemoryBudget = bytes;
+}
+
+std::size_t FileManager::getPagedMemoryBudget() const {
+    return pagedMemoryBudget;
+}
+
+void FileManager::setEncodedMemoryBudget(std::size_t bytes) {
+    encodedMemoryBudget = bytes;
+}
+
+std::size_t FileManager::getEncodedMemoryBudget() const {
+    return encodedMemoryBudget;
+}
+
+// Leaves room for the dependency graph, the formula programs and the page cache of the kernel
+std::size_t FileManager::defaultPagedMemoryBudget() {
+    long pages = sysconf(_SC_PHYS_PAGES);
+    long pageSize = sysconf(_SC_PAGESIZE);
+    if (pages <= 0 || pageSize <= 0) {
+        return 0;
+    }
+    return static_cast<std::size_t>(pages) / 4 * static_cast<std::size_t>(pageSize);
+}
+
 
 // Get the current file name (if a file is loaded or saved)
 std::string FileManager::getCurrentFileName() const {
@@ -3,36 +3,222 @@
 
 #include <string>
 #include <memory>
+#include <string_view>
+#include <functional>
+#include "Custom1DArray.h"
+#include "ImportSchema.h"
 
-
+class Cell;
 
 namespace GTUSpreadsheet {
 class Spreadsheet;
+class SheetSnapshot;
 }
 
 namespace Utils{
 
+class EditJournal;
+class LazyCsvFile;
+
 class FileManager {
 private:
     std::shared_ptr<GTUSpreadsheet::Spreadsheet> spreadsheet; // Pointer to the spreadsheet instance
     std::string currentFileName;                              // Name of the current file
+    int importThreads;                                        // Threads used by loadFile, 0 = one per core
+    int exportThreads;                                        // Threads that format a CSV file, 0 = one per core
+    std::unique_ptr<EditJournal> journal;                     // Edits since the file was last written
+    std::size_t pagedMemoryBudget;                            // Larger files are loaded in paged mode, 0 = never
+    std::size_t encodedMemoryBudget;                          // Encoded cold tiles in paged mode, 0 = none
+    std::unique_ptr<LazyCsvFile> lazyFile;                    // File opened with openFile, rows not all read yet
+
+    // A full write running on a background thread (see saveInBackground)
+    struct BackgroundSave;
+    std::unique_ptr<BackgroundSave> backgroundSave;
+
+    // Rows parsed from one piece of the file, stored column-wise (one entry per non-empty field)
+    // Value cells are already built by the worker; formulas are kept as text for the main thread
+    struct ParsedChunk {
+        int rowCount = 0;                              // Non-blank lines in the chunk
+        int maxCol = 0;                                // Widest line, in fields
+        DynamicArray<int> rows;                        // Row of the field, relative to the chunk
+        DynamicArray<int> cols;                        // Column of the field
+        DynamicArray<std::shared_ptr<Cell>> cells;     // Value cell, or nullptr for a formula
+        DynamicArray<std::string> formulas;            // Formula text when the cell is nullptr
+    };
+
+    // Rows formatted as CSV by one export worker; writeCsv writes them out in order
+    struct FormattedRows {
+        std::string text;               // Each row ends with a line break, empty rows are ","
+        std::size_t contentEnd = 0;     // End of the last non-empty row, 0 if every row is empty
+        int trailingEmptyRows = 0;      // Empty rows after contentEnd
+    };
+
+    // The export formats the rows in blocks of this many rows, one block per worker at a time
+    static const int EXPORT_BLOCK_ROWS = 4096;
+
+    // Files smaller than this are parsed on the calling thread only
+    static const std::size_t PARALLEL_IMPORT_MIN_BYTES = 1 << 20;
+
+    // A paged load parses and stores this much of the file at a time
+    static const std::size_t PAGED_LOAD_WINDOW_BYTES = 64 << 20;
+
+    // saveFile() appends to the journal until it is larger than this and a quarter of the file
+    static const std::size_t JOURNAL_COMPACT_MIN_BYTES = 4 << 20;
+
+    // Writes the used area of the snapshot as CSV, formatting the rows on up to 'threads' threads
+    static void writeCsv(const GTUSpreadsheet::SheetSnapshot& sheet, const std::string& fileName, int threads);
+
+    // Formats the rows [firstRow, lastRow) of the used area; runs on an export worker
+    static void formatRows(const GTUSpreadsheet::SheetSnapshot& sheet, int firstRow, int lastRow, FormattedRows& rows);
+
+    // Writes the snapshot to "<file>.tmp", flushes it and renames it over the file
+    // Only reads the snapshot, so it runs on the background thread of a save
+    static void writeSnapshot(const GTUSpreadsheet::SheetSnapshot& sheet, const std::string& fileName, int threads);
+
+    // Returns true if saveFile() may append to the journal instead of rewriting the file
+    bool journalHasRoom() const;
+
+    // Starts an empty journal for a file that was just rewritten and makes it the current file
+    void startJournal(const std::string& fileName);
+
+    // Joins the finished background save, starts the journal of the written file (or keeps the
+    // old one if the write failed) and reports the result in the status line
+    void completeSave();
+
+    // Flushes a written file to disk
+    static void syncToDisk(const std::string& fileName);
+
+    // Replays the journal of a loaded file and starts recording edits for it
+    void openJournal(const std::string& fileName);
+
+    // Switches the sheet to paged mode if the file is larger than the paged-mode budget
+    void enablePagingIfLarge(const std::string& fileName, std::size_t fileBytes);
+
+    // Stops recording edits and closes the journal
+    void detachJournal();
+
+    // Reads the rest of a lazily opened file into the sheet and closes it
+    void finishLazyFile();
+
+    // Closes a lazily opened file without reading the rest (the sheet is about to be replaced)
+    void detachLazyFile();
+
+    // The lazily opened file parses its blocks with parseChunk
+    friend class LazyCsvFile;
+
+    // Returns the offset just past the next line break outside double quotes
+    static std::size_t findRecordEnd(std::string_view text, std::size_t pos, bool inQuotes);
+
+    // Runs task(0) .. task(count - 1), each on its own thread, and waits for all of them
+    // If a thread cannot be started or a task throws, the started threads are still joined
+    // and the first exception is rethrown
+    static void runOnThreads(int count, const std::function<void(int)>& task);
+
+    // Splits the text into up to 'count' chunks that end at line breaks outside double quotes
+    static int splitIntoChunks(std::string_view text, int count, std::unique_ptr<std::string_view[]>& chunks);
+
+    // Parses the lines of one chunk; runs on a worker thread and only reads the schema
+    static void parseChunk(std::string_view text, ParsedChunk& chunk, const ImportSchema& schema);
+
+    // Stores one decoded field, converting it as its column is declared
+    static void addField(ParsedChunk& chunk, int col, std::string_view field, ImportSchema::ColumnType type);
 
 public:
     // Constructor
     explicit FileManager(std::shared_ptr<GTUSpreadsheet::Spreadsheet> sheet);
 
+    // Detaches the journal from the spreadsheet
+    ~FileManager();
+
+    FileManager(const FileManager&) = delete;
+    FileManager& operator=(const FileManager&) = delete;
+
     // Create a new file
     void makeNewFile();
 
     // Save the spreadsheet to the current file
+    // Appends the edits since the last save to "<file>.journal" instead of rewriting the file
     void saveFile();
 
     // Save the spreadsheet to a specified file
     void saveFileAs(const std::string& fileName);
 
+    // Saves like saveFile() (same name as the current file) or saveFileAs() without blocking:
+    // appending the edits to the journal is done right away, a full write of the file is done
+    // from a snapshot of the sheet on a background thread while the sheet can still be edited
+    // The result is shown in the status line when pollSave() sees the write finish
+    // While an earlier write is still running nothing is saved and the status line says so
+    void saveInBackground(const std::string& fileName);
+
+    // Saves the edits made since the last save with saveInBackground(); does nothing if there is
+    // no current file, nothing to save or a save is still running
+    void autosave();
+
+    // Returns true if the current file has edits that were not saved yet
+    bool hasUnsavedEdits() const;
+
+    // Returns true while a background save is running or waiting for pollSave()
+    bool isSaving() const;
+
+    // Completes a background save whose write has finished; returns true if one was completed
+    bool pollSave();
+
+    // Waits for a background save and completes it (e.g. before the sheet is replaced)
+    void waitForSave();
+
     // Load a spreadsheet from a specified file
+    // Large files are split into chunks that are parsed on several threads
+    // A file larger than the paged-mode memory budget switches the sheet to paged mode
+    // Edits saved to the file's journal are replayed on top of it
     void loadFile(const std::string& fileName);
 
+    // Load a spreadsheet using declared column types; skipped columns are not loaded at all
+    // With skipped columns the sheet is not bound to the file: its journal is neither replayed
+    // nor continued, and the sheet has no current file name, so it is only saved with saveFileAs
+    void loadFile(const std::string& fileName, const ImportSchema& schema);
+
+    // Open a CSV file without parsing it: only its row offsets are indexed and rows are parsed
+    // when they are shown or read by a formula; the sheet is switched to paged mode
+    // The rest of the file is read in before it is saved with saveFileAs
+    void openFile(const std::string& fileName);
+
+    // Returns true while a lazily opened file is not fully indexed
+    bool isIndexing() const;
+
+    // Indexes more of a lazily opened file for about budgetMs (called while the user is idle)
+    void runIndexSlice(int budgetMs);
+
+    // Sets the number of threads used to parse a file; 0 uses one per core, 1 disables the parallel import
+    void setImportThreads(int threads);
+
+    // Returns the configured number of import threads (0 = one per core)
+    int getImportThreads() const;
+
+    // Sets the number of threads that format a CSV file when it is saved; 0 uses one per core
+    // The output is the same for any number of threads
+    void setExportThreads(int threads);
+
+    // Returns the configured number of export threads (0 = one per core)
+    int getExportThreads() const;
+
+    // Files larger than the budget are loaded in paged mode: the cells are kept in a page file
+    // next to the loaded file, with at most about this many bytes of them in memory; 0 disables it
+    void setPagedMemoryBudget(std::size_t bytes);
+
+    // Returns the paged-mode memory budget in bytes (0 = disabled)
+    std::size_t getPagedMemoryBudget() const;
+
+    // In paged mode, tiles without formulas that leave the cache are kept column-encoded in memory,
+    // up to about this many bytes, instead of being written to the page file; 0 disables it
+    // Applies to the sheets switched to paged mode afterwards
+    void setEncodedMemoryBudget(std::size_t bytes);
+
+    // Returns the budget of the encoded tiles in bytes (0 = disabled)
+    std::size_t getEncodedMemoryBudget() const;
+
+    // A quarter of the physical memory
+    static std::size_t defaultPagedMemoryBudget();
+
     // Get the current file name
     std::string getCurrentFileName() const;
 };
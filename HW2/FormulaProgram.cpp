@@ -0,0 +1,320 @@
+#include "FormulaProgram.h"
+#include <algorithm>
+#include <cctype>
+#include <stdexcept>
+
+// Programs are only created through compile()
+FormulaProgram::FormulaProgram()
+    : kind(Kind::Empty), aggregate(Aggregate::None),
+      rangeStartRow(0), rangeStartCol(0), rangeEndRow(0), rangeEndCol(0) {}
+
+// Parses letters followed by digits; the column letters are case-insensitive
+bool FormulaProgram::parseReference(const string& text, int& row, int& col) {
+    size_t i = 0;
+    long long column = 0;
+    while (i < text.size() && isalpha(static_cast<unsigned char>(text[i]))) {
+        column = column * 26 + (toupper(static_cast<unsigned char>(text[i])) - 'A' + 1);
+        if (column > 1000000) return false; // Far beyond any grid, treat as plain text
+        ++i;
+    }
+    if (i == 0 || i >= text.size()) return false;
+
+    long long number = 0;
+    size_t digitStart = i;
+    while (i < text.size() && isdigit(static_cast<unsigned char>(text[i]))) {
+        number = number * 10 + (text[i] - '0');
+        if (number > 1000000000) return false;
+        ++i;
+    }
+    if (i != text.size() || i == digitStart) return false;
+
+    row = static_cast<int>(number) - 1; // Convert to zero-based index
+    col = static_cast<int>(column) - 1;
+    return true;
+}
+
+// Get column label (A, B, ..., Z, AA, AB, ...)
+string FormulaProgram::columnLabel(int col) {
+    string label;
+    while (col >= 0) {
+        label = static_cast<char>(col % 26 + 'A') + label;
+        col = col / 26 - 1;
+    }
+    return label;
+}
+
+// Applies the specified mathematical operator on two numeric operands
+double FormulaProgram::applyOperator(double a, double b, char op) {
+    switch (op) {
+        case '+': return a + b;
+        case '-': return a - b;
+        case '*': return a * b;
+        case '/':
+            if (b == 0) throw runtime_error("Division by zero");
+            return a / b;
+    }
+    throw runtime_error("Unknown operator");
+}
+
+// Every maximal run of letters and digits that forms an A1 reference becomes a relative reference;
+// everything else (operators, spaces, function names, constants) is kept as literal text
+void FormulaProgram::split(const string& formula, int row, int col,
+                           DynamicArray<string>& literals, DynamicArray<pair<int, int>>& references) {
+    string literal;
+    size_t i = 0;
+    while (i < formula.size()) {
+        if (!isalnum(static_cast<unsigned char>(formula[i]))) {
+            literal += formula[i++];
+            continue;
+        }
+        size_t start = i;
+        while (i < formula.size() && isalnum(static_cast<unsigned char>(formula[i]))) ++i;
+        string word = formula.substr(start, i - start);
+
+        int refRow, refCol;
+        if (parseReference(word, refRow, refCol)) {
+            literals.pushBack(literal);
+            literal.clear();
+            references.pushBack(make_pair(refRow - row, refCol - col));
+        } else {
+            literal += word;
+        }
+    }
+    literals.pushBack(literal);
+}
+
+// Joins the literal text with "R[dr]C[dc]" placeholders
+// Formulas whose own text contains brackets could collide with the placeholders, so they get a
+// key that is unique to their position and are simply not shared
+string FormulaProgram::canonicalize(const string& formula, int row, int col) {
+    if (formula.find_first_of("[]") != string::npos) {
+        return "[" + to_string(row) + "," + to_string(col) + "]" + formula;
+    }
+
+    DynamicArray<string> literals;
+    DynamicArray<pair<int, int>> references;
+    split(formula, row, col, literals, references);
+
+    string key = literals[0];
+    for (int i = 0; i < references.getSize(); ++i) {
+        key += "R[" + to_string(references[i].first) + "]C[" + to_string(references[i].second) + "]";
+        key += literals[i + 1];
+    }
+    return key;
+}
+
+// Compiles the formula into one of: empty, arithmetic expression ('='),
+// aggregate function ('@'), plain text, or invalid (always evaluates to #ERROR)
+shared_ptr<const FormulaProgram> FormulaProgram::compile(const string& formula, int row, int col) {
+    shared_ptr<FormulaProgram> program(new FormulaProgram());
+    program->canonical = canonicalize(formula, row, col);
+    if (formula.find_first_of("[]") != string::npos) {
+        program->literals.pushBack(formula); // Not shared, keep the text as written
+    } else {
+        split(formula, row, col, program->literals, program->textReferences);
+    }
+
+    if (formula.empty()) {
+        program->kind = Kind::Empty;
+    } else if (formula.size() > 1 && formula[0] == '@') {
+        program->compileAggregate(formula, row, col);
+    } else if (formula[0] == '=') {
+        program->compileExpression(formula.substr(1), row, col);
+    } else {
+        program->kind = Kind::Text;
+    }
+    return program;
+}
+
+// Parses "@NAME(start..end)" into the function and the relative range bounds
+void FormulaProgram::compileAggregate(const string& formula, int row, int col) {
+    kind = Kind::Invalid;
+    size_t openParen = formula.find('(');
+    size_t closeParen = formula.find(')');
+    if (openParen == string::npos || closeParen == string::npos || closeParen < openParen) return;
+
+    string funcName = formula.substr(1, openParen - 1);
+    string range = formula.substr(openParen + 1, closeParen - openParen - 1);
+    size_t sep = range.find("..");
+    if (sep == string::npos) return;
+
+    int startRow, startCol, endRow, endCol;
+    if (!parseReference(range.substr(0, sep), startRow, startCol) ||
+        !parseReference(range.substr(sep + 2), endRow, endCol)) {
+        return;
+    }
+
+    if (funcName == "SUM" || funcName == "Sum") {
+        aggregate = Aggregate::Sum;
+    } else if (funcName == "AVER" || funcName == "Aver") {
+        aggregate = Aggregate::Average;
+    } else if (funcName == "MAX" || funcName == "Max") {
+        aggregate = Aggregate::Max;
+    } else if (funcName == "MIN" || funcName == "Min") {
+        aggregate = Aggregate::Min;
+    } else if (funcName == "STDDEV" || funcName == "Stddev") {
+        aggregate = Aggregate::StdDev;
+    } else {
+        return; // Unknown function
+    }
+
+    rangeStartRow = startRow - row;
+    rangeStartCol = startCol - col;
+    rangeEndRow = endRow - row;
+    rangeEndCol = endCol - col;
+    kind = Kind::Aggregate;
+}
+
+// Tokenizes the expression and turns every operand into a step
+// Evaluation is left to right; an operator applies to every following operand until the next one
+void FormulaProgram::compileExpression(const string& expression, int row, int col) {
+    DynamicArray<string> tokens;
+    string token;
+    bool inFunction = false; // Inside an "@NAME(...)" token, which is not valid in an expression
+
+    for (size_t i = 0; i < expression.length(); ++i) {
+        char ch = expression[i];
+        if (ch == '@') {
+            if (!token.empty()) {
+                tokens.pushBack(token);
+                token.clear();
+            }
+            inFunction = true;
+            token += ch;
+        } else if (inFunction) {
+            token += ch;
+            if (ch == ')') {
+                tokens.pushBack(token);
+                token.clear();
+                inFunction = false;
+            }
+        } else if (isspace(static_cast<unsigned char>(ch))) {
+            if (!token.empty()) {
+                tokens.pushBack(token);
+                token.clear();
+            }
+        } else if (ch == '+' || ch == '-' || ch == '*' || ch == '/') {
+            if (!token.empty()) {
+                tokens.pushBack(token);
+                token.clear();
+            }
+            tokens.pushBack(string(1, ch));
+        } else {
+            token += ch;
+        }
+    }
+    if (!token.empty()) {
+        tokens.pushBack(token);
+    }
+
+    kind = Kind::Expression;
+    char currentOp = '\0';
+    for (int i = 0; i < tokens.getSize(); ++i) {
+        const string& current = tokens[i];
+        if (current == "+" || current == "-" || current == "*" || current == "/") {
+            currentOp = current[0];
+            continue;
+        }
+
+        ProgramStep step;
+        step.op = currentOp;
+        step.constant = 0;
+        step.rowOffset = 0;
+        step.colOffset = 0;
+
+        int refRow, refCol;
+        if (parseReference(current, refRow, refCol)) {
+            step.isReference = true;
+            step.rowOffset = refRow - row;
+            step.colOffset = refCol - col;
+            referenceOffsets.pushBack(make_pair(step.rowOffset, step.colOffset));
+        } else {
+            step.isReference = false;
+            try {
+                step.constant = stod(current);
+            } catch (...) {
+                // A token that is neither a number nor a reference makes the whole formula an error
+                kind = Kind::Invalid;
+                steps.clear();
+                referenceOffsets.clear();
+                return;
+            }
+        }
+        steps.pushBack(step);
+    }
+}
+
+// Substitutes the references of the given cell back into the literal text
+string FormulaProgram::decompile(int row, int col) const {
+    string text = literals[0];
+    for (int i = 0; i < textReferences.getSize(); ++i) {
+        text += columnLabel(col + textReferences[i].second);
+        text += to_string(row + textReferences[i].first + 1);
+        text += literals[i + 1];
+    }
+    return text;
+}
+
+FormulaProgram::Kind FormulaProgram::getKind() const {
+    return kind;
+}
+
+FormulaProgram::Aggregate FormulaProgram::getAggregate() const {
+    return aggregate;
+}
+
+const string& FormulaProgram::getCanonical() const {
+    return canonical;
+}
+
+const DynamicArray<ProgramStep>& FormulaProgram::getSteps() const {
+    return steps;
+}
+
+const DynamicArray<pair<int, int>>& FormulaProgram::getReferenceOffsets() const {
+    return referenceOffsets;
+}
+
+void FormulaProgram::getRangeOffsets(int& startRow, int& startCol, int& endRow, int& endCol) const {
+    startRow = rangeStartRow;
+    startCol = rangeStartCol;
+    endRow = rangeEndRow;
+    endCol = rangeEndCol;
+}
+
+// Constructor: starts purging expired entries once a thousand shapes are cached
+FormulaProgramCache::FormulaProgramCache() : purgeThreshold(1024) {}
+
+// Looks the shape up by its canonical text and compiles it only when no live program exists
+shared_ptr<const FormulaProgram> FormulaProgramCache::get(const string& formula, int row, int col) {
+    string key = FormulaProgram::canonicalize(formula, row, col);
+    auto it = programs.find(key);
+    if (it != programs.end()) {
+        shared_ptr<const FormulaProgram> program = it->second.lock();
+        if (program) return program;
+    }
+
+    shared_ptr<const FormulaProgram> program = FormulaProgram::compile(formula, row, col);
+    programs[key] = program;
+
+    // Drop the shapes that no cell uses anymore
+    if (programs.size() > purgeThreshold) {
+        for (auto entry = programs.begin(); entry != programs.end();) {
+            if (entry->second.expired()) {
+                entry = programs.erase(entry);
+            } else {
+                ++entry;
+            }
+        }
+        purgeThreshold = max(static_cast<size_t>(1024), programs.size() * 2);
+    }
+    return program;
+}
+
+int FormulaProgramCache::size() const {
+    return static_cast<int>(programs.size());
+}
+
+void FormulaProgramCache::clear() {
+    programs.clear();
+}
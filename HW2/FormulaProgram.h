@@ -0,0 +1,103 @@
+#ifndef FORMULAPROGRAM_H
+#define FORMULAPROGRAM_H
+
+// Compiled form of a formula in relative (R1C1-style) coordinates
+// Cells whose formulas have the same shape relative to their own position
+// (e.g. =A1*B1 in row 1 and =A2*B2 in row 2) share one program and one dependency template
+
+#include <string>
+#include <memory>
+#include <unordered_map>
+#include <utility>
+#include "Custom1DArray.h"
+
+using namespace std;
+
+// One operand of an arithmetic expression and the operator that combines it with the running result
+struct ProgramStep {
+    char op;                  // '+', '-', '*', '/' or '\0' when the operand replaces the running result
+    bool isReference;         // True for a cell reference, false for a numeric constant
+    double constant;          // Value of a constant operand
+    int rowOffset, colOffset; // Position of a referenced cell relative to the formula cell
+};
+
+class FormulaProgram {
+public:
+    enum class Kind { Empty, Expression, Aggregate, Text, Invalid };
+    enum class Aggregate { None, Sum, Average, Max, Min, StdDev };
+
+    // Compiles a formula written in the cell at (row, col)
+    // The program itself only stores offsets, so it is valid for every cell with the same shape
+    static shared_ptr<const FormulaProgram> compile(const string& formula, int row, int col);
+
+    // Returns the relative form used as the sharing key, e.g. "=A5*B5" in A5 -> "=R[0]C[0]*R[0]C[1]"
+    static string canonicalize(const string& formula, int row, int col);
+
+    // Rebuilds the A1-style formula text for the cell at (row, col)
+    string decompile(int row, int col) const;
+
+    Kind getKind() const;
+    Aggregate getAggregate() const;
+    const string& getCanonical() const;
+
+    // Operands of an expression, evaluated left to right without operator precedence
+    const DynamicArray<ProgramStep>& getSteps() const;
+
+    // Dependency template: offsets of the single-cell references of an expression
+    const DynamicArray<pair<int, int>>& getReferenceOffsets() const;
+
+    // Offsets of the range read by an aggregate function
+    void getRangeOffsets(int& startRow, int& startCol, int& endRow, int& endCol) const;
+
+    // Applies an arithmetic operator, throwing on division by zero
+    static double applyOperator(double a, double b, char op);
+
+    // Parses an A1-style reference ("B12", "aa3"); returns false if the text is not a reference
+    static bool parseReference(const string& text, int& row, int& col);
+
+    // Converts a column index to its label (0 -> "A", 26 -> "AA")
+    static string columnLabel(int col);
+
+private:
+    FormulaProgram();
+
+    // Splits the formula into literal text and references, which is all the canonical form needs
+    static void split(const string& formula, int row, int col,
+                      DynamicArray<string>& literals, DynamicArray<pair<int, int>>& references);
+
+    void compileExpression(const string& expression, int row, int col);
+    void compileAggregate(const string& formula, int row, int col);
+
+    Kind kind;
+    Aggregate aggregate;
+    DynamicArray<ProgramStep> steps;
+    DynamicArray<pair<int, int>> referenceOffsets;
+    int rangeStartRow, rangeStartCol, rangeEndRow, rangeEndCol;
+
+    // Formula text around the references: literals[0] ref[0] literals[1] ... literals[n]
+    DynamicArray<string> literals;
+    DynamicArray<pair<int, int>> textReferences;
+    string canonical;
+};
+
+// Shares compiled programs between cells with the same canonical formula
+// Entries are weak so that programs no longer used by any cell are released
+class FormulaProgramCache {
+public:
+    FormulaProgramCache();
+
+    // Returns the program for a formula at (row, col), compiling it only on the first use of its shape
+    shared_ptr<const FormulaProgram> get(const string& formula, int row, int col);
+
+    // Number of distinct shapes currently cached
+    int size() const;
+
+    // Drops all entries
+    void clear();
+
+private:
+    unordered_map<string, weak_ptr<const FormulaProgram>> programs;
+    size_t purgeThreshold; // Expired entries are removed when the map grows past this size
+};
+
+#endif // FORMULAPROGRAM_H
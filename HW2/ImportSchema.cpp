@@ -0,0 +1,62 @@
+#include "ImportSchema.h"
+#include <stdexcept>
+
+namespace Utils {
+
+// Grows the per-column arrays; new columns are inferred and kept
+void ImportSchema::reserveColumn(int column) {
+    if (column < 0) {
+        throw std::out_of_range("Column index must not be negative");
+    }
+    if (skippedBefore.getSize() == 0) {
+        skippedBefore.pushBack(0);
+    }
+    while (types.getSize() <= column) {
+        types.pushBack(ColumnType::Infer);
+        skipped.pushBack(0);
+        skippedBefore.pushBack(skippedBefore[skippedBefore.getSize() - 1]);
+    }
+}
+
+void ImportSchema::setColumnType(int column, ColumnType type) {
+    reserveColumn(column);
+    types[column] = type;
+}
+
+// Marks the column and updates the running count of skipped columns after it
+void ImportSchema::skipColumn(int column) {
+    reserveColumn(column);
+    if (skipped[column]) return;
+    skipped[column] = 1;
+    for (int c = column + 1; c < skippedBefore.getSize(); ++c) {
+        ++skippedBefore[c];
+    }
+}
+
+ImportSchema::ColumnType ImportSchema::getColumnType(int column) const {
+    return column < types.getSize() ? types[column] : ColumnType::Infer;
+}
+
+// Kept columns are numbered without the skipped ones before them
+int ImportSchema::getTargetColumn(int column) const {
+    if (column < skipped.getSize()) {
+        return skipped[column] ? -1 : column - skippedBefore[column];
+    }
+    return column - (skippedBefore.getSize() > 0 ? skippedBefore[skippedBefore.getSize() - 1] : 0);
+}
+
+int ImportSchema::countTargetColumns(int count) const {
+    if (count <= 0) return 0;
+    int last = count < skippedBefore.getSize() ? count : skippedBefore.getSize() - 1;
+    return count - (last >= 0 ? skippedBefore[last] : 0);
+}
+
+bool ImportSchema::isEmpty() const {
+    return types.getSize() == 0;
+}
+
+// The last entry counts every skipped column
+bool ImportSchema::hasSkippedColumns() const {
+    return skippedBefore.getSize() > 0 && skippedBefore[skippedBefore.getSize() - 1] > 0;
+}
+}
@@ -0,0 +1,54 @@
+#ifndef IMPORTSCHEMA_H
+#define IMPORTSCHEMA_H
+
+#include "Custom1DArray.h"
+
+namespace Utils {
+
+// Declared layout of a recurring CSV feed
+// Typed columns are converted without trying every cell type, and skipped columns are
+// dropped while parsing: the columns after them move left in the sheet
+// Formula text is imported as it is, so its references are read in the shifted sheet
+// (with column C skipped, "=C1" reads the cell that was column D in the file)
+class ImportSchema {
+public:
+    enum class ColumnType {
+        Infer,    // Classify every field (the default for undeclared columns)
+        Int64,    // 64-bit integer
+        Double,   // Decimal number
+        Label,    // Text, even if it looks like a number or a formula
+        Formula   // Formula text
+    };
+
+    // Declares the type of a source column (zero-based)
+    void setColumnType(int column, ColumnType type);
+
+    // Drops a source column from the import
+    void skipColumn(int column);
+
+    // Returns the declared type of a source column
+    ColumnType getColumnType(int column) const;
+
+    // Returns the sheet column of a source column, or -1 if it is skipped
+    int getTargetColumn(int column) const;
+
+    // Returns how many of the first 'count' source columns are kept
+    int countTargetColumns(int count) const;
+
+    // Returns true if no column is typed or skipped
+    bool isEmpty() const;
+
+    // Returns true if at least one column is skipped
+    bool hasSkippedColumns() const;
+
+private:
+    DynamicArray<ColumnType> types;   // Declared types, indexed by source column
+    DynamicArray<int> skippedBefore;  // skippedBefore[c] = skipped columns among 0..c-1; one entry past the last
+    DynamicArray<char> skipped;       // 1 if the source column is skipped
+
+    // Extends the arrays so that 'column' has an entry
+    void reserveColumn(int column);
+};
+}
+
+#endif // IMPORTSCHEMA_H
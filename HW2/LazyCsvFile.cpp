@@ -0,0 +1,123 @@
+#include "LazyCsvFile.h"
+#include "Spreadsheet.h"
+#include "FileManager.h"
+#include "CsvTokenizer.h"
+#include <algorithm>
+#include <chrono>
+#include <limits>
+
+namespace Utils {
+
+// Nothing is scanned yet; the caller indexes the rows it needs first
+LazyCsvFile::LazyCsvFile(GTUSpreadsheet::Spreadsheet& sheet, const std::string& fileName)
+    : sheet(sheet), file(fileName), text(file.contents()), scanOffset(0), scanInQuotes(false),
+      recordStart(0), rowCount(0), indexed(false) {}
+
+// The line of a blank record holds nothing but spaces and carriage returns, which
+// parseChunk reads as a single empty field
+void LazyCsvFile::addRecord(std::size_t start, std::size_t end) {
+    std::size_t lineEnd = end > start && text[end - 1] == '\n' ? end - 1 : end;
+    bool blank = true;
+    for (std::size_t i = start; i < lineEnd; ++i) {
+        if (text[i] != ' ' && text[i] != '\r') {
+            blank = false;
+            break;
+        }
+    }
+    if (blank) return;
+
+    if (rowCount % BLOCK_ROWS == 0) {
+        blockOffsets.pushBack(start);
+    }
+    ++rowCount;
+}
+
+void LazyCsvFile::scanRecords(std::size_t maxRecords) {
+    std::size_t ends[256];
+    while (!indexed && maxRecords > 0) {
+        std::size_t count = CsvTokenizer::findRecordEnds(text, scanOffset, scanInQuotes, ends,
+                                                         std::min<std::size_t>(maxRecords, 256));
+        if (count == 0) {
+            // A last line without a line break is still a record
+            if (recordStart < text.size()) {
+                addRecord(recordStart, text.size());
+            }
+            recordStart = text.size();
+            indexed = true;
+            break;
+        }
+        for (std::size_t i = 0; i < count; ++i) {
+            addRecord(recordStart, ends[i]);
+            recordStart = ends[i];
+        }
+        maxRecords -= count;
+    }
+    growSheet();
+}
+
+// The sheet only grows: the user may already have moved below the end of the file
+void LazyCsvFile::growSheet() {
+    if (rowCount > sheet.getTotalRows()) {
+        sheet.resizeGrid(rowCount, sheet.getTotalCols());
+    }
+}
+
+void LazyCsvFile::indexRows(int rows) {
+    while (!indexed && rowCount < rows) {
+        scanRecords(SCAN_RECORDS);
+    }
+}
+
+bool LazyCsvFile::indexSlice(int budgetMs) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(budgetMs);
+    while (!indexed && std::chrono::steady_clock::now() < deadline) {
+        scanRecords(SCAN_RECORDS);
+    }
+    return indexed;
+}
+
+bool LazyCsvFile::isIndexed() const {
+    return indexed;
+}
+
+int LazyCsvFile::getIndexedRows() const {
+    return rowCount;
+}
+
+// The block ends where the next one starts, so the scan must have found the next block too
+void LazyCsvFile::loadBlock(int block) {
+    while (!indexed && blockOffsets.getSize() <= block + 1) {
+        scanRecords(SCAN_RECORDS);
+    }
+    if (block >= blockOffsets.getSize()) {
+        return; // Below the end of the file
+    }
+    std::size_t start = blockOffsets[block];
+    std::size_t end = block + 1 < blockOffsets.getSize() ? blockOffsets[block + 1] : text.size();
+
+    FileManager::ParsedChunk chunk;
+    FileManager::parseChunk(text.substr(start, end - start), chunk, schema);
+    if (chunk.maxCol > sheet.getTotalCols()) {
+        sheet.resizeGrid(sheet.getTotalRows(), chunk.maxCol);
+    }
+
+    int firstRow = block * BLOCK_ROWS;
+    int formulaIndex = 0;
+    for (int f = 0; f < chunk.cells.getSize(); ++f) {
+        int row = firstRow + chunk.rows[f];
+        if (chunk.cells[f]) {
+            sheet.restoreCell(row, chunk.cols[f], chunk.cells[f]);
+        } else {
+            sheet.restoreFormula(row, chunk.cols[f], chunk.formulas[formulaIndex++]);
+        }
+    }
+}
+
+// Reading the first cell of a block loads it if it was not loaded yet
+void LazyCsvFile::loadAll() {
+    indexRows(std::numeric_limits<int>::max());
+    for (int block = 0; block < blockOffsets.getSize(); ++block) {
+        sheet.peekCell(block * BLOCK_ROWS, 0);
+    }
+}
+}
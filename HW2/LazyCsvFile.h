@@ -0,0 +1,78 @@
+#ifndef LAZYCSVFILE_H
+#define LAZYCSVFILE_H
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include "Custom1DArray.h"
+#include "ImportSchema.h"
+#include "MappedFile.h"
+#include "RowSource.h"
+
+namespace GTUSpreadsheet {
+class Spreadsheet;
+}
+
+namespace Utils {
+
+// A CSV file opened without parsing it
+// The file is mapped and only an index of its rows is built: the offset of the first row of
+// every block of RowSource::BLOCK_ROWS rows, found with the SIMD line break scan of CsvTokenizer.
+// A block is parsed when the spreadsheet first touches one of its cells (drawGrid scrolling to it,
+// a formula or a range function reading it). The index is extended as far as a request needs;
+// the rest of the file is indexed in time slices while the user is idle.
+// Blank lines are skipped exactly like loadFile does, so the rows are numbered the same way.
+class LazyCsvFile : public GTUSpreadsheet::RowSource {
+public:
+    // Maps the file; throws std::runtime_error if it cannot be read
+    // The sheet must be in paged mode: loading a block resizes it while its cells are being read
+    LazyCsvFile(GTUSpreadsheet::Spreadsheet& sheet, const std::string& fileName);
+
+    LazyCsvFile(const LazyCsvFile&) = delete;
+    LazyCsvFile& operator=(const LazyCsvFile&) = delete;
+
+    // Parses the block and stores its cells; formulas are left to be computed when read
+    void loadBlock(int block) override;
+
+    // Scans the file until it has the given number of rows or ends, growing the sheet
+    void indexRows(int rows) override;
+
+    // Scans for about budgetMs; returns true once the whole file is indexed
+    bool indexSlice(int budgetMs);
+
+    // Returns true once the whole file is indexed
+    bool isIndexed() const;
+
+    // Returns the number of rows found so far
+    int getIndexedRows() const;
+
+    // Indexes the rest of the file and loads every block that was not loaded yet (e.g. before saving)
+    void loadAll();
+
+private:
+    // Records handed to the line break scan at a time
+    static const std::size_t SCAN_RECORDS = 16384;
+
+    GTUSpreadsheet::Spreadsheet& sheet;
+    MappedFile file;
+    std::string_view text;
+    ImportSchema schema;                  // Default schema: every field is classified
+    DynamicArray<std::size_t> blockOffsets; // Offset of the first row of each block
+    std::size_t scanOffset;               // Where the line break scan continues
+    bool scanInQuotes;                    // True if scanOffset is inside a quoted field
+    std::size_t recordStart;              // Start of the record the scan is in
+    int rowCount;                         // Rows indexed so far (blank lines are not rows)
+    bool indexed;                         // True once the scan reached the end of the file
+
+    // Indexes up to maxRecords more records, then grows the sheet to the rows found
+    void scanRecords(std::size_t maxRecords);
+
+    // Counts the record [start, end) as a row unless it is a blank line
+    void addRecord(std::size_t start, std::size_t end);
+
+    // Grows the sheet to the rows indexed so far
+    void growSheet();
+};
+}
+
+#endif // LAZYCSVFILE_H
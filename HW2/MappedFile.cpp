@@ -0,0 +1,63 @@
+#include "MappedFile.h"
+#include <algorithm>
+#include <stdexcept>
+#include <fcntl.h>     // For open()
+#include <unistd.h>    // For close()
+#include <sys/mman.h>  // For mmap()
+#include <sys/stat.h>  // For fstat()
+
+namespace Utils {
+
+// Maps the file read-only and tells the kernel it will be read front to back
+MappedFile::MappedFile(const std::string& fileName) : fd(-1), data(nullptr), length(0) {
+    fd = open(fileName.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Error: Could not open file for reading: " + fileName);
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+        close(fd);
+        throw std::runtime_error("Error: Could not read file size: " + fileName);
+    }
+    length = static_cast<std::size_t>(info.st_size);
+
+    // mmap() rejects empty mappings, an empty file simply has no contents
+    if (length > 0) {
+        void* mapping = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping == MAP_FAILED) {
+            close(fd);
+            throw std::runtime_error("Error: Could not map file: " + fileName);
+        }
+        madvise(mapping, length, MADV_SEQUENTIAL);
+        data = static_cast<const char*>(mapping);
+    }
+}
+
+// Releases the mapping and the descriptor
+MappedFile::~MappedFile() {
+    if (data) {
+        munmap(const_cast<char*>(data), length);
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+std::string_view MappedFile::contents() const {
+    return std::string_view(data, length);
+}
+
+std::size_t MappedFile::size() const {
+    return length;
+}
+
+// Only whole pages can be released, so the range is rounded down to a page boundary
+void MappedFile::release(std::size_t end) const {
+    std::size_t pageSize = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+    end = std::min(end, length) / pageSize * pageSize;
+    if (data && end > 0) {
+        madvise(const_cast<char*>(data), end, MADV_DONTNEED);
+    }
+}
+}
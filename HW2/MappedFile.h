@@ -0,0 +1,39 @@
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include <string>
+#include <string_view>
+
+namespace Utils {
+
+// Read-only memory mapping of a whole file
+// The loader parses the mapped bytes in place instead of copying them through stream buffers
+class MappedFile {
+private:
+    int fd;              // Open file descriptor, -1 if none
+    const char* data;    // Start of the mapping, nullptr for an empty file
+    std::size_t length;  // Size of the file in bytes
+
+public:
+    // Opens and maps the file; throws std::runtime_error if it cannot be read
+    explicit MappedFile(const std::string& fileName);
+
+    // Unmaps the file and closes the descriptor
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    // Returns the whole file contents; valid while the MappedFile is alive
+    std::string_view contents() const;
+
+    // Returns the size of the file in bytes
+    std::size_t size() const;
+
+    // Tells the kernel the bytes before 'end' will not be read again, so their pages can be dropped
+    // The contents stay readable; they are read from the file again if needed
+    void release(std::size_t end) const;
+};
+}
+
+#endif // MAPPEDFILE_H
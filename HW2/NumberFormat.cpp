@@ -0,0 +1,85 @@
+#include "NumberFormat.h"
+#include <charconv>
+#include <stdexcept>
+#include <system_error>
+
+namespace GTUSpreadsheet {
+
+int NumberFormat::clampPrecision(int precision) {
+    if (precision < 0) return 0;
+    if (precision > MAX_PRECISION) return MAX_PRECISION;
+    return precision;
+}
+
+// Fixed notation with exactly 'precision' decimals, rounded to nearest like printf("%.*f")
+char* NumberFormat::writeFixed(char* first, char* last, double value, int precision) {
+    to_chars_result written = to_chars(first, last, value, chars_format::fixed, clampPrecision(precision));
+    return written.ec == errc() ? written.ptr : nullptr;
+}
+
+char* NumberFormat::writeInteger(char* first, char* last, long long value) {
+    to_chars_result written = to_chars(first, last, value);
+    return written.ec == errc() ? written.ptr : nullptr;
+}
+
+// to_chars without a format picks the shortest text that round-trips
+char* NumberFormat::writeShortest(char* first, char* last, double value) {
+    to_chars_result written = to_chars(first, last, value);
+    return written.ec == errc() ? written.ptr : nullptr;
+}
+
+// BUFFER_SIZE covers every value, so the writes cannot run out of room
+void NumberFormat::appendFixed(string& out, double value, int precision) {
+    char buffer[BUFFER_SIZE];
+    char* end = writeFixed(buffer, buffer + sizeof(buffer), value, precision);
+    if (!end) {
+        throw length_error("Number does not fit the format buffer");
+    }
+    out.append(buffer, end);
+}
+
+void NumberFormat::appendInteger(string& out, long long value) {
+    char buffer[24];
+    char* end = writeInteger(buffer, buffer + sizeof(buffer), value);
+    out.append(buffer, end);
+}
+
+void NumberFormat::appendShortest(string& out, double value) {
+    char buffer[BUFFER_SIZE];
+    char* end = writeShortest(buffer, buffer + sizeof(buffer), value);
+    if (!end) {
+        throw length_error("Number does not fit the format buffer");
+    }
+    out.append(buffer, end);
+}
+
+string NumberFormat::fixed(double value, int precision) {
+    string text;
+    appendFixed(text, value, precision);
+    return text;
+}
+
+string NumberFormat::integer(long long value) {
+    string text;
+    appendInteger(text, value);
+    return text;
+}
+
+// Formats and reads back, so the result is exactly the number the shown text stands for
+double NumberFormat::roundToPrecision(double value, int precision) {
+    char buffer[BUFFER_SIZE];
+    char* end = writeFixed(buffer, buffer + sizeof(buffer), value, precision);
+    double rounded;
+    if (!end || from_chars(buffer, end, rounded).ec != errc()) {
+        return value; // inf and nan have nothing to round
+    }
+    return rounded;
+}
+
+bool NumberFormat::parse(string_view text, double& value) {
+    if (text.empty()) return false;
+    from_chars_result parsed = from_chars(text.data(), text.data() + text.size(), value);
+    return parsed.ec == errc() && parsed.ptr == text.data() + text.size();
+}
+
+} // namespace GTUSpreadsheet
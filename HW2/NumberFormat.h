@@ -0,0 +1,62 @@
+#ifndef NUMBERFORMAT_H
+#define NUMBERFORMAT_H
+
+// Number to text conversion for cells, formulas, the grid and file export
+// Everything goes through std::to_chars / std::from_chars: no locale, no stream and no
+// allocation for the conversion itself. The write functions fill a buffer supplied by the
+// caller; the append functions format into a stack buffer and append the text to a string.
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+using namespace std;
+
+namespace GTUSpreadsheet {
+
+class NumberFormat {
+public:
+    // Decimals shown for decimal values and formula results unless a column sets its own
+    // Formulas read values rounded to this many decimals, whatever a column shows
+    static const int DEFAULT_PRECISION = 2;
+
+    // Most decimals a column may show
+    static const int MAX_PRECISION = 15;
+
+    // Fits any finite double in fixed notation with MAX_PRECISION decimals
+    // (309 integer digits, sign, point and decimals), any integer and any shortest form
+    static const size_t BUFFER_SIZE = 336;
+
+    // Writes the value with 'precision' decimals (clamped to 0..MAX_PRECISION) into [first, last)
+    // Returns the end of the text, or nullptr if the buffer is too small
+    static char* writeFixed(char* first, char* last, double value, int precision);
+
+    // Writes the integer; returns the end of the text, or nullptr if the buffer is too small
+    static char* writeInteger(char* first, char* last, long long value);
+
+    // Writes the shortest text that reads back as exactly the same double
+    // Returns the end of the text, or nullptr if the buffer is too small
+    static char* writeShortest(char* first, char* last, double value);
+
+    // Appends the text of the write functions above to 'out'
+    static void appendFixed(string& out, double value, int precision);
+    static void appendInteger(string& out, long long value);
+    static void appendShortest(string& out, double value);
+
+    // Returns the text of the write functions above
+    static string fixed(double value, int precision);
+    static string integer(long long value);
+
+    // Rounds the value the way it is shown with 'precision' decimals
+    static double roundToPrecision(double value, int precision);
+
+    // Reads a whole text as one number; returns false if anything else is in it
+    static bool parse(string_view text, double& value);
+
+    // Limits a precision to 0..MAX_PRECISION
+    static int clampPrecision(int precision);
+};
+
+} // namespace GTUSpreadsheet
+
+#endif // NUMBERFORMAT_H
@@ -0,0 +1,698 @@
+#include "PagedGrid.h"
+#include "Spreadsheet.h"
+#include "Cell.h"
+#include "EncodedTile.h"
+#include <cerrno>
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>     // For open()
+#include <unistd.h>    // For pread(), pwrite(), ftruncate()
+
+namespace GTUSpreadsheet {
+
+namespace {
+enum CellKind : uint8_t { KIND_INT = 1, KIND_DOUBLE = 2, KIND_LABEL = 3, KIND_FORMULA = 4 };
+
+template <typename T>
+void put(string& out, T value) {
+    char bytes[sizeof(T)];
+    memcpy(bytes, &value, sizeof(T));
+    out.append(bytes, sizeof(T));
+}
+
+void putText(string& out, const string& text) {
+    put<uint32_t>(out, static_cast<uint32_t>(text.size()));
+    out += text;
+}
+
+// Reads from a serialized tile; a short tile means the page file is damaged
+template <typename T>
+T take(const string& data, size_t& offset) {
+    if (data.size() < sizeof(T) || offset > data.size() - sizeof(T)) {
+        throw runtime_error("Corrupt page file");
+    }
+    T value;
+    memcpy(&value, data.data() + offset, sizeof(T));
+    offset += sizeof(T);
+    return value;
+}
+
+string takeText(const string& data, size_t& offset) {
+    uint32_t length = take<uint32_t>(data, offset);
+    if (length > data.size() - offset) {
+        throw runtime_error("Corrupt page file");
+    }
+    string text = data.substr(offset, length);
+    offset += length;
+    return text;
+}
+}
+
+const shared_ptr<Cell> PagedGrid::emptyCell;
+
+// The file is only reachable through the descriptor, so nothing is left behind after a crash
+PagedGrid::PagedGrid(Spreadsheet& sheet, const string& pageFileName, size_t memoryBudgetBytes)
+    : owner(sheet), fd(-1), memoryBudget(memoryBudgetBytes), fileEnd(0), snapshots(0),
+      lruHead(nullptr), lruTail(nullptr), residentBytes(0), lastTile(nullptr),
+      encodedBudget(0), nextAge(0), encodedBytes(0) {
+    fd = ::open(pageFileName.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        throw runtime_error("Error: Could not create page file: " + pageFileName);
+    }
+    ::unlink(pageFileName.c_str());
+}
+
+PagedGrid::~PagedGrid() {
+    resident.clear(); // Release the cells before the descriptor
+    if (fd >= 0) {
+        ::close(fd);
+    }
+}
+
+long long PagedGrid::tileKey(int row, int col) {
+    return (static_cast<long long>(row / TILE_ROWS) << 32) | static_cast<unsigned>(col / TILE_COLS);
+}
+
+// Reading an area that was never written creates nothing
+const shared_ptr<Cell>& PagedGrid::get(int row, int col) const {
+    Tile* tile = findTile(tileKey(row, col), false);
+    if (!tile) return emptyCell;
+    return tile->cells[(row % TILE_ROWS) * TILE_COLS + col % TILE_COLS];
+}
+
+void PagedGrid::set(int row, int col, shared_ptr<Cell> cell) {
+    Tile* tile = findTile(tileKey(row, col), cell != nullptr);
+    if (!tile) return; // Clearing a cell that was never written
+
+    if (tile->cells.use_count() > 1) {
+        // A snapshot still reads this array
+        shared_ptr<shared_ptr<Cell>[]> copy(new shared_ptr<Cell>[TILE_CELLS]);
+        copy_n(tile->cells.get(), TILE_CELLS, copy.get());
+        tile->cells = std::move(copy);
+    }
+    shared_ptr<Cell>& slot = tile->cells[(row % TILE_ROWS) * TILE_COLS + col % TILE_COLS];
+    size_t oldBytes = cellBytes(slot.get());
+    size_t newBytes = cellBytes(cell.get());
+    tile->bytes = tile->bytes - oldBytes + newBytes;
+    residentBytes = residentBytes - oldBytes + newBytes;
+    if (dynamic_cast<FormulaCell*>(cell.get())) {
+        tile->hasFormulas = true;
+    }
+    slot = std::move(cell);
+    tile->dirty = true;
+    if (newBytes > oldBytes) {
+        evictOverBudget(tile);
+    }
+}
+
+// Repeated accesses to the same tile skip the lookup and the LRU update
+PagedGrid::Tile* PagedGrid::findTile(long long key, bool create) const {
+    if (lastTile && lastTile->key == key) {
+        return lastTile;
+    }
+
+    Tile* tile;
+    auto found = resident.find(key);
+    if (found != resident.end()) {
+        tile = found->second.get();
+        removeFromLru(tile);
+        pushFront(tile);
+    } else {
+        auto slot = slots.find(key);
+        if (encoded.count(key)) {
+            tile = decodeEncoded(key);
+        } else if (slot != slots.end()) {
+            tile = readTile(key, slot->second);
+        } else if (create) {
+            tile = new Tile();
+            tile->key = key;
+            tile->cells.reset(new shared_ptr<Cell>[TILE_CELLS]);
+            tile->bytes = TILE_BYTES;
+            tile->dirty = true;
+            tile->hasFormulas = false;
+            tile->resultStamp = 0;
+        } else {
+            return nullptr;
+        }
+        resident.emplace(key, unique_ptr<Tile>(tile));
+        residentBytes += tile->bytes;
+        pushFront(tile);
+        evictOverBudget(tile);
+    }
+    lastTile = tile;
+    return tile;
+}
+
+// Tile record: cell count, then per cell its index in the tile, its kind and its value
+// Formulas keep their text, their last result and whether that result is stale
+void PagedGrid::writeTile(Tile& tile) const {
+    string out;
+    put<uint32_t>(out, 0);
+    uint32_t count = 0;
+    size_t staleFormulas = 0;
+    string label;
+    for (int i = 0; i < TILE_CELLS; ++i) {
+        const Cell* cell = tile.cells[i].get();
+        if (!cell) continue;
+
+        if (auto formulaCell = dynamic_cast<const FormulaCell*>(cell)) {
+            put<uint16_t>(out, static_cast<uint16_t>(i));
+            put<uint8_t>(out, KIND_FORMULA);
+            put<uint32_t>(out, programId(formulaCell->getProgram()));
+            putText(out, formulaCell->getStoredResult());
+            put<uint8_t>(out, formulaCell->isDirty() ? 1 : 0);
+            if (formulaCell->isDirty()) ++staleFormulas;
+        } else if (auto intCell = dynamic_cast<const IntValueCell*>(cell)) {
+            put<uint16_t>(out, static_cast<uint16_t>(i));
+            put<uint8_t>(out, KIND_INT);
+            put<int64_t>(out, intCell->getValue());
+        } else if (auto doubleCell = dynamic_cast<const DoubleValueCell*>(cell)) {
+            put<uint16_t>(out, static_cast<uint16_t>(i));
+            put<uint8_t>(out, KIND_DOUBLE);
+            put<double>(out, doubleCell->getValue());
+        } else {
+            label.clear();
+            cell->appendContent(label);
+            if (label.empty()) continue; // Placeholder cell
+            put<uint16_t>(out, static_cast<uint16_t>(i));
+            put<uint8_t>(out, KIND_LABEL);
+            putText(out, label);
+        }
+        ++count;
+    }
+    memcpy(&out[0], &count, sizeof(count));
+
+    // Stale formulas get room for their results, which are usually written back soon
+    writeRecord(tile.key, out, staleFormulas * RESULT_BYTES);
+    tile.dirty = false;
+    tile.resultStamp = resultStamp(tile);
+}
+
+void PagedGrid::writeRecord(long long key, const string& out, size_t growth) const {
+    // While a snapshot may read the old record, the tile goes to a new slot
+    auto found = slots.find(key);
+    bool relocated = found == slots.end() || out.size() > found->second.capacity || snapshots > 0;
+    PageSlot slot = relocated ? allocateSlot(out.size(), growth) : found->second;
+    slot.length = static_cast<uint32_t>(out.size());
+
+    size_t written = 0;
+    while (written < out.size()) {
+        ssize_t n = ::pwrite(fd, out.data() + written, out.size() - written,
+                             static_cast<off_t>(slot.offset + written));
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (relocated) freeSlots.emplace(slot.capacity, slot.offset);
+            throw runtime_error("Error while writing page file: " + string(strerror(errno)));
+        }
+        written += static_cast<size_t>(n);
+    }
+    // The old copy is only given up once the new one is written
+    if (relocated && found != slots.end()) {
+        if (snapshots > 0) {
+            retiredSlots.pushBack(make_pair(found->second.capacity, found->second.offset));
+        } else {
+            freeSlots.emplace(found->second.capacity, found->second.offset);
+        }
+    }
+    slots[key] = slot;
+}
+
+// A clean tile that has a slot is already in the page file, so dropping its encoded copy later
+// costs no write
+bool PagedGrid::encodeTile(const Tile& tile) const {
+    if (encodedBudget == 0 || tile.hasFormulas) return false;
+    shared_ptr<const EncodedTile> encodedTile = EncodedTile::encode(tile.cells.get(), TILE_ROWS, TILE_COLS);
+    if (!encodedTile) return false;
+
+    EncodedEntry entry;
+    entry.tile = encodedTile;
+    entry.age = nextAge++;
+    entry.written = !tile.dirty && slots.count(tile.key) > 0;
+    encodedBytes += encodedTile->getMemoryBytes();
+    encodedOrder.emplace(entry.age, tile.key);
+    encoded.emplace(tile.key, std::move(entry));
+    return true;
+}
+
+// The tile is dirty unless the page file holds the same cells, so it is encoded or written again
+// when it is evicted
+PagedGrid::Tile* PagedGrid::decodeEncoded(long long key) const {
+    auto found = encoded.find(key);
+    unique_ptr<Tile> tile(new Tile());
+    tile->key = key;
+    tile->cells.reset(new shared_ptr<Cell>[TILE_CELLS]);
+    found->second.tile->decode(tile->cells.get(), static_cast<int>(key >> 32) * TILE_ROWS,
+                               static_cast<int>(key & 0xffffffff) * TILE_COLS);
+    tile->bytes = TILE_BYTES + decodedBytes(tile->cells.get());
+    tile->dirty = !found->second.written;
+    tile->hasFormulas = false;
+    tile->resultStamp = resultStamp(*tile);
+
+    encodedBytes -= found->second.tile->getMemoryBytes();
+    encodedOrder.erase(found->second.age);
+    encoded.erase(found);
+    return tile.release();
+}
+
+// The record is the encoded bytes behind a marker, so the tile is read back without re-encoding
+void PagedGrid::spillEncoded() const {
+    while (encodedBytes > encodedBudget && !encodedOrder.empty()) {
+        auto oldest = encodedOrder.begin();
+        auto found = encoded.find(oldest->second);
+        if (!found->second.written) {
+            string record;
+            put<uint32_t>(record, ENCODED_RECORD);
+            record += found->second.tile->getBytes();
+            writeRecord(found->first, record, 0);
+        }
+        encodedBytes -= found->second.tile->getMemoryBytes();
+        encoded.erase(found);
+        encodedOrder.erase(oldest);
+    }
+}
+
+size_t PagedGrid::decodedBytes(const shared_ptr<Cell>* cells) {
+    size_t bytes = 0;
+    string label;
+    for (int i = 0; i < TILE_CELLS; ++i) {
+        const Cell* cell = cells[i].get();
+        if (!cell) continue;
+        if (dynamic_cast<const StringValueCell*>(cell)) {
+            label.clear();
+            cell->appendContent(label);
+            bytes += 2 * label.size(); // Kept as both content and value
+        }
+        bytes += cellBytes(cell);
+    }
+    return bytes;
+}
+
+// Reuses the smallest freed slot that fits, unless most of it would be wasted
+// Otherwise the slot is appended with some room to grow, so a tile that gains a few cells
+// is rewritten in place
+PagedGrid::PageSlot PagedGrid::allocateSlot(size_t length, size_t growth) const {
+    PageSlot slot;
+    slot.length = 0;
+    length += growth;
+    auto freed = freeSlots.lower_bound(static_cast<uint32_t>(length));
+    if (freed != freeSlots.end() && freed->first <= 2 * length) {
+        slot.offset = freed->second;
+        slot.capacity = freed->first;
+        freeSlots.erase(freed);
+        return slot;
+    }
+    slot.offset = fileEnd;
+    slot.capacity = static_cast<uint32_t>(length + length / 8);
+    fileEnd += slot.capacity;
+    return slot;
+}
+
+void PagedGrid::readSlot(int fd, const PageSlot& slot, string& data) {
+    data.assign(slot.length, '\0');
+    size_t done = 0;
+    while (done < data.size()) {
+        ssize_t n = ::pread(fd, &data[done], data.size() - done, static_cast<off_t>(slot.offset + done));
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR) continue;
+            throw runtime_error("Error while reading page file");
+        }
+        done += static_cast<size_t>(n);
+    }
+}
+
+PagedGrid::Tile* PagedGrid::readTile(long long key, const PageSlot& slot) const {
+    string data;
+    readSlot(fd, slot, data);
+
+    unique_ptr<Tile> tile(new Tile());
+    tile->key = key;
+    tile->cells.reset(new shared_ptr<Cell>[TILE_CELLS]);
+    tile->bytes = TILE_BYTES;
+    tile->dirty = false;
+    tile->hasFormulas = false;
+    decodeTile(data, key, programs, owner.shared_from_this(), tile->cells.get(), tile->bytes, tile->hasFormulas);
+    tile->resultStamp = resultStamp(*tile);
+    return tile.release();
+}
+
+void PagedGrid::decodeTile(const string& data, long long key, const DynamicArray<shared_ptr<const FormulaProgram>>& programs,
+                           const shared_ptr<Spreadsheet>& owner, shared_ptr<Cell>* cells, size_t& bytes, bool& hasFormulas) {
+    int firstRow = static_cast<int>(key >> 32) * TILE_ROWS;
+    int firstCol = static_cast<int>(key & 0xffffffff) * TILE_COLS;
+    size_t offset = 0;
+    uint32_t count = take<uint32_t>(data, offset);
+    if (count == ENCODED_RECORD) {
+        shared_ptr<const EncodedTile> encodedTile = EncodedTile::fromBytes(data.substr(offset));
+        if (encodedTile->getRows() != TILE_ROWS || encodedTile->getCols() != TILE_COLS) {
+            throw runtime_error("Corrupt page file");
+        }
+        encodedTile->decode(cells, firstRow, firstCol);
+        bytes += decodedBytes(cells);
+        return;
+    }
+    for (uint32_t n = 0; n < count; ++n) {
+        uint16_t index = take<uint16_t>(data, offset);
+        uint8_t kind = take<uint8_t>(data, offset);
+        if (index >= TILE_CELLS) {
+            throw runtime_error("Corrupt page file");
+        }
+        int row = firstRow + index / TILE_COLS;
+        int col = firstCol + index % TILE_COLS;
+
+        shared_ptr<Cell> cell;
+        switch (kind) {
+            case KIND_INT:
+                cell = make_shared<IntValueCell>(take<int64_t>(data, offset));
+                break;
+            case KIND_DOUBLE:
+                cell = make_shared<DoubleValueCell>(take<double>(data, offset));
+                break;
+            case KIND_LABEL: {
+                string text = takeText(data, offset);
+                bytes += 2 * text.size(); // Kept as both content and value
+                cell = make_shared<StringValueCell>(text);
+                break;
+            }
+            case KIND_FORMULA: {
+                uint32_t id = take<uint32_t>(data, offset);
+                string cached = takeText(data, offset);
+                bool stale = take<uint8_t>(data, offset) != 0;
+                if (id >= static_cast<uint32_t>(programs.getSize())) {
+                    throw runtime_error("Corrupt page file");
+                }
+                if (stale && !owner) {
+                    throw logic_error("A snapshot was taken before a formula was computed");
+                }
+                auto formulaCell = make_shared<FormulaCell>(programs[id], cached, owner, row, col);
+                if (stale) {
+                    formulaCell->markDirty();
+                }
+                cell = formulaCell;
+                hasFormulas = true;
+                break;
+            }
+            default:
+                throw runtime_error("Corrupt page file");
+        }
+        cell->setPosition(row, col);
+        bytes += cellBytes(cell.get());
+        cells[index] = std::move(cell);
+    }
+}
+
+// FNV-1a over the results and stale flags of the formulas
+uint64_t PagedGrid::resultStamp(const Tile& tile) {
+    uint64_t hash = 14695981039346656037ull;
+    if (!tile.hasFormulas) return hash;
+    for (int i = 0; i < TILE_CELLS; ++i) {
+        auto formulaCell = dynamic_cast<const FormulaCell*>(tile.cells[i].get());
+        if (!formulaCell) continue;
+        string result = formulaCell->getStoredResult();
+        result += formulaCell->isDirty() ? '1' : '0';
+        for (char c : result) {
+            hash ^= static_cast<unsigned char>(c);
+            hash *= 1099511628211ull;
+        }
+    }
+    return hash;
+}
+
+// Programs are kept for as long as the page file refers to them
+uint32_t PagedGrid::programId(const shared_ptr<const FormulaProgram>& program) const {
+    auto found = programIds.find(program.get());
+    if (found != programIds.end()) {
+        return found->second;
+    }
+    uint32_t id = static_cast<uint32_t>(programs.getSize());
+    programs.pushBack(program);
+    programIds.emplace(program.get(), id);
+    return id;
+}
+
+// Pinned tiles are moved to the front and passed over, so the budget is a soft limit while
+// many formulas are in use (e.g. during a large recalculation)
+void PagedGrid::evictOverBudget(const Tile* keep) const {
+    size_t attempts = resident.size();
+    while (residentBytes > memoryBudget && lruTail && lruTail != keep && attempts-- > 0) {
+        Tile* victim = lruTail;
+        removeFromLru(victim);
+        if (isPinned(*victim)) {
+            pushFront(victim);
+            continue;
+        }
+        // A clean tile only needs writing if one of its formulas was recalculated
+        try {
+            if (!encodeTile(*victim) &&
+                (victim->dirty || (victim->hasFormulas && resultStamp(*victim) != victim->resultStamp))) {
+                writeTile(*victim);
+            }
+        } catch (...) {
+            pushFront(victim); // Keep the only copy of the cells
+            throw;
+        }
+        residentBytes -= victim->bytes;
+        if (lastTile == victim) {
+            lastTile = nullptr;
+        }
+        resident.erase(victim->key);
+    }
+    spillEncoded();
+}
+
+// A formula that is referenced elsewhere may still change (a recalculation holds it) and a
+// formula that is being evaluated is still running; in both cases the object must stay the cell
+bool PagedGrid::isPinned(const Tile& tile) {
+    if (!tile.hasFormulas) return false;
+    for (int i = 0; i < TILE_CELLS; ++i) {
+        const shared_ptr<Cell>& cell = tile.cells[i];
+        auto formulaCell = dynamic_cast<const FormulaCell*>(cell.get());
+        if (formulaCell && (cell.use_count() > 1 || formulaCell->isEvaluating())) {
+            return true;
+        }
+    }
+    return false;
+}
+
+size_t PagedGrid::cellBytes(const Cell* cell) {
+    if (!cell) return 0;
+    return dynamic_cast<const FormulaCell*>(cell) ? FORMULA_CELL_BYTES : VALUE_CELL_BYTES;
+}
+
+void PagedGrid::removeFromLru(Tile* tile) const {
+    if (tile->prev) tile->prev->next = tile->next; else lruHead = tile->next;
+    if (tile->next) tile->next->prev = tile->prev; else lruTail = tile->prev;
+    tile->prev = tile->next = nullptr;
+}
+
+void PagedGrid::pushFront(Tile* tile) const {
+    tile->prev = nullptr;
+    tile->next = lruHead;
+    if (lruHead) lruHead->prev = tile; else lruTail = tile;
+    lruHead = tile;
+}
+
+void PagedGrid::clear() {
+    if (snapshots > 0) {
+        throw logic_error("The page file is still read by a snapshot");
+    }
+    resident.clear();
+    slots.clear();
+    freeSlots.clear();
+    programs.clear();
+    programIds.clear();
+    lruHead = lruTail = lastTile = nullptr;
+    residentBytes = 0;
+    encoded.clear();
+    encodedOrder.clear();
+    encodedBytes = 0;
+    fileEnd = 0;
+    if (::ftruncate(fd, 0) != 0) {
+        throw runtime_error("Error while truncating page file");
+    }
+}
+
+// The tiles in memory are shared, the rest is read from the page file by the snapshot itself
+unique_ptr<PagedGrid::Snapshot> PagedGrid::takeSnapshot() {
+    unique_ptr<Snapshot> snapshot(new Snapshot());
+    snapshot->fd = ::fcntl(fd, F_DUPFD_CLOEXEC, 0);
+    if (snapshot->fd < 0) {
+        throw runtime_error("Error: Could not share page file");
+    }
+    for (const auto& entry : resident) {
+        snapshot->sharedTiles.emplace(entry.first, entry.second->cells);
+    }
+    for (const auto& entry : encoded) {
+        snapshot->encodedTiles.emplace(entry.first, entry.second.tile);
+    }
+    snapshot->slots = slots;
+    snapshot->programs = programs;
+    ++snapshots;
+    return snapshot;
+}
+
+// The slots given up while snapshots were alive can be reused once the last one is gone
+void PagedGrid::releaseSnapshot() {
+    if (snapshots > 0 && --snapshots == 0) {
+        for (int i = 0; i < retiredSlots.getSize(); ++i) {
+            freeSlots.emplace(retiredSlots[i].first, retiredSlots[i].second);
+        }
+        retiredSlots.clear();
+    }
+}
+
+PagedGrid::Snapshot::Snapshot() : fd(-1), reader(*this) {}
+
+PagedGrid::Snapshot::~Snapshot() {
+    if (fd >= 0) {
+        ::close(fd);
+    }
+}
+
+const shared_ptr<Cell>& PagedGrid::Snapshot::get(int row, int col) const {
+    return reader.get(row, col);
+}
+
+PagedGrid::Snapshot::Reader::Reader(const Snapshot& snapshot) : snapshot(snapshot), lastKey(-1), lastCells(nullptr) {}
+
+// Tiles that were not in memory are decoded from the page file; a few are kept, which covers
+// reading the sheet row by row or column by column
+// The snapshot itself is only read (the page file with pread), so readers do not interfere
+const shared_ptr<Cell>& PagedGrid::Snapshot::Reader::get(int row, int col) {
+    long long key = tileKey(row, col);
+    if (key != lastKey) {
+        lastKey = key;
+        lastCells = nullptr;
+        auto shared = snapshot.sharedTiles.find(key);
+        auto read = readTiles.find(key);
+        if (shared != snapshot.sharedTiles.end()) {
+            lastCells = shared->second.get();
+        } else if (read != readTiles.end()) {
+            lastCells = read->second.get();
+        } else {
+            auto encodedTile = snapshot.encodedTiles.find(key);
+            auto slot = snapshot.slots.find(key);
+            if (encodedTile != snapshot.encodedTiles.end() || slot != snapshot.slots.end()) {
+                shared_ptr<shared_ptr<Cell>[]> cells(new shared_ptr<Cell>[TILE_CELLS]);
+                if (encodedTile != snapshot.encodedTiles.end()) {
+                    encodedTile->second->decode(cells.get(), static_cast<int>(key >> 32) * TILE_ROWS,
+                                                static_cast<int>(key & 0xffffffff) * TILE_COLS);
+                } else {
+                    string data;
+                    readSlot(snapshot.fd, slot->second, data);
+                    size_t bytes = 0;
+                    bool hasFormulas = false;
+                    decodeTile(data, key, snapshot.programs, nullptr, cells.get(), bytes, hasFormulas);
+                }
+                if (readTiles.size() >= READ_TILES) {
+                    readTiles.clear();
+                }
+                lastCells = cells.get();
+                readTiles.emplace(key, std::move(cells));
+            }
+        }
+    }
+    if (!lastCells) return emptyCell;
+    return lastCells[(row % TILE_ROWS) * TILE_COLS + col % TILE_COLS];
+}
+
+size_t PagedGrid::getResidentBytes() const {
+    return residentBytes;
+}
+
+int PagedGrid::getResidentTiles() const {
+    return static_cast<int>(resident.size());
+}
+
+size_t PagedGrid::getPageFileBytes() const {
+    return static_cast<size_t>(fileEnd);
+}
+
+size_t PagedGrid::getMemoryBudget() const {
+    return memoryBudget;
+}
+
+size_t PagedGrid::getEncodedBytes() const {
+    return encodedBytes;
+}
+
+int PagedGrid::getEncodedTiles() const {
+    return static_cast<int>(encoded.size());
+}
+
+size_t PagedGrid::getEncodedMemoryBudget() const {
+    return encodedBudget;
+}
+
+// Lowering the budget writes the oldest encoded tiles out right away
+void PagedGrid::setEncodedMemoryBudget(size_t bytes) {
+    encodedBudget = bytes;
+    spillEncoded();
+}
+
+// Each band of TILE_ROWS rows is read at once: the encoded columns of the band are unpacked into
+// number arrays, the other cells are read one by one as before
+// The values are visited in the same order as a row-by-row loop over the cells, so aggregates
+// add them up in the same order
+void PagedGrid::scanNumbers(int startRow, int startCol, int endRow, int endCol,
+                            const function<void(double)>& visit) const {
+    if (startRow > endRow || startCol > endCol) return;
+    int width = endCol - startCol + 1;
+    unique_ptr<double[]> values(new double[static_cast<size_t>(width) * TILE_ROWS]);
+    unique_ptr<bool[]> present(new bool[static_cast<size_t>(width) * TILE_ROWS]);
+    unique_ptr<bool[]> fromEncoded(new bool[width]);
+
+    for (int bandStart = startRow; bandStart <= endRow;) {
+        int bandEnd = min(endRow, (bandStart / TILE_ROWS + 1) * TILE_ROWS - 1);
+        for (int c = startCol; c <= endCol; ++c) {
+            auto found = encoded.find(tileKey(bandStart, c));
+            fromEncoded[c - startCol] = found != encoded.end();
+            if (found != encoded.end()) {
+                size_t column = static_cast<size_t>(c - startCol) * TILE_ROWS;
+                found->second.tile->readNumbers(c % TILE_COLS, &values[column], &present[column]);
+            }
+        }
+        for (int r = bandStart; r <= bandEnd; ++r) {
+            for (int c = startCol; c <= endCol; ++c) {
+                if (fromEncoded[c - startCol]) {
+                    size_t index = static_cast<size_t>(c - startCol) * TILE_ROWS + r % TILE_ROWS;
+                    if (present[index]) visit(values[index]);
+                    continue;
+                }
+                shared_ptr<Cell> cell = get(r, c); // Keeps a formula alive while it is evaluated
+                double value;
+                if (FormulaCell::readNumber(cell.get(), value)) {
+                    visit(value);
+                }
+            }
+        }
+        bandStart = bandEnd + 1;
+    }
+}
+
+// Only positions are collected, so the tiles read here can be evicted again right away
+void PagedGrid::collectDirtyFormulas(int startRow, int startCol, int endRow, int endCol,
+                                     DynamicArray<pair<int, int>>& formulas) const {
+    if (startRow > endRow || startCol > endCol) return;
+    for (int tileRow = startRow / TILE_ROWS; tileRow <= endRow / TILE_ROWS; ++tileRow) {
+        for (int tileCol = startCol / TILE_COLS; tileCol <= endCol / TILE_COLS; ++tileCol) {
+            long long key = tileKey(tileRow * TILE_ROWS, tileCol * TILE_COLS);
+            if (encoded.count(key)) continue; // Encoded tiles never hold formulas
+            Tile* tile = findTile(key, false);
+            if (!tile || !tile->hasFormulas) continue;
+            int firstRow = max(startRow, tileRow * TILE_ROWS), lastRow = min(endRow, tileRow * TILE_ROWS + TILE_ROWS - 1);
+            int firstCol = max(startCol, tileCol * TILE_COLS), lastCol = min(endCol, tileCol * TILE_COLS + TILE_COLS - 1);
+            for (int r = firstRow; r <= lastRow; ++r) {
+                for (int c = firstCol; c <= lastCol; ++c) {
+                    auto formulaCell = dynamic_cast<const FormulaCell*>(
+                        tile->cells[(r % TILE_ROWS) * TILE_COLS + c % TILE_COLS].get());
+                    if (formulaCell && formulaCell->isDirty()) {
+                        formulas.pushBack(make_pair(r, c));
+                    }
+                }
+            }
+        }
+    }
+}
+
+} // namespace GTUSpreadsheet
@@ -0,0 +1,267 @@
+#ifndef PAGEDGRID_H
+#define PAGEDGRID_H
+
+// Out-of-core cell storage for sheets larger than memory
+// The grid is cut into tiles of TILE_ROWS x TILE_COLS cells. Tiles live in a page file and only
+// the recently used ones are kept in memory, in an LRU cache bounded by a memory budget.
+// A tile is read back when one of its cells is accessed; modified tiles are written back
+// when they are evicted. Formulas are stored as an index into an in-memory table of their
+// shared programs, together with their last result.
+// A snapshot shares the cells of the tiles in memory (set() copies a shared tile before writing
+// to it) and reads the other tiles from their slots, which are not rewritten until it is released.
+// Optionally, evicted tiles without formulas are first kept in memory column-encoded (see
+// EncodedTile), which takes a fraction of the memory of their cells, and only the oldest of
+// them go to the page file once the encoded tiles exceed their own budget.
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include "Custom1DArray.h"
+
+using namespace std;
+
+class Cell;
+class FormulaProgram;
+
+namespace GTUSpreadsheet {
+
+class Spreadsheet;
+class EncodedTile;
+
+class PagedGrid {
+private:
+    // Where a tile is stored in the page file
+    struct PageSlot {
+        uint64_t offset;
+        uint32_t length;
+        uint32_t capacity;   // A rewritten tile that still fits reuses the slot
+    };
+
+public:
+    static const int TILE_ROWS = 256;
+    static const int TILE_COLS = 16;
+
+    // The tiles as they were when takeSnapshot() was called; may be read on another thread
+    class Snapshot {
+    public:
+        // Closes its descriptor of the page file
+        ~Snapshot();
+
+        Snapshot(const Snapshot&) = delete;
+        Snapshot& operator=(const Snapshot&) = delete;
+
+        // Tiles decoded from the page file for one reading thread
+        // Several threads may read the snapshot at once if each one uses its own reader
+        class Reader {
+        public:
+            explicit Reader(const Snapshot& snapshot);
+
+            // Returns the cell at (row, col) (nullptr if empty); valid until the next call
+            const shared_ptr<Cell>& get(int row, int col);
+
+        private:
+            const Snapshot& snapshot;
+            unordered_map<long long, shared_ptr<shared_ptr<Cell>[]>> readTiles;
+            long long lastKey;
+            const shared_ptr<Cell>* lastCells;
+        };
+
+        // Returns the cell at (row, col) (nullptr if empty); valid until the next call
+        // Uses the reader of the snapshot, so only one thread may call it
+        const shared_ptr<Cell>& get(int row, int col) const;
+
+    private:
+        friend class PagedGrid;
+        Snapshot();
+
+        // Tiles read from the page file that a reader keeps for the next calls
+        static const size_t READ_TILES = 64;
+
+        int fd; // Own descriptor of the page file
+        unordered_map<long long, shared_ptr<shared_ptr<Cell>[]>> sharedTiles; // Tiles that were in memory
+        unordered_map<long long, shared_ptr<const EncodedTile>> encodedTiles; // Tiles that were encoded
+        unordered_map<long long, PageSlot> slots;
+        DynamicArray<shared_ptr<const FormulaProgram>> programs;
+        mutable Reader reader;
+    };
+
+    // Creates the page file; it is unlinked right away, so it disappears with the process
+    // Throws runtime_error if the file cannot be created
+    PagedGrid(Spreadsheet& owner, const string& pageFileName, size_t memoryBudgetBytes);
+
+    // Closes the page file
+    ~PagedGrid();
+
+    PagedGrid(const PagedGrid&) = delete;
+    PagedGrid& operator=(const PagedGrid&) = delete;
+
+    // Returns the cell at (row, col), reading its tile from the page file if needed (nullptr if empty)
+    // The reference is valid until the next access to the grid
+    const shared_ptr<Cell>& get(int row, int col) const;
+
+    // Stores a cell; its tile is marked modified
+    void set(int row, int col, shared_ptr<Cell> cell);
+
+    // Calls visit() with the number of every numeric cell of the range, row by row, as
+    // FormulaCell::readNumber reads them; encoded tiles are read without building their cells
+    void scanNumbers(int startRow, int startCol, int endRow, int endCol, const function<void(double)>& visit) const;
+
+    // Appends the positions of the dirty formulas of the range, row by row within each tile;
+    // encoded tiles and tiles without formulas are skipped without looking at their cells
+    void collectDirtyFormulas(int startRow, int startCol, int endRow, int endCol,
+                              DynamicArray<pair<int, int>>& formulas) const;
+
+    // Evicted tiles without formulas are kept encoded in memory, up to about this many bytes,
+    // before they are written to the page file; 0 (the default) writes them right away
+    void setEncodedMemoryBudget(size_t bytes);
+
+    // Drops every tile and empties the page file
+    // Throws logic_error while a snapshot is alive
+    void clear();
+
+    // Takes a snapshot of the tiles; pending formulas must have been computed first
+    // Costs one pointer per tile in memory and a copy of the slot and program tables
+    unique_ptr<Snapshot> takeSnapshot();
+
+    // Called once a snapshot was destroyed: its slots may be reused again
+    void releaseSnapshot();
+
+    // Approximate memory held by the tiles in the cache
+    size_t getResidentBytes() const;
+
+    // Number of tiles in the cache
+    int getResidentTiles() const;
+
+    // Bytes used in the page file
+    size_t getPageFileBytes() const;
+
+    // Memory budget of the cache
+    size_t getMemoryBudget() const;
+
+    // Memory held by the encoded tiles, and their number
+    size_t getEncodedBytes() const;
+    int getEncodedTiles() const;
+
+    // Budget of the encoded tiles (0 = not used)
+    size_t getEncodedMemoryBudget() const;
+
+private:
+    static const int TILE_CELLS = TILE_ROWS * TILE_COLS;
+    // Rough footprint of a cell object with its control block; labels add their length
+    static const size_t VALUE_CELL_BYTES = 128;
+    static const size_t FORMULA_CELL_BYTES = 256;
+    static const size_t TILE_BYTES = TILE_CELLS * sizeof(shared_ptr<Cell>) + 64;
+    // Typical length of a formula result, reserved in the page file for stale formulas
+    static const size_t RESULT_BYTES = 16;
+    // Cell count of a page record that holds an encoded tile instead of a cell list
+    static const uint32_t ENCODED_RECORD = 0xffffffff;
+
+    // A tile in memory, linked into the LRU list (head = most recently used)
+    struct Tile {
+        long long key;
+        shared_ptr<shared_ptr<Cell>[]> cells; // Shared with snapshots, copied before a write
+        size_t bytes;        // Estimated memory of the tile and its cells
+        bool dirty;          // Changed since it was read from the page file
+        bool hasFormulas;    // Formula results may change without the tile being modified
+        uint64_t resultStamp; // Hash of the formula results as they are in the page file
+        Tile* prev;
+        Tile* next;
+    };
+
+    // An evicted tile kept encoded in memory
+    struct EncodedEntry {
+        shared_ptr<const EncodedTile> tile;
+        uint64_t age;    // Order of encoding; the oldest go to the page file first
+        bool written;    // The page file already holds the same cells, so it is dropped without a write
+    };
+
+    Spreadsheet& owner;  // Cells read back belong to this sheet
+    int fd;              // Page file
+    size_t memoryBudget;
+    mutable uint64_t fileEnd; // Next free byte in the page file
+
+    // Reads fill the cache and evict from it, so the cache is mutable
+    mutable unordered_map<long long, unique_ptr<Tile>> resident;
+    mutable unordered_map<long long, PageSlot> slots;
+    mutable multimap<uint32_t, uint64_t> freeSlots; // Capacity -> offset of slots left by moved tiles
+    int snapshots;       // Live snapshots; while there are any, tiles are never rewritten in place
+    mutable DynamicArray<pair<uint32_t, uint64_t>> retiredSlots; // Slots given up while snapshots read them
+    // Formulas are stored as an index into this table, so reading a tile does not compile them
+    mutable DynamicArray<shared_ptr<const FormulaProgram>> programs;
+    mutable unordered_map<const FormulaProgram*, uint32_t> programIds;
+    mutable Tile* lruHead;
+    mutable Tile* lruTail;
+    mutable size_t residentBytes;
+    mutable Tile* lastTile;  // Most recently accessed tile, checked before the hash lookup
+    size_t encodedBudget;
+    mutable unordered_map<long long, EncodedEntry> encoded;
+    mutable map<uint64_t, long long> encodedOrder; // Age -> key
+    mutable uint64_t nextAge;
+    mutable size_t encodedBytes;
+    static const shared_ptr<Cell> emptyCell;
+
+    // Packs the tile coordinates of a cell into a key
+    static long long tileKey(int row, int col);
+
+    // Returns the resident tile, reading it from the page file; nullptr if it was never written
+    Tile* findTile(long long key, bool create) const;
+
+    // Reads a tile from its slot and builds its cells
+    Tile* readTile(long long key, const PageSlot& slot) const;
+
+    // Reads the record stored in a slot
+    static void readSlot(int fd, const PageSlot& slot, string& data);
+
+    // Builds the cells of a tile record into 'cells'; adds their memory to 'bytes'
+    // Without an owner (for a snapshot) the formulas belong to no sheet and must not be stale
+    static void decodeTile(const string& data, long long key, const DynamicArray<shared_ptr<const FormulaProgram>>& programs,
+                           const shared_ptr<Spreadsheet>& owner, shared_ptr<Cell>* cells, size_t& bytes, bool& hasFormulas);
+
+    // Finds room for a tile record of the given length that may grow by 'growth' bytes
+    PageSlot allocateSlot(size_t length, size_t growth) const;
+
+    // Serializes the tile into its slot (or a new one)
+    void writeTile(Tile& tile) const;
+
+    // Writes a record of the tile into its slot, or a new one if it does not fit
+    void writeRecord(long long key, const string& record, size_t growth) const;
+
+    // Encodes an evicted tile and keeps it in memory; returns false if encoded tiles are not
+    // used or the tile has formulas
+    bool encodeTile(const Tile& tile) const;
+
+    // Builds the tile of an encoded entry again and drops the entry
+    Tile* decodeEncoded(long long key) const;
+
+    // Writes the oldest encoded tiles to the page file until they fit their budget
+    void spillEncoded() const;
+
+    // Memory of decoded cells, as counted for a tile read from the page file
+    static size_t decodedBytes(const shared_ptr<Cell>* cells);
+
+    // Evicts least recently used tiles until the cache fits the budget; 'keep' is never evicted
+    void evictOverBudget(const Tile* keep) const;
+
+    // Returns the index of the program in the program table, adding it if needed
+    uint32_t programId(const shared_ptr<const FormulaProgram>& program) const;
+
+    // Hash of the results of the tile's formulas, to tell whether a clean tile must be written back
+    static uint64_t resultStamp(const Tile& tile);
+
+    // A tile whose formula is being evaluated or referenced outside the grid must stay in memory
+    static bool isPinned(const Tile& tile);
+
+    // Estimated memory of one cell, without the text of labels
+    static size_t cellBytes(const Cell* cell);
+
+    // LRU list maintenance
+    void removeFromLru(Tile* tile) const;
+    void pushFront(Tile* tile) const;
+};
+
+} // namespace GTUSpreadsheet
+
+#endif // PAGEDGRID_H
@@ -0,0 +1,26 @@
+#ifndef ROWSOURCE_H
+#define ROWSOURCE_H
+
+namespace GTUSpreadsheet {
+
+// Interface for a file whose rows are read into the spreadsheet only when they are needed
+// (e.g. a lazily opened CSV). Rows are handed out in blocks of BLOCK_ROWS; the spreadsheet asks
+// for a block the first time one of its cells is read or written.
+class RowSource {
+public:
+    static const int BLOCK_ROWS = 64;
+
+    virtual ~RowSource() = default;
+
+    // Stores the cells of rows [block * BLOCK_ROWS, (block + 1) * BLOCK_ROWS) into the spreadsheet
+    // Called at most once per block
+    virtual void loadBlock(int block) = 0;
+
+    // Finds the rows of the file until there are at least 'rows' of them or the file ends,
+    // growing the spreadsheet to the rows found
+    virtual void indexRows(int rows) = 0;
+};
+
+} // namespace GTUSpreadsheet
+
+#endif // ROWSOURCE_H
@@ -0,0 +1,132 @@
+#include "ScreenBuffer.h"
+#include "AnsiTerminal.h"
+#include <stdexcept>
+
+// Constructor: Allocates both buffers; the terminal contents are unknown until cleared
+ScreenBuffer::ScreenBuffer(int rows, int cols)
+    : rows(rows), cols(cols), cleared(true) {
+    if (rows <= 0 || cols <= 0) {
+        throw std::invalid_argument("Screen size must be positive");
+    }
+    back.reset(new Glyph[static_cast<size_t>(rows) * cols]);
+    front.reset(new Glyph[static_cast<size_t>(rows) * cols]);
+    fill(back.get());
+    fill(front.get());
+}
+
+// A blank is a space in the normal style, which looks the same as a cleared terminal cell
+void ScreenBuffer::fill(Glyph* glyphs) {
+    for (int i = 0; i < rows * cols; ++i) {
+        glyphs[i] = Glyph{' ', STYLE_NORMAL};
+    }
+}
+
+// Blanks the back buffer
+void ScreenBuffer::clear() {
+    fill(back.get());
+}
+
+// Writes the text into the back buffer, cutting it at the right edge of the screen
+void ScreenBuffer::print(int row, int col, const std::string& text, Style style) {
+    // The terminal treats row and column 0 as 1
+    if (row < 1) row = 1;
+    if (col < 1) col = 1;
+    if (row > rows) return;
+
+    Glyph* line = back.get() + static_cast<size_t>(row - 1) * cols;
+    std::size_t pos = 0;
+    for (int column = col - 1; pos < text.size() && column < cols; ++column) {
+        line[column] = Glyph{nextCharacter(text, pos), style};
+    }
+}
+
+// A lead byte tells how many continuation bytes follow; anything else is one byte on its own
+std::uint32_t ScreenBuffer::nextCharacter(const std::string& text, std::size_t& pos) {
+    unsigned char lead = static_cast<unsigned char>(text[pos++]);
+    // A control character would move the terminal's cursor away from where the model has it
+    if (lead < 0x20 || lead == 0x7f) return ' ';
+    if (lead < 0x80) return lead;
+
+    int length = lead >= 0xf0 && lead < 0xf8 ? 4 : lead >= 0xe0 ? 3 : lead >= 0xc0 ? 2 : 0;
+    if (length == 0 || lead >= 0xf8 || text.size() - pos < static_cast<std::size_t>(length - 1)) {
+        return '?'; // A stray continuation byte, an invalid lead byte or a cut-off character
+    }
+    std::uint32_t ch = lead;
+    for (int i = 1; i < length; ++i) {
+        unsigned char next = static_cast<unsigned char>(text[pos]);
+        if ((next & 0xc0) != 0x80) return '?'; // The next character starts here
+        ch |= static_cast<std::uint32_t>(next) << (8 * i);
+        ++pos;
+    }
+    return ch;
+}
+
+void ScreenBuffer::appendCharacter(std::string& out, std::uint32_t ch) {
+    do {
+        out += static_cast<char>(ch & 0xff);
+        ch >>= 8;
+    } while (ch != 0);
+}
+
+// Forces a full redraw on the next present()
+void ScreenBuffer::invalidate() {
+    cleared = true;
+}
+
+// Prints each run of changed characters of the same style with one cursor move
+// The frame goes to the terminal with a single write
+void ScreenBuffer::present(AnsiTerminal& terminal) {
+    terminal.beginFrame();
+    if (cleared) {
+        terminal.clearScreen();
+        fill(front.get());
+        cleared = false;
+    }
+
+    std::string text;
+    for (int row = 0; row < rows; ++row) {
+        const Glyph* newLine = back.get() + static_cast<size_t>(row) * cols;
+        Glyph* oldLine = front.get() + static_cast<size_t>(row) * cols;
+
+        int col = 0;
+        while (col < cols) {
+            if (newLine[col] == oldLine[col]) {
+                ++col;
+                continue;
+            }
+
+            // Extend the run over the following changes of the same style, bridging short gaps
+            Style style = newLine[col].style;
+            int start = col;
+            int end = col + 1;
+            for (int next = end; next < cols && newLine[next].style == style; ++next) {
+                if (newLine[next] != oldLine[next]) {
+                    end = next + 1;
+                } else if (next - end >= MERGE_GAP) {
+                    break;
+                }
+            }
+
+            text.clear();
+            for (int i = start; i < end; ++i) {
+                appendCharacter(text, newLine[i].ch);
+                oldLine[i] = newLine[i];
+            }
+            if (style == STYLE_INVERTED) {
+                terminal.printInvertedAt(row + 1, start + 1, text);
+            } else {
+                terminal.printAt(row + 1, start + 1, text);
+            }
+            col = end;
+        }
+    }
+    terminal.endFrame();
+}
+
+int ScreenBuffer::getRows() const {
+    return rows;
+}
+
+int ScreenBuffer::getCols() const {
+    return cols;
+}
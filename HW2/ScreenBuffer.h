@@ -0,0 +1,78 @@
+#ifndef SCREEN_BUFFER_H
+#define SCREEN_BUFFER_H
+
+// Model of the terminal screen for flicker-free redraws
+// A frame is drawn into the back buffer; present() compares it with the front buffer (what the
+// terminal shows) and prints only the runs of characters that changed, then keeps the frame as
+// the new front buffer. Redrawing an unchanged screen prints nothing.
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+class AnsiTerminal;
+
+class ScreenBuffer {
+public:
+    // How a character is drawn, as AnsiTerminal::printAt / printInvertedAt draw it
+    enum Style : unsigned char { STYLE_NORMAL = 0, STYLE_INVERTED = 1 };
+
+    // Creates a screen of rows x cols characters; the first present() clears the terminal
+    ScreenBuffer(int rows, int cols);
+
+    ScreenBuffer(const ScreenBuffer&) = delete;
+    ScreenBuffer& operator=(const ScreenBuffer&) = delete;
+
+    // Blanks the back buffer before a new frame is drawn
+    void clear();
+
+    // Draws text into the back buffer at a 1-based row and column, like AnsiTerminal::printAt
+    // Each character takes one column, however many bytes it has; text beyond the screen is cut off
+    void print(int row, int col, const std::string& text, Style style = STYLE_NORMAL);
+
+    // The terminal was drawn on directly (e.g. by a menu), so the next present() clears it
+    // and prints the whole frame
+    void invalidate();
+
+    // Prints the differences between the back and front buffers to the terminal as one frame
+    void present(AnsiTerminal& terminal);
+
+    int getRows() const;
+    int getCols() const;
+
+private:
+    // One character of the screen with its style
+    // A character is one terminal column, so a multi-byte UTF-8 character is one glyph holding
+    // all of its bytes (the first one in the low byte of ch)
+    struct Glyph {
+        std::uint32_t ch;
+        Style style;
+
+        bool operator==(const Glyph& other) const { return ch == other.ch && style == other.style; }
+        bool operator!=(const Glyph& other) const { return !(*this == other); }
+    };
+
+    // Unchanged characters between two changes of a row up to which both are printed as one run,
+    // since printing them is shorter than the cursor move to the next change
+    static const int MERGE_GAP = 6;
+
+    int rows;
+    int cols;
+    std::unique_ptr<Glyph[]> back;   // Frame being drawn
+    std::unique_ptr<Glyph[]> front;  // What the terminal shows
+    bool cleared;                    // The terminal must be cleared before the next present()
+
+    // Sets every glyph of the buffer to a blank
+    void fill(Glyph* glyphs);
+
+    // Reads the character starting at text[pos] and advances pos past it
+    // Control characters become a space and broken UTF-8 sequences a '?', so every glyph takes
+    // exactly one column on the terminal
+    static std::uint32_t nextCharacter(const std::string& text, std::size_t& pos);
+
+    // Appends the bytes of a glyph's character
+    static void appendCharacter(std::string& out, std::uint32_t ch);
+};
+
+#endif // SCREEN_BUFFER_H
@@ -0,0 +1,56 @@
+#include "SheetSnapshot.h"
+#include "Cell.h"
+#include "NumberFormat.h"
+
+namespace GTUSpreadsheet {
+
+// The sheet fills in the grid or the tiles
+SheetSnapshot::SheetSnapshot(int totalRows, int totalCols, int usedRows, int usedCols)
+    : totalRows(totalRows), totalCols(totalCols), usedRows(usedRows), usedCols(usedCols), grid(1, 1) {}
+
+int SheetSnapshot::getTotalRows() const {
+    return totalRows;
+}
+
+int SheetSnapshot::getTotalCols() const {
+    return totalCols;
+}
+
+int SheetSnapshot::getUsedRows() const {
+    return usedRows;
+}
+
+int SheetSnapshot::getUsedCols() const {
+    return usedCols;
+}
+
+// Columns the sheet never set keep the default
+int SheetSnapshot::getColumnPrecision(int col) const {
+    if (col >= 0 && col < columnPrecision.getSize()) {
+        return columnPrecision[col];
+    }
+    return NumberFormat::DEFAULT_PRECISION;
+}
+
+int SheetSnapshot::getPrecisionColumns() const {
+    return columnPrecision.getSize();
+}
+
+const Cell* SheetSnapshot::peekCell(int row, int col) const {
+    if (row < 0 || row >= totalRows || col < 0 || col >= totalCols) {
+        return nullptr;
+    }
+    return pages ? pages->get(row, col).get() : grid.at(row, col).get();
+}
+
+SheetSnapshot::Reader::Reader(const SheetSnapshot& sheet)
+    : sheet(sheet), pages(sheet.pages ? new PagedGrid::Snapshot::Reader(*sheet.pages) : nullptr) {}
+
+const Cell* SheetSnapshot::Reader::peekCell(int row, int col) {
+    if (row < 0 || row >= sheet.totalRows || col < 0 || col >= sheet.totalCols) {
+        return nullptr;
+    }
+    return pages ? pages->get(row, col).get() : sheet.grid.at(row, col).get();
+}
+
+} // namespace GTUSpreadsheet
@@ -0,0 +1,74 @@
+#ifndef SHEETSNAPSHOT_H
+#define SHEETSNAPSHOT_H
+
+#include <memory>
+#include "Custom1DArray.h"
+#include "Custom2DArray.h"
+#include "PagedGrid.h"
+
+using namespace std;
+
+class Cell;
+
+namespace GTUSpreadsheet {
+
+// Read-only copy of a spreadsheet taken for writing it out (see Spreadsheet::takeSnapshot)
+// Taking it copies no cells: it shares the row blocks of the grid, or in paged mode the tiles,
+// with the sheet, which copies a block before it writes to it again. A formula whose result
+// changes while the snapshot is alive is replaced by a copy in the sheet, so the cells seen
+// here keep the values they had when it was taken.
+// Only const methods of the cells are used, so the snapshot may be read on another thread
+// while the sheet is edited; it is handed back with Spreadsheet::releaseSnapshot.
+class SheetSnapshot {
+public:
+    SheetSnapshot(const SheetSnapshot&) = delete;
+    SheetSnapshot& operator=(const SheetSnapshot&) = delete;
+
+    // Dimensions of the sheet when the snapshot was taken
+    int getTotalRows() const;
+    int getTotalCols() const;
+
+    // Bounds of the cells that received content, as Spreadsheet::getUsedRows/getUsedCols
+    int getUsedRows() const;
+    int getUsedCols() const;
+
+    // Decimals the column showed when the snapshot was taken (see Spreadsheet::getColumnPrecision)
+    int getColumnPrecision(int col) const;
+
+    // Returns the size of the precision table; columns past it show the default
+    int getPrecisionColumns() const;
+
+    // Returns the cell at the position (nullptr if none)
+    // In paged mode the pointer is valid until the next call, and only one thread may call it
+    const Cell* peekCell(int row, int col) const;
+
+    // Reads the cells on one of several threads; each thread uses its own reader
+    class Reader {
+    public:
+        explicit Reader(const SheetSnapshot& sheet);
+
+        // Returns the cell at the position (nullptr if none), like peekCell
+        const Cell* peekCell(int row, int col);
+
+    private:
+        const SheetSnapshot& sheet;
+        unique_ptr<PagedGrid::Snapshot::Reader> pages; // Tile cache of this thread in paged mode
+    };
+
+private:
+    friend class Spreadsheet;
+
+    SheetSnapshot(int totalRows, int totalCols, int usedRows, int usedCols);
+
+    int totalRows;
+    int totalCols;
+    int usedRows;
+    int usedCols;
+    DynamicArray<unsigned char> columnPrecision; // Copied from the sheet
+    Dynamic2DVector<shared_ptr<Cell>> grid;    // Row blocks shared with the sheet
+    unique_ptr<PagedGrid::Snapshot> pages;     // Tiles of the page cache in paged mode
+};
+
+} // namespace GTUSpreadsheet
+
+#endif // SHEETSNAPSHOT_H
@@ -1,10 +1,17 @@
 #include "Spreadsheet.h"
 #include"FileManager.h"
 #include "Cell.h"
+#include "ColumnKernel.h"
+#include "NumberFormat.h"
 #include <iostream>
 #include <iomanip>
 #include <stdexcept>
 #include <memory>
+#include <unordered_map>
+#include <chrono>
+#include <charconv>
+#include <cctype>
+#include <limits>
 
 
 namespace GTUSpreadsheet {
@@ -26,7 +33,21 @@ Spreadsheet::Spreadsheet(int rows, int cols)
       visibleRows(21), 
       visibleCols(8),
       cellWidth(9),
-      grid(rows, cols) {
+      lazyEvaluation(false),
+      batchDepth(0),
+      backgroundRecalculation(false),
+      usedRows(0),
+      usedCols(0),
+      editObserver(nullptr),
+      rowSource(nullptr),
+      liveSnapshots(0),
+      editing(false),
+      editRow(0),
+      editCol(0),
+      screen(GRID_START_ROW + visibleRows - 1,
+             3 + visibleCols * cellWidth > STATUS_WIDTH ? 3 + visibleCols * cellWidth : STATUS_WIDTH),
+      grid(rows, cols),
+      recalcQueueHead(0) {
 }
 
 // Initializes the grid by creating and assigning cells to the grid structure
@@ -63,6 +84,13 @@ void Spreadsheet::resizeGrid(int newRows, int newCols) {
         throw invalid_argument("Grid dimensions must be positive");
     }
 
+    // Paged tiles are created when a cell is first stored, so only the dimensions change
+    if (pages) {
+        totalRows = newRows;
+        totalCols = newCols;
+        return;
+    }
+
     // Store old dimensions
     int oldRows = totalRows;
     int oldCols = totalCols;
@@ -88,27 +116,12 @@ void Spreadsheet::resizeGrid(int newRows, int newCols) {
     }
 }
 
-//Parses a cell reference string (e.g., "A1") into numeric row and column indices
+//Parses a cell reference string (e.g., "A1", "AB12") into numeric row and column indices
+//Uses the same rules as the formula compiler so both agree on what a reference means
 void Spreadsheet::parseCellReference(const string& reference, int& row, int& col) const {
-    string colLabel, rowLabel;
-
-    //Separate column labels and row numbers from the reference string
-    for (char ch : reference) {
-        if (isalpha(ch)) {
-            colLabel += ch; // Collect alphabetical characters as column label
-        } else if (isdigit(ch)) {
-            rowLabel += ch; // Collect numerical characters as row number
-        } else {
-            throw runtime_error("Invalid cell reference: " + reference);
-        }
-    }
-
-    if (colLabel.empty() || rowLabel.empty()) {
-        throw runtime_error("Incomplete cell reference: " + reference);
+    if (!FormulaProgram::parseReference(reference, row, col)) {
+        throw runtime_error("Invalid cell reference: " + reference);
     }
-
-    col = colLabel[0] - 'A'; // Assuming single-character column labels
-    row = stoi(rowLabel) - 1; // Convert to zero-based index
 }
 
 // Destructor
@@ -149,7 +162,9 @@ string Spreadsheet::getColumnLabel(int col) const {
 void Spreadsheet::drawGrid(AnsiTerminal& terminal, int selectedRow, int selectedCol, 
                           int rowOffset, int colOffset){
     try {
-        terminal.clearScreen();
+        // The frame is drawn into the back buffer; only what differs from the previous
+        // frame is printed at the end
+        screen.clear();
 
         //Auto-resize the grid if the selection exceeds the current grid size
         if (selectedRow >= totalRows || selectedCol >= totalCols) {
@@ -172,12 +187,15 @@ void Spreadsheet::drawGrid(AnsiTerminal& terminal, int selectedRow, int selected
         }
 
         // Get the currently selected cell
-        shared_ptr<Cell> selectedCell = grid.at(selectedRow, selectedCol);
+        shared_ptr<Cell> selectedCell = cellAt(selectedRow, selectedCol);
         
         // First line: Cell info and content
         string currentCellInfo = getColumnLabel(selectedCol) + to_string(selectedRow + 1);
         string typeDisplay;
-        string cellContent = selectedCell ? selectedCell->getRawContent() : "";
+        // While the selected cell is being edited the lines show the typed text
+        bool editingSelected = editing && editRow == selectedRow && editCol == selectedCol;
+        string cellContent = editingSelected ? editText
+                                             : (selectedCell ? selectedCell->getRawContent() : "");
 
         // Determine cell type display
         if (auto strCell = dynamic_pointer_cast<StringValueCell>(selectedCell)) {
@@ -194,18 +212,17 @@ void Spreadsheet::drawGrid(AnsiTerminal& terminal, int selectedRow, int selected
 
         // Pad the first line
         string paddedFirstLine = currentCellInfo + " " + typeDisplay + " " + cellContent;
-        while (paddedFirstLine.length() < 75) {
+        while (paddedFirstLine.length() < STATUS_WIDTH) {
             paddedFirstLine += ' ';
         }
-        terminal.printInvertedAt(0, 1, paddedFirstLine);
+        screen.print(1, 1, paddedFirstLine, ScreenBuffer::STYLE_INVERTED);
 
         // Display raw content (formula or value)
-        string rawContent = selectedCell ? selectedCell->getRawContent() : "";
-        string paddedInputDisplay = rawContent;
-        while (paddedInputDisplay.length() < 75) {
+        string paddedInputDisplay = cellContent;
+        while (paddedInputDisplay.length() < STATUS_WIDTH) {
             paddedInputDisplay += ' ';
         }
-        terminal.printAt(3, 1, paddedInputDisplay);
+        screen.print(3, 1, paddedInputDisplay);
 
         // Display cell type
         string typeDisplayLine;
@@ -221,17 +238,24 @@ void Spreadsheet::drawGrid(AnsiTerminal& terminal, int selectedRow, int selected
             typeDisplayLine = "";
         }
 
+        if (editingSelected) {
+            typeDisplayLine = "Editing (Enter sets the cell, ESC cancels)";
+        }
         string paddedTypeDisplay = typeDisplayLine;
-        while (paddedTypeDisplay.length() < 75) {
+        if (hasPendingRecalc()) {
+            paddedTypeDisplay += "  [recalculating: " +
+                to_string(recalcQueue.getSize() - recalcQueueHead) + " pending]";
+        }
+        if (!statusMessage.empty()) {
+            paddedTypeDisplay += "  [" + statusMessage + "]";
+        }
+        while (paddedTypeDisplay.length() < STATUS_WIDTH) {
             paddedTypeDisplay += ' ';
         }
-        terminal.printInvertedAt(2, 1, paddedTypeDisplay);
-
-        // Grid display starting position
-        const int gridStartRow = 5;
+        screen.print(2, 1, paddedTypeDisplay, ScreenBuffer::STYLE_INVERTED);
 
         // Print top-left corner
-        terminal.printInvertedAt(gridStartRow - 1, 1, string(cellWidth, ' '));
+        screen.print(GRID_START_ROW - 1, 1, string(cellWidth, ' '), ScreenBuffer::STYLE_INVERTED);
 
         // Print column headers
         for (int col = 0; col < visibleCols; ++col) {
@@ -246,10 +270,11 @@ void Spreadsheet::drawGrid(AnsiTerminal& terminal, int selectedRow, int selected
             paddedColLabel += colLabel;
             paddedColLabel += string(paddingRight, ' ');
 
-            terminal.printInvertedAt(gridStartRow - 1, 4 + col * cellWidth, paddedColLabel);
+            screen.print(GRID_START_ROW - 1, 4 + col * cellWidth, paddedColLabel, ScreenBuffer::STYLE_INVERTED);
         }
 
         // Print rows with content
+        const string blankCell(cellWidth, ' ');
         for (int row = 0; row < visibleRows; ++row) {
             int actualRow = row + rowOffset;
             if (actualRow >= getTotalRows()) break;
@@ -257,197 +282,285 @@ void Spreadsheet::drawGrid(AnsiTerminal& terminal, int selectedRow, int selected
             // Print row label
             string rowLabel = to_string(actualRow + 1);
             string paddedRowLabel = rowLabel + string(cellWidth - rowLabel.length() - 1, ' ') + ' ';
-            terminal.printInvertedAt(gridStartRow + row, 1, paddedRowLabel);
+            screen.print(GRID_START_ROW + row, 1, paddedRowLabel, ScreenBuffer::STYLE_INVERTED);
 
             // Print cell contents
             for (int col = 0; col < visibleCols; ++col) {
                 int actualCol = col + colOffset;
                 if (actualCol >= getTotalCols()) break;
 
-                shared_ptr<Cell> cell = grid.at(actualRow, actualCol);
-                string content = cell ? cell->getContent() : "";
+                shared_ptr<Cell> cell = cellAt(actualRow, actualCol);
+
+                // With background recalculation a stale formula keeps its old value and a
+                // pending marker; it is not computed here so drawing never blocks
+                // A cell being edited shows the typed text instead
+                bool edited = editing && actualRow == editRow && actualCol == editCol;
+                auto formulaCell = dynamic_cast<const FormulaCell*>(cell.get());
+                bool pending = !edited && backgroundRecalculation && formulaCell && formulaCell->isDirty();
 
-                // Trim content if too long
-                string displayContent = content.length() > cellWidth ? 
-                    content.substr(0, cellWidth) : content;
-                
-                // Pad content
-                string paddedContent = displayContent + 
-                    string(cellWidth - displayContent.length(), ' ');
+                string editedContent;
+                if (edited) {
+                    editedContent = editText.substr(0, cellWidth);
+                    editedContent += string(cellWidth - editedContent.length(), ' ');
+                }
+                const string& paddedContent = edited ? editedContent
+                                            : cell ? displayText(cell, pending, getColumnPrecision(actualCol))
+                                                   : blankCell;
 
-                int cellRow = gridStartRow + row;
+                int cellRow = GRID_START_ROW + row;
                 int cellCol = 4 + col * cellWidth;
 
                 if (actualRow == selectedRow && actualCol == selectedCol) {
-                    terminal.printInvertedAt(cellRow, cellCol, paddedContent);
+                    screen.print(cellRow, cellCol, paddedContent, ScreenBuffer::STYLE_INVERTED);
                 } else {
-                    if (!content.empty()) {
-                        terminal.printAt(cellRow, cellCol, paddedContent);
-                    } else {
-                        terminal.printAt(cellRow, cellCol, string(cellWidth, ' '));
-                    }
+                    screen.print(cellRow, cellCol, paddedContent);
                 }
             }
         }
+
+        screen.present(terminal);
     } catch (const exception& e) {
         throw runtime_error("Error in drawGrid: " + string(e.what()));
     }
 }
 
 
-// Clear the spreadsheet
-void Spreadsheet::clear() {
-    for (int r = 0; r < totalRows; ++r) {
-        for (int c = 0; c < totalCols; ++c) {
-            grid.at(r, c) = nullptr;
+// Formats the cell only when it is not cached for its current result, the cell width and precision
+const string& Spreadsheet::displayText(const shared_ptr<Cell>& cell, bool pending, int precision) {
+    auto formulaCell = dynamic_cast<FormulaCell*>(cell.get());
+
+    // Reading a stale formula that is not left pending computes it, which gives a new result
+    if (formulaCell && !pending && formulaCell->isDirty()) {
+        formulaCell->evaluate();
+    }
+    unsigned version = formulaCell ? formulaCell->getResultVersion() : 0;
+
+    auto it = displayCache.find(cell.get());
+    if (it != displayCache.end()) {
+        const DisplayEntry& entry = it->second;
+        // Owner comparison: a new cell allocated where an old one was is a different owner
+        bool sameCell = !entry.cell.owner_before(cell) && !cell.owner_before(entry.cell);
+        if (sameCell && entry.version == version && entry.width == cellWidth &&
+            entry.precision == precision && entry.pending == pending) {
+            return entry.text;
+        }
+    } else {
+        if (displayCache.size() >= DISPLAY_CACHE_CELLS) {
+            displayCache.clear();
         }
+        it = displayCache.emplace(cell.get(), DisplayEntry()).first;
     }
+
+    // The number is formatted straight into the cached text
+    string& text = it->second.text;
+    text.clear();
+    if (pending) {
+        formulaCell->appendResult(text, precision);
+    } else {
+        cell->appendFormatted(text, precision);
+    }
+
+    // Trim content if too long
+    int contentWidth = pending ? cellWidth - 1 : cellWidth;
+    if (text.length() > static_cast<size_t>(contentWidth)) {
+        text.resize(contentWidth);
+    }
+    if (pending) {
+        text += PENDING_MARKER;
+    }
+    // Pad content
+    text.append(cellWidth - text.length(), ' ');
+
+    it->second.cell = cell;
+    it->second.version = version;
+    it->second.width = cellWidth;
+    it->second.precision = precision;
+    it->second.pending = pending;
+    return text;
 }
 
+// Columns past the end of the table use the default, so the table only grows when a column is set
+void Spreadsheet::setColumnPrecision(int col, int decimals) {
+    if (col < 0) {
+        throw out_of_range("Column out of range");
+    }
+    while (columnPrecision.getSize() <= col) {
+        columnPrecision.pushBack(NumberFormat::DEFAULT_PRECISION);
+    }
+    unsigned char precision = static_cast<unsigned char>(NumberFormat::clampPrecision(decimals));
+    if (columnPrecision[col] == precision) return;
+    columnPrecision[col] = precision;
+    if (editObserver) {
+        editObserver->onColumnPrecisionChanged(col);
+    }
+}
 
-void Spreadsheet::handleInput(char key, int curRow, int curCol, Utils::FileManager &fileManager) {
-    AnsiTerminal terminal;
-    //Ignore navigation keys at this point
-    if (key == 'U' || key == 'D' || key == 'L' || key == 'R') {
-        return;
+int Spreadsheet::getColumnPrecision(int col) const {
+    if (col >= 0 && col < columnPrecision.getSize()) {
+        return columnPrecision[col];
     }
+    return NumberFormat::DEFAULT_PRECISION;
+}
 
-    int rowOffset;
-    int colOffset;
 
-    //Handle directional input for moving the cursor
-    switch(key) {
-        case 'U':
-            if (curRow > 0) {
-                curRow--;
-                if (curRow < rowOffset) {
-                    rowOffset = curRow;
-                }
-            }
-            break;
-            
-        case 'D':
-            curRow++;
-            if (curRow >= totalRows) {
-                resizeGrid(curRow + 10, totalCols); // Expand grid if needed
-            }
-            if (curRow - rowOffset >= visibleRows) {
-                rowOffset = curRow - visibleRows + 1;
-            }
-            break;
-            
-        case 'L':
-            if (curCol > 0) {
-                curCol--;
-                if (curCol < colOffset) {
-                    colOffset = curCol;
-                }
-            }
-            break;
-            
-        case 'R':
-            curCol++;
-            if (curCol >= totalCols) {
-                resizeGrid(totalRows, curCol + 5); // Expand grid horizontally if needed
-            }
-            if (curCol - colOffset >= visibleCols) {
-                colOffset = curCol - visibleCols + 1;
+// Clear the spreadsheet
+void Spreadsheet::clear() {
+    if (liveSnapshots > 0) {
+        throw logic_error("The spreadsheet cannot be cleared while a snapshot is being written");
+    }
+    // Typed text belongs to a cell that is going away, and the columns start over
+    editing = false;
+    columnPrecision.clear();
+    if (pages) {
+        pages->clear();
+    } else {
+        for (int r = 0; r < totalRows; ++r) {
+            for (int c = 0; c < totalCols; ++c) {
+                grid.at(r, c) = nullptr;
             }
-            break;
+        }
     }
+    dependencyGraph.clear();
+    usedRows = 0;
+    usedCols = 0;
+    // The cleared rows must not be loaded again from the file
+    rowSource = nullptr;
+    loadedBlocks.clear();
+}
+
 
-    //Update the grid display after moving the cursor
-    drawGrid(terminal, curRow, curCol, rowOffset, colOffset);
+void Spreadsheet::handleInput(AnsiTerminal& terminal, int key, int curRow, int curCol, Utils::FileManager &fileManager) {
+    //Navigation keys are handled by the caller, which also redraws the grid
+    if (AnsiTerminal::isArrowKey(key)) {
+        return;
+    }
 
     //Ensure grid expansion if the cursor moves beyond current bounds
     if (curRow >= totalRows || curCol >= totalCols) {
         resizeGrid(curRow + 1, curCol + 1);
     }
 
-    shared_ptr<Cell> currentCell = grid.at(curRow, curCol);
-    string temp;
-    if (currentCell) {
-        temp = currentCell->getRawContent(); 
-    } else {
-        temp = "";
+    //An edit of another cell is finished before this one is touched
+    if (editing && (editRow != curRow || editCol != curCol)) {
+        commitEdit();
     }
 
-
     // Open the file menu when '\' is pressed
     if (key == '\\') {
+        // Saving must see the typed text, and loading replaces the cell anyway
+        commitEdit();
         terminal.clearScreen();
         terminal.printAt(1, 1, "Menu:");
         terminal.printAt(2, 1, "1. Save File");
         terminal.printAt(3, 1, "2. Load File");
-        terminal.printAt(4, 1, "3. Cancel");
-        terminal.printAt(5, 1, "Enter your choice: ");
+        terminal.printAt(4, 1, "3. Open Large File (rows are read as they are needed)");
+        terminal.printAt(5, 1, "4. Cancel");
+        terminal.printAt(6, 1, "Enter your choice: ");
 
         char choice = terminal.getKeystroke();
         switch (choice) {
             case '1': {
-                terminal.printAt(6, 1, "Enter file name to save as: ");
+                terminal.printAt(7, 1, "Enter file name to save as: ");
                 string fileName;
                 cin >> fileName;
-                fileManager.saveFileAs(fileName);
+                // Saving to the open file only appends the new edits to its journal; a full
+                // write runs in the background and reports its result in the status line
+                fileManager.saveInBackground(fileName);
                 break;
             }
             case '2': {
-                terminal.printAt(6, 1, "Enter file name to load: ");
+                terminal.printAt(7, 1, "Enter file name to load: ");
                 string fileName;
                 cin >> fileName;
                 fileManager.loadFile(fileName);
                 break;
             }
-            case '3': // Cancel
+            case '3': {
+                terminal.printAt(7, 1, "Enter file name to open: ");
+                string fileName;
+                cin >> fileName;
+                fileManager.openFile(fileName);
+                break;
+            }
+            case '4': // Cancel
                 break;
             default:
                 break;
         }
         terminal.clearScreen();
+        // The menu was drawn over the grid, so the next frame is printed in full
+        screen.invalidate();
         return;
     }
 
+    //Alt+'.' and Alt+',' show one decimal more or less in the selected column
+    if (key == AnsiTerminal::ALT_KEY + '.' || key == AnsiTerminal::ALT_KEY + ',') {
+        setColumnPrecision(curCol, getColumnPrecision(curCol) + (key == AnsiTerminal::ALT_KEY + '.' ? 1 : -1));
+        return;
+    }
+    //Other Alt keys have no action and are not typed text
+    if (key >= AnsiTerminal::ALT_KEY) {
+        return;
+    }
+
+    //Enter sets the cell from the edit line; ESC drops the edit line
+    if (key == '\x0D') {
+        commitEdit();
+        return;
+    }
+    if (key == '\033') {
+        cancelEdit();
+        return;
+    }
+
+    //The edit line starts from the cell's content, so typing appends to it
+    if (!editing) {
+        const Cell* currentCell = peekCell(curRow, curCol);
+        editText = currentCell ? currentCell->getRawContent() : "";
+        editRow = curRow;
+        editCol = curCol;
+        editing = true;
+    }
+
     //Handle backspace for deleting the last character in the cell content
+    //Typing only changes the edit line; nothing is parsed or recalculated until the commit
     if(key == '\b' || key == 127 || key == 8) {
-        if (!temp.empty()) {
-            temp.pop_back();
-            setCellContent(curRow, curCol, temp);
-        }
-    //Process regular input for formulas and values
-    } else if(key != 'U' && key != 'D' && key != 'R' && key != 'L') {
-        temp.push_back(key);
-
-        //If the input starts a formula (using '@' for functions)
-        if(temp[0] == '@' && temp.find(')') != string::npos) {
-            auto formulaCell = make_shared<FormulaCell>(temp, shared_from_this());
-            grid.at(curRow, curCol) = formulaCell;
-            try {
-                formulaCell->evaluate(); // Try to evaluate the formula
-            } catch (const exception& e) {
-                formulaCell->setContent("#ERROR");
-            }
-        //If the input starts an arithmetic formula (using '=')
-        } else if(temp[0] == '=') {
-            auto formulaCell = make_shared<FormulaCell>(temp, shared_from_this());
-            grid.at(curRow, curCol) = formulaCell;
-            try {
-                formulaCell->evaluate();
-            } catch (const exception& e) {
-                formulaCell->setContent("#ERROR");
-            }
-        //Otherwise, treat input as a regular cell value
-        } else {
-            setCellContent(curRow, curCol, temp);
+        if (!editText.empty()) {
+            editText.pop_back();
         }
+    } else {
+        editText.push_back(static_cast<char>(key));
+    }
+}
+
+// Formulas ('@' functions and '=' expressions) and plain values are only parsed here; they go
+// through setCellContent so that dependent formulas are recalculated or marked dirty
+void Spreadsheet::commitEdit() {
+    if (!editing) return;
+    editing = false;
+    if (editRow >= totalRows || editCol >= totalCols) return;
+
+    const Cell* currentCell = peekCell(editRow, editCol);
+    string current = currentCell ? currentCell->getRawContent() : "";
+    if (editText != current) {
+        setCellContent(editRow, editCol, editText);
     }
 }
 
+// The typed text is dropped without touching the cell
+void Spreadsheet::cancelEdit() {
+    editing = false;
+}
+
+// Returns true while the edit line holds text that was not committed
+bool Spreadsheet::isEditing() const {
+    return editing;
+}
+
 //Evaluates the formula in a specific cell (if it is a FormulaCell)
 void Spreadsheet::evaluateFormula(int row, int col) {
-    auto cell = grid.at(row, col);
-    if (!cell) return;
     //Attempt to cast the cell to a FormulaCell
-    auto formulaCell = dynamic_pointer_cast<FormulaCell>(cell);
+    FormulaCell* formulaCell = formulaForUpdate(row, col);
     if (!formulaCell) return;
 
     try {
@@ -471,27 +584,551 @@ int GTUSpreadsheet::Spreadsheet::columnToIndex(const string& column) const {
     return index - 1; // Convert to zero-based index
 }
 
-// Recalculates all cells that depend on the specified cell (row, col)
-void GTUSpreadsheet::Spreadsheet::recalculateDependencies(int row, int col) {
-    //Iterate through all cells in the grid
-    for (int r = 0; r < totalRows; ++r) {
-        for (int c = 0; c < totalCols; ++c) {
-            //Retrieve the current cell and check if it's a FormulaCell
-            auto cell = grid.at(r, c);
-            auto formulaCell = dynamic_pointer_cast<FormulaCell>(cell);
-            //If it's a FormulaCell, check its dependencies
+// Returns the cache that lets formulas of the same shape share one compiled program
+FormulaProgramCache& Spreadsheet::getProgramCache() {
+    return programCache;
+}
+
+// Enables or disables on-demand formula evaluation
+void Spreadsheet::setLazyEvaluation(bool enabled) {
+    lazyEvaluation = enabled;
+}
+
+// Returns true if formulas are evaluated when first read
+bool Spreadsheet::isLazyEvaluation() const {
+    return lazyEvaluation;
+}
+
+// Background recalculation only makes sense on top of lazy evaluation
+void Spreadsheet::setBackgroundRecalculation(bool enabled) {
+    backgroundRecalculation = enabled;
+    if (enabled) {
+        lazyEvaluation = true;
+    }
+}
+
+// Returns true if dirty formulas are computed in time slices
+bool Spreadsheet::isBackgroundRecalculation() const {
+    return backgroundRecalculation;
+}
+
+// Returns true while queued formulas are waiting
+bool Spreadsheet::hasPendingRecalc() const {
+    return recalcQueueHead < recalcQueue.getSize();
+}
+
+// Runs one time slice of recalculation
+// The visible cells come first so the screen settles quickly, then the queue is drained in order
+// Each step is one formula, so the work can be resumed by the next slice at any point
+bool Spreadsheet::runRecalcSlice(int budgetMs, int rowOffset, int colOffset) {
+    auto deadline = chrono::steady_clock::now() + chrono::milliseconds(budgetMs);
+    bool visibleUpdated = false;
+
+    for (int r = rowOffset; r < rowOffset + visibleRows && r < totalRows; ++r) {
+        for (int c = colOffset; c < colOffset + visibleCols && c < totalCols; ++c) {
+            auto formulaCell = dynamic_pointer_cast<FormulaCell>(cellAt(r, c));
+            if (!formulaCell || !formulaCell->isDirty()) continue;
+            if (chrono::steady_clock::now() >= deadline) return visibleUpdated;
+
+            // A formula whose inputs are still dirty would compute them all in this one call, so
+            // it waits until the queue has reached them; the input it waits for is remembered,
+            // so the search is not repeated on every slice while that input is dirty
+            long long cellKey = DependencyGraph::key(r, c);
+            auto waiting = waitingInputs.find(cellKey);
+            if (waiting != waitingInputs.end()) {
+                auto input = dynamic_cast<const FormulaCell*>(cellAt(waiting->second.first, waiting->second.second).get());
+                if (input && input->isDirty()) continue;
+                waitingInputs.erase(waiting);
+            }
+            pair<int, int> input;
+            if (waitsForQueue(*formulaCell, input)) {
+                waitingInputs[cellKey] = input;
+                continue;
+            }
+            formulaCell->evaluate();
+            visibleUpdated = true;
+            if (chrono::steady_clock::now() >= deadline) return visibleUpdated;
+        }
+    }
+
+    while (recalcQueueHead < recalcQueue.getSize()) {
+        pair<int, int> pos = recalcQueue[recalcQueueHead++];
+        queuedCells.erase(DependencyGraph::key(pos.first, pos.second));
+        auto formulaCell = dynamic_pointer_cast<FormulaCell>(getCell(pos.first, pos.second));
+        // Entries may be stale: the cell was replaced or already computed by a read
+        if (formulaCell && formulaCell->isDirty()) {
+            // A formula queued ahead of its inputs (e.g. an aggregate over a column that is
+            // recalculated below it) goes to the back once instead of computing them all now
+            pair<int, int> input;
+            long long cellKey = DependencyGraph::key(pos.first, pos.second);
+            if (deferredCells.count(cellKey) == 0 && waitsForQueue(*formulaCell, input)) {
+                deferredCells.insert(cellKey);
+                queueRecalc(pos.first, pos.second);
+                if (chrono::steady_clock::now() >= deadline) break;
+                continue;
+            }
+            // A fill-down column below this cell is computed in one go; the cells the kernel
+            // had to leave dirty are finished right away so the run is not retried per cell
+            int endRow = pos.first + max(evaluateColumnRun(pos.first, pos.second, KERNEL_SLICE_ROWS), 1);
+            for (int r = pos.first; r < endRow; ++r) {
+                auto runCell = dynamic_pointer_cast<FormulaCell>(cellAt(r, pos.second));
+                if (runCell && runCell->isDirty()) {
+                    runCell->evaluate();
+                }
+            }
+            if (endRow > rowOffset && pos.first < rowOffset + visibleRows &&
+                pos.second >= colOffset && pos.second < colOffset + visibleCols) {
+                visibleUpdated = true;
+            }
+            if (chrono::steady_clock::now() >= deadline) break;
+        }
+    }
+
+    // Release the queue once it is drained
+    if (recalcQueueHead >= recalcQueue.getSize()) {
+        recalcQueue.clear();
+        recalcQueueHead = 0;
+        waitingInputs.clear();
+        deferredCells.clear();
+    }
+    return visibleUpdated;
+}
+
+// Only inputs that are still queued are waited for; the queue computes nothing else
+bool Spreadsheet::waitsForQueue(const FormulaCell& formula, pair<int, int>& input) const {
+    return formula.findDirtyInput(input) && queuedCells.count(DependencyGraph::key(input.first, input.second)) > 0;
+}
+
+// The queue is drained in one long slice; the scan is only needed in plain lazy mode
+void Spreadsheet::finishRecalc() {
+    while (hasPendingRecalc()) {
+        runRecalcSlice(numeric_limits<int>::max(), 0, 0);
+    }
+    if (lazyEvaluation && !backgroundRecalculation) {
+        int rows = getUsedRows(), cols = getUsedCols();
+        for (int r = 0; r < rows; ++r) {
+            for (int c = 0; c < cols; ++c) {
+                auto formulaCell = dynamic_cast<const FormulaCell*>(cellAt(r, c).get());
+                if (formulaCell && formulaCell->isDirty()) {
+                    formulaCell->getContent();
+                }
+            }
+        }
+    }
+}
+
+// Both grids share their storage with the snapshot, which is copied block by block as it is written
+unique_ptr<SheetSnapshot> Spreadsheet::takeSnapshot() {
+    finishRecalc();
+    unique_ptr<SheetSnapshot> snapshot(new SheetSnapshot(totalRows, totalCols, getUsedRows(), getUsedCols()));
+    if (pages) {
+        snapshot->pages = pages->takeSnapshot();
+    } else {
+        snapshot->grid = grid;
+    }
+    snapshot->columnPrecision = columnPrecision;
+    ++liveSnapshots;
+    return snapshot;
+}
+
+// Once no snapshot is left, every formula may be changed in place again
+void Spreadsheet::releaseSnapshot(unique_ptr<SheetSnapshot> snapshot) {
+    if (!snapshot) return;
+    bool paged = snapshot->pages != nullptr;
+    snapshot.reset();
+    if (paged && pages) {
+        pages->releaseSnapshot();
+    }
+    if (--liveSnapshots == 0) {
+        detachedCells.clear();
+    }
+}
+
+// A formula read by a snapshot must keep its result, so the sheet continues with a copy
+// Addresses in detachedCells belong to cells created after the snapshots, which the snapshots
+// keep alive, so a recorded address never matches a cell they read
+FormulaCell* Spreadsheet::formulaForUpdate(int row, int col) {
+    auto formulaCell = dynamic_cast<FormulaCell*>(cellAt(row, col).get());
+    if (!formulaCell || liveSnapshots == 0 || detachedCells.count(formulaCell)) {
+        return formulaCell;
+    }
+    shared_ptr<FormulaCell> copy = formulaCell->clone();
+    formulaCell = copy.get();
+    detachedCells.insert(formulaCell);
+    storeCell(row, col, std::move(copy));
+    return formulaCell;
+}
+
+void Spreadsheet::setStatusMessage(const string& message) {
+    statusMessage = message;
+}
+
+const string& Spreadsheet::getStatusMessage() const {
+    return statusMessage;
+}
+
+// Starts a batch: edits are queued and recalculation is deferred until commit()
+// Batches may be nested; only the outermost commit() recalculates
+void Spreadsheet::beginBatch() {
+    ++batchDepth;
+}
+
+// Ends a batch: links the queued formulas into the dependency graph and recalculates
+// every formula affected by the queued edits exactly once
+void Spreadsheet::commit() {
+    if (batchDepth == 0) {
+        throw logic_error("commit() called without beginBatch()");
+    }
+    if (--batchDepth > 0) {
+        return;
+    }
+
+    // Only the cells stored in the batch can be new formulas; the graph of the rest is intact,
+    // so the sheet is not scanned (which would read every tile back in paged mode)
+    unordered_map<long long, int> added;
+    for (int i = 0; i < pendingChanges.getSize(); ++i) {
+        int row = pendingChanges[i].first, col = pendingChanges[i].second;
+        if (!added.emplace(DependencyGraph::key(row, col), 0).second) continue;
+        if (auto formulaCell = dynamic_cast<FormulaCell*>(cellAt(row, col).get())) {
+            dependencyGraph.addFormula(row, col, *formulaCell);
+        }
+    }
+    recalculateFrom(pendingChanges);
+    pendingChanges.clear();
+}
+
+// Returns true while a batch is open
+bool Spreadsheet::isBatching() const {
+    return batchDepth > 0;
+}
+
+// New formulas are not evaluated right away in lazy mode or inside a batch
+bool Spreadsheet::isEvaluationDeferred() const {
+    return lazyEvaluation || batchDepth > 0;
+}
+
+// Rebuilds the reverse dependency index from every formula in the grid
+void Spreadsheet::rebuildDependencyGraph() {
+    dependencyGraph.clear();
+    int rows = getUsedRows(), cols = getUsedCols(); // No formula was ever stored outside
+    for (int r = 0; r < rows; ++r) {
+        for (int c = 0; c < cols; ++c) {
+            auto formulaCell = dynamic_pointer_cast<FormulaCell>(cellAt(r, c));
             if (formulaCell) {
-                const auto& deps = formulaCell->getDependencies(); // Access dependencies
-                //Check if the specified (row, col) matches any of the dependencies
-                for (int i = 0; i < deps.getSize(); ++i) {
-                    if (deps[i].first == row && deps[i].second == col) {
-                        formulaCell->evaluate(); // Recalculate the dependent cell's formula
-                        break;
-                    }
+                dependencyGraph.addFormula(r, c, *formulaCell);
+            }
+        }
+    }
+}
+
+// Stores a new cell (or nullptr to clear) at (row, col) and updates dependent formulas
+// Inside a batch the change is only queued
+void Spreadsheet::placeCell(int row, int col, shared_ptr<Cell> cell) {
+    if (cell) {
+        usedRows = max(usedRows, row + 1);
+        usedCols = max(usedCols, col + 1);
+    }
+    if (batchDepth > 0) {
+        // The replaced formula loses its edges now; commit() adds the new formulas in one pass
+        if (auto oldFormula = dynamic_cast<FormulaCell*>(cellAt(row, col).get())) {
+            dependencyGraph.removeFormula(row, col, *oldFormula);
+        }
+        storeCell(row, col, cell);
+        pendingChanges.pushBack(make_pair(row, col));
+        return;
+    }
+
+    shared_ptr<Cell> oldCell = cellAt(row, col);
+    auto oldFormula = dynamic_pointer_cast<FormulaCell>(oldCell);
+    auto newFormula = dynamic_pointer_cast<FormulaCell>(cell);
+
+    // A plain value replaced by a plain value can be applied to aggregates as a delta
+    bool valueEdit = !oldFormula && !newFormula;
+    double oldValue = 0, newValue = 0;
+    bool hadOld = valueEdit && FormulaCell::readNumber(oldCell.get(), oldValue);
+    bool hasNew = valueEdit && FormulaCell::readNumber(cell.get(), newValue);
+
+    if (oldFormula) {
+        dependencyGraph.removeFormula(row, col, *oldFormula);
+    }
+    storeCell(row, col, cell);
+    if (newFormula) {
+        dependencyGraph.addFormula(row, col, *newFormula);
+    }
+
+    DynamicArray<pair<int, int>> changed;
+    changed.pushBack(make_pair(row, col));
+    if (valueEdit) {
+        applyAggregateDeltas(row, col, hadOld, oldValue, hasNew, newValue, changed);
+    }
+    recalculateFrom(changed);
+}
+
+// Offers the old and new value of an edited cell to the aggregate formulas whose range covers it
+// Aggregates that accept the delta are already up to date; they are appended to 'updated'
+// so that only their own dependents get recalculated
+void Spreadsheet::applyAggregateDeltas(int row, int col, bool hadOld, double oldValue,
+                                       bool hasNew, double newValue, DynamicArray<pair<int, int>>& updated) {
+    DynamicArray<pair<int, int>> dependents;
+    dependencyGraph.getDependents(row, col, dependents);
+    for (int i = 0; i < dependents.getSize(); ++i) {
+        auto formulaCell = dynamic_cast<FormulaCell*>(cellAt(dependents[i].first, dependents[i].second).get());
+        int startRow, startCol, endRow, endCol;
+        if (!formulaCell || !formulaCell->getRange(startRow, startCol, endRow, endCol)) continue;
+        formulaCell = formulaForUpdate(dependents[i].first, dependents[i].second);
+        if (formulaCell->applyDelta(hadOld, oldValue, hasNew, newValue)) {
+            updated.pushBack(dependents[i]);
+        }
+    }
+}
+
+// Breadth-first walk over the dependents, like the one in recalculateFrom but without stopping
+// at dirty formulas: their values are needed as well
+void Spreadsheet::collectAffected(const DynamicArray<pair<int, int>>& cells,
+                                  DynamicArray<pair<int, int>>& affected) const {
+    unordered_map<long long, int> seen;
+    DynamicArray<pair<int, int>> dependents;
+    int first = affected.getSize();
+    for (int i = 0; i < cells.getSize(); ++i) {
+        if (seen.emplace(DependencyGraph::key(cells[i].first, cells[i].second), 0).second) {
+            affected.pushBack(cells[i]);
+        }
+    }
+    for (int i = first; i < affected.getSize(); ++i) {
+        dependents.clear();
+        dependencyGraph.getDependents(affected[i].first, affected[i].second, dependents);
+        for (int j = 0; j < dependents.getSize(); ++j) {
+            if (seen.emplace(DependencyGraph::key(dependents[j].first, dependents[j].second), 0).second) {
+                affected.pushBack(dependents[j]);
+            }
+        }
+    }
+}
+
+// Recalculates the formulas affected by a set of changed cells
+// Changed cells that hold a deferred (dirty) formula are recalculated as well
+void Spreadsheet::recalculateFrom(const DynamicArray<pair<int, int>>& changed) {
+    // Collect the affected formulas with a breadth-first walk over the dependents
+    unordered_map<long long, int> index; // position key -> index in nodes
+    DynamicArray<pair<int, int>> nodes;
+    DynamicArray<pair<int, int>> dependents;
+
+    for (int i = 0; i < changed.getSize(); ++i) {
+        long long k = DependencyGraph::key(changed[i].first, changed[i].second);
+        if (index.emplace(k, nodes.getSize()).second) {
+            nodes.pushBack(changed[i]);
+        }
+    }
+    int seedCount = nodes.getSize();
+    DynamicArray<int> reachedSeeds; // Seeds that also depend on another affected formula
+
+    for (int i = 0; i < nodes.getSize(); ++i) {
+        // In lazy mode a formula that is already dirty had its dependents marked
+        // when it became dirty, so the walk can stop there
+        if (lazyEvaluation && i >= seedCount) {
+            auto formulaCell = dynamic_pointer_cast<FormulaCell>(cellAt(nodes[i].first, nodes[i].second));
+            if (formulaCell && formulaCell->isDirty()) continue;
+        }
+
+        dependents.clear();
+        dependencyGraph.getDependents(nodes[i].first, nodes[i].second, dependents);
+        for (int j = 0; j < dependents.getSize(); ++j) {
+            long long k = DependencyGraph::key(dependents[j].first, dependents[j].second);
+            auto inserted = index.emplace(k, nodes.getSize());
+            if (inserted.second) {
+                nodes.pushBack(dependents[j]);
+            } else if (i >= seedCount && inserted.first->second < seedCount) {
+                // A seed (e.g. an aggregate that already took a delta) also reads a formula
+                // that is being recalculated, so its value is not final either
+                reachedSeeds.pushBack(inserted.first->second);
+            }
+        }
+    }
+
+    // The formulas are looked up by position each time instead of being held, so in paged mode
+    // their tiles can be evicted while the rest of the recalculation runs
+    auto formulaAt = [this, &nodes](int i) {
+        return dynamic_cast<FormulaCell*>(cellAt(nodes[i].first, nodes[i].second).get());
+    };
+
+    // Invalidate everything that was reached; seeds keep their state unless they are deferred formulas
+    for (int i = seedCount; i < nodes.getSize(); ++i) {
+        if (FormulaCell* formulaCell = formulaForUpdate(nodes[i].first, nodes[i].second)) {
+            formulaCell->markDirty();
+        }
+    }
+    for (int i = 0; i < reachedSeeds.getSize(); ++i) {
+        const pair<int, int>& seed = nodes[reachedSeeds[i]];
+        if (FormulaCell* formulaCell = formulaForUpdate(seed.first, seed.second)) {
+            formulaCell->markDirty();
+        }
+    }
+    if (backgroundRecalculation) {
+        for (int i = 0; i < nodes.getSize(); ++i) {
+            // Queue the work for the time-sliced recalculation
+            FormulaCell* formulaCell = formulaAt(i);
+            if (formulaCell && formulaCell->isDirty()) {
+                queueRecalc(nodes[i].first, nodes[i].second);
+            }
+        }
+    }
+
+    // Lazy mode: the values are computed when they are read
+    if (lazyEvaluation) {
+        return;
+    }
+
+    // Eager mode: evaluate in dependency order (Kahn's algorithm) so that each formula
+    // is evaluated once, after all of its affected inputs
+    DynamicArray<int> pendingInputs;
+    for (int i = 0; i < nodes.getSize(); ++i) {
+        pendingInputs.pushBack(0);
+    }
+    for (int i = 0; i < nodes.getSize(); ++i) {
+        dependents.clear();
+        dependencyGraph.getDependents(nodes[i].first, nodes[i].second, dependents);
+        for (int j = 0; j < dependents.getSize(); ++j) {
+            auto it = index.find(DependencyGraph::key(dependents[j].first, dependents[j].second));
+            if (it != index.end()) {
+                ++pendingInputs[it->second];
+            }
+        }
+    }
+
+    // Runs of the same program whose inputs are already final are computed column-wise first;
+    // their cells are no longer dirty, so the loop below only passes through them
+    if (nodes.getSize() >= ColumnKernel::MIN_RUN) {
+        DynamicArray<char> covered; // Nodes already handed to a kernel, so each run is tried once
+        for (int i = 0; i < nodes.getSize(); ++i) {
+            covered.pushBack(0);
+        }
+        // A paged run is cut into pieces so that it does not keep the whole column in memory
+        int maxRunRows = pages ? PAGED_RUN_ROWS : totalRows;
+        for (int i = 0; i < nodes.getSize(); ++i) {
+            if (covered[i]) continue;
+            FormulaCell* formulaCell = formulaAt(i);
+            if (!formulaCell || !formulaCell->isDirty()) continue;
+            shared_ptr<const FormulaProgram> program = formulaCell->getProgram();
+            int col = nodes[i].second;
+
+            // Start at the top of the run
+            int row = nodes[i].first;
+            while (row > 0) {
+                auto above = dynamic_pointer_cast<FormulaCell>(cellAt(row - 1, col));
+                auto it = index.find(DependencyGraph::key(row - 1, col));
+                if (!above || !above->isDirty() || above->getProgram() != program ||
+                    it == index.end() || covered[it->second]) {
+                    break;
                 }
+                --row;
+            }
+
+            int length = evaluateColumnRun(row, col, maxRunRows);
+            for (int r = row; r < row + length; ++r) {
+                auto it = index.find(DependencyGraph::key(r, col));
+                if (it != index.end()) covered[it->second] = 1;
             }
         }
     }
+
+    DynamicArray<int> ready;
+    for (int i = 0; i < nodes.getSize(); ++i) {
+        if (pendingInputs[i] == 0) ready.pushBack(i);
+    }
+    for (int head = 0; head < ready.getSize(); ++head) {
+        int i = ready[head];
+        FormulaCell* formulaCell = formulaAt(i);
+        if (formulaCell && formulaCell->isDirty()) {
+            formulaCell->evaluate();
+        }
+        dependents.clear();
+        dependencyGraph.getDependents(nodes[i].first, nodes[i].second, dependents);
+        for (int j = 0; j < dependents.getSize(); ++j) {
+            auto it = index.find(DependencyGraph::key(dependents[j].first, dependents[j].second));
+            if (it != index.end() && --pendingInputs[it->second] == 0) {
+                ready.pushBack(it->second);
+            }
+        }
+    }
+
+    // Whatever is left is part of a cycle; evaluating it reports the circular reference
+    for (int i = 0; i < nodes.getSize(); ++i) {
+        FormulaCell* formulaCell = formulaAt(i);
+        if (formulaCell && formulaCell->isDirty()) {
+            formulaCell->getContent();
+        }
+    }
+}
+
+// Collects the dirty cells below (row, col) that share its program, loads the inputs of every
+// row into typed double columns and evaluates the program once for the whole run
+// Cells whose inputs are still dirty stay dirty and are left to the scalar evaluator
+int Spreadsheet::evaluateColumnRun(int row, int col, int maxRows) {
+    auto first = dynamic_pointer_cast<FormulaCell>(getCell(row, col));
+    if (!first || !first->isDirty() || !ColumnKernel::supports(*first->getProgram())) return 0;
+    const FormulaProgram* program = first->getProgram().get();
+
+    // Shared pointers keep the run in memory in paged mode while its inputs are read
+    DynamicArray<shared_ptr<FormulaCell>> cells;
+    for (int r = row; r < totalRows && cells.getSize() < maxRows; ++r) {
+        auto formulaCell = dynamic_pointer_cast<FormulaCell>(cellAt(r, col));
+        if (!formulaCell || !formulaCell->isDirty() || formulaCell->getProgram().get() != program) break;
+        cells.pushBack(formulaCell);
+    }
+    int length = cells.getSize();
+    if (length < ColumnKernel::MIN_RUN) return 0;
+
+    ColumnKernel kernel(length);
+    const auto& steps = program->getSteps();
+    for (int s = 0; s < steps.getSize(); ++s) {
+        const ProgramStep& step = steps[s];
+        if (!step.isReference) {
+            kernel.fillConstant(step.constant);
+        } else {
+            // Gather the referenced column; the reference has the same offset in every row of the run
+            double* operand = kernel.operandBuffer();
+            int inputCol = col + step.colOffset;
+            // Rows below the indexed part of a lazily opened file exist but are not counted yet
+            if (rowSource && row + length + step.rowOffset > totalRows) {
+                rowSource->indexRows(row + length + step.rowOffset);
+            }
+            for (int i = 0; i < length; ++i) {
+                int inputRow = row + i + step.rowOffset;
+                Cell* input = (inputRow >= 0 && inputRow < totalRows && inputCol >= 0 && inputCol < totalCols)
+                    ? cellAt(inputRow, inputCol).get() : nullptr;
+                operand[i] = 0;
+                auto inputFormula = dynamic_cast<FormulaCell*>(input);
+                if (inputFormula && inputFormula->isDirty()) {
+                    kernel.setLaneState(i, ColumnKernel::LANE_DEFERRED);
+                } else if (!input || !input->getNumber(operand[i])) {
+                    kernel.setLaneState(i, ColumnKernel::LANE_ERROR);
+                }
+            }
+        }
+        kernel.applyOperand(step.op);
+    }
+
+    for (int i = 0; i < length; ++i) {
+        switch (kernel.getLaneState(i)) {
+            case ColumnKernel::LANE_OK:
+                cells[i]->storeResult(kernel.getResult(i));
+                break;
+            case ColumnKernel::LANE_ERROR:
+                cells[i]->storeError();
+                break;
+            default:
+                break; // Left dirty
+        }
+    }
+    return length;
+}
+
+// Recalculates all cells that depend on the specified cell (row, col)
+// In lazy mode the dependent formulas are only marked dirty
+void GTUSpreadsheet::Spreadsheet::recalculateDependencies(int row, int col) {
+    DynamicArray<pair<int, int>> changed(1);
+    changed.pushBack(make_pair(row, col));
+    recalculateFrom(changed);
 }
 
 
@@ -503,63 +1140,314 @@ void GTUSpreadsheet::Spreadsheet::setCellContent(int row, int col, const string&
 
     // If the content is empty, clear the cell and update dependencies
     if (content.empty()) {
-        grid.at(row, col) = nullptr;
-        recalculateDependencies(row, col);
-        return;
+        placeCell(row, col, nullptr);
+    } else if (isFormulaText(content)) {
+        // The constructor evaluates the formula, or only marks it dirty when evaluation is deferred
+        placeCell(row, col, make_shared<FormulaCell>(content, shared_from_this(), row, col));
+    } else {
+        placeCell(row, col, makeValueCell(content));
     }
 
-    // If content is a formula function starting with '@'
-    if (content[0] == '@' && content.find(')') != string::npos) {
-        auto formulaCell = make_shared<FormulaCell>(content, shared_from_this());
-        grid.at(row, col) = formulaCell;
-        try {
-            formulaCell->evaluate();
-        } catch (const exception& e) {
-            formulaCell->setContent("#ERROR");
+    if (editObserver) {
+        editObserver->onCellEdited(row, col, content);
+    }
+}
+
+void Spreadsheet::setEditObserver(CellEditObserver* observer) {
+    editObserver = observer;
+}
+
+// Loading a block grows the sheet while cells are being read, which only paged mode allows
+void Spreadsheet::setRowSource(RowSource* source) {
+    if (source && !pages) {
+        throw logic_error("A row source needs paged mode");
+    }
+    rowSource = source;
+    loadedBlocks.clear();
+}
+
+// The block is marked before it is loaded: loading stores its cells through storeCell
+void Spreadsheet::loadRowBlock(int row) const {
+    int block = row / RowSource::BLOCK_ROWS;
+    if (block < loadedBlocks.getSize() && loadedBlocks[block]) return;
+    while (loadedBlocks.getSize() <= block) {
+        loadedBlocks.pushBack(0);
+    }
+    loadedBlocks[block] = 1;
+    rowSource->loadBlock(block);
+}
+
+// Stores a ready-made cell at (row, col) and updates dependencies like setCellContent
+void Spreadsheet::setCell(int row, int col, shared_ptr<Cell> cell) {
+    if (row < 0 || row >= totalRows || col < 0 || col >= totalCols) {
+        throw out_of_range("Cell position out of range");
+    }
+    if (cell) {
+        cell->setPosition(row, col);
+    }
+    placeCell(row, col, cell);
+}
+
+// Places the cell directly; its value is already final
+void Spreadsheet::restoreCell(int row, int col, shared_ptr<Cell> cell) {
+    if (row < 0 || row >= totalRows || col < 0 || col >= totalCols) {
+        throw out_of_range("Cell position out of range");
+    }
+    if (cell) {
+        cell->setPosition(row, col);
+        usedRows = max(usedRows, row + 1);
+        usedCols = max(usedCols, col + 1);
+    }
+    storeCell(row, col, cell);
+}
+
+// The restored formulas only need their edges; their values are already up to date
+void Spreadsheet::finishRestore() {
+    rebuildDependencyGraph();
+}
+
+// Left dirty, so the formula is computed from the current values of its inputs when first read
+void Spreadsheet::restoreFormula(int row, int col, const string& formula) {
+    auto formulaCell = make_shared<FormulaCell>(programCache.get(formula, row, col), "",
+                                                shared_from_this(), row, col);
+    formulaCell->markDirty();
+    restoreCell(row, col, formulaCell);
+    dependencyGraph.addFormula(row, col, *formulaCell);
+    // Queued so that background recalculation and finishRecalc() find it
+    queueRecalc(row, col);
+}
+
+// A formula that is still waiting keeps its place in the queue
+void Spreadsheet::queueRecalc(int row, int col) {
+    if (queuedCells.insert(DependencyGraph::key(row, col)).second) {
+        recalcQueue.pushBack(make_pair(row, col));
+    }
+}
+
+// Formula functions start with '@' and need a closing parenthesis; expressions start with '='
+bool Spreadsheet::isFormulaText(string_view content) {
+    if (content.empty()) return false;
+    return (content[0] == '@' && content.find(')') != string_view::npos) || content[0] == '=';
+}
+
+// Strips leading spaces and a '+' sign; returns false if the text cannot start a number
+// Only digits, one sign or a decimal point can start a number ("inf" and "nan" are labels)
+bool Spreadsheet::numberText(string_view content, string_view& number) {
+    size_t start = content.find_first_not_of(' ');
+    if (start == string_view::npos) return false;
+    number = content.substr(start);
+    bool plus = number[0] == '+';
+    if (plus) {
+        number.remove_prefix(1); // from_chars does not accept a plus sign
+    }
+    size_t digit = (!plus && !number.empty() && number[0] == '-') ? 1 : 0;
+    return digit < number.size() && (isdigit(static_cast<unsigned char>(number[digit])) || number[digit] == '.');
+}
+
+// Succeeds only if the whole text is an integer that fits in 64 bits
+bool Spreadsheet::parseInteger(string_view content, long long& value) {
+    string_view number;
+    if (!numberText(content, number) || number.find_first_of(".eE") != string_view::npos) return false;
+    from_chars_result parsed = from_chars(number.data(), number.data() + number.size(), value);
+    return parsed.ec == errc() && parsed.ptr == number.data() + number.size();
+}
+
+// Succeeds only if the whole text is a finite decimal number
+bool Spreadsheet::parseDecimal(string_view content, double& value) {
+    string_view number;
+    if (!numberText(content, number)) return false;
+    from_chars_result parsed = from_chars(number.data(), number.data() + number.size(), value);
+    return parsed.ec == errc() && parsed.ptr == number.data() + number.size();
+}
+
+// Tries an integer first, then a decimal; anything that is not entirely a number is a label
+// A number that does not fit in 64 bits is stored as a double
+Spreadsheet::ContentKind Spreadsheet::classifyContent(string_view content, long long& intValue, double& doubleValue) {
+    if (content.empty()) return ContentKind::Empty;
+    if (isFormulaText(content)) return ContentKind::Formula;
+    if (parseInteger(content, intValue)) return ContentKind::Integer;
+    if (parseDecimal(content, doubleValue)) return ContentKind::Decimal;
+    return ContentKind::Label;
+}
+
+// Builds the typed cell straight from the classified text
+shared_ptr<Cell> Spreadsheet::makeValueCell(string_view content) {
+    long long intValue = 0;
+    double doubleValue = 0;
+    switch (classifyContent(content, intValue, doubleValue)) {
+        case ContentKind::Integer:
+            return make_shared<IntValueCell>(intValue);
+        case ContentKind::Decimal:
+            return make_shared<DoubleValueCell>(doubleValue);
+        default:
+            return make_shared<StringValueCell>(string(content));
+    }
+}
+
+// Moves the cells into tiles and releases the in-memory grid
+// Empty placeholder cells are not moved; in paged mode an empty cell is simply absent
+void Spreadsheet::enablePaging(const string& pageFileName, size_t memoryBudgetBytes, size_t encodedBudgetBytes) {
+    if (pages) {
+        throw logic_error("Paging is already enabled");
+    }
+    unique_ptr<PagedGrid> paged(new PagedGrid(*this, pageFileName, memoryBudgetBytes));
+    paged->setEncodedMemoryBudget(encodedBudgetBytes);
+    int rows = getUsedRows(), cols = getUsedCols();
+    for (int r = 0; r < rows; ++r) {
+        for (int c = 0; c < cols; ++c) {
+            const shared_ptr<Cell>& cell = grid.at(r, c);
+            if (!cell) continue;
+            if (!dynamic_cast<FormulaCell*>(cell.get())) {
+                string content;
+                cell->appendContent(content);
+                if (content.empty()) continue;
+            }
+            paged->set(r, c, cell);
         }
-    // If content starts with '=', treat it as a regular formula
-    } else if (content[0] == '=') {
-        auto formulaCell = make_shared<FormulaCell>(content, shared_from_this());
-        grid.at(row, col) = formulaCell;
-        formulaCell->evaluate();
-        recalculateDependencies(row, col);
+    }
+    pages = std::move(paged);
+    grid = Dynamic2DVector<shared_ptr<Cell>>(1, 1);
+}
+
+bool Spreadsheet::isPaged() const {
+    return pages != nullptr;
+}
+
+const PagedGrid* Spreadsheet::getPagedGrid() const {
+    return pages.get();
+}
+
+// Every cell access of the spreadsheet goes through these two
+const shared_ptr<Cell>& Spreadsheet::cellAt(int row, int col) const {
+    if (rowSource) loadRowBlock(row);
+    return pages ? pages->get(row, col) : grid.at(row, col);
+}
+
+// A cell written before its row was loaded would be overwritten by the load
+void Spreadsheet::storeCell(int row, int col, shared_ptr<Cell> cell) {
+    if (rowSource) loadRowBlock(row);
+    if (pages) {
+        pages->set(row, col, std::move(cell));
     } else {
-        try {
-            // First check if the content contains a decimal point
-            if (content.find('.') != string::npos) {
-                // If it has a decimal point, parse as double
-                double doubleValue = stod(content);
-                grid.at(row, col) = make_shared<DoubleValueCell>(doubleValue);
-            } else {
-                try {
-                    // If no decimal point, try parsing as integer first
-                    int intValue = stoi(content);
-                    grid.at(row, col) = make_shared<IntValueCell>(intValue);
-                } catch (...) {
-                    // If integer parsing fails, try as double
-                    try {
-                        double doubleValue = stod(content);
-                        grid.at(row, col) = make_shared<DoubleValueCell>(doubleValue);
-                    } catch (...) {
-                        // If all numeric parsing fails, treat as string
-                        grid.at(row, col) = make_shared<StringValueCell>(content);
-                    }
-                }
+        grid.at(row, col) = std::move(cell);
+    }
+}
+
+// Reads the range like getCell() would: rows of a lazily opened file are indexed and loaded first
+void Spreadsheet::scanNumbers(int startRow, int startCol, int endRow, int endCol,
+                              const function<void(double)>& visit) const {
+    if (rowSource && endRow >= totalRows) {
+        rowSource->indexRows(endRow + 1);
+    }
+    startRow = max(startRow, 0);
+    startCol = max(startCol, 0);
+    endRow = min(endRow, totalRows - 1);
+    endCol = min(endCol, totalCols - 1);
+    if (startRow > endRow || startCol > endCol) return;
+
+    if (pages) {
+        if (rowSource) {
+            for (int row = startRow - startRow % RowSource::BLOCK_ROWS; row <= endRow; row += RowSource::BLOCK_ROWS) {
+                loadRowBlock(row);
+            }
+        }
+        pages->scanNumbers(startRow, startCol, endRow, endCol, visit);
+        return;
+    }
+    for (int r = startRow; r <= endRow; ++r) {
+        for (int c = startCol; c <= endCol; ++c) {
+            shared_ptr<Cell> cell = grid.at(r, c); // Keeps a formula alive while it is evaluated
+            double value;
+            if (FormulaCell::readNumber(cell.get(), value)) {
+                visit(value);
             }
-            recalculateDependencies(row, col);
-        } catch (const exception& e) {
-            // If any error occurs during parsing, create a string cell
-            grid.at(row, col) = make_shared<StringValueCell>(content);
-            recalculateDependencies(row, col);
         }
     }
 }
 
+// Visits the range like scanNumbers(), but only looks at which cells are dirty formulas
+void Spreadsheet::collectDirtyFormulas(int startRow, int startCol, int endRow, int endCol,
+                                       DynamicArray<pair<int, int>>& formulas) const {
+    if (rowSource && endRow >= totalRows) {
+        rowSource->indexRows(endRow + 1);
+    }
+    startRow = max(startRow, 0);
+    startCol = max(startCol, 0);
+    endRow = min(endRow, totalRows - 1);
+    endCol = min(endCol, totalCols - 1);
+    if (startRow > endRow || startCol > endCol) return;
+
+    if (pages) {
+        if (rowSource) {
+            for (int row = startRow - startRow % RowSource::BLOCK_ROWS; row <= endRow; row += RowSource::BLOCK_ROWS) {
+                loadRowBlock(row);
+            }
+        }
+        pages->collectDirtyFormulas(startRow, startCol, endRow, endCol, formulas);
+        return;
+    }
+    for (int r = startRow; r <= endRow; ++r) {
+        for (int c = startCol; c <= endCol; ++c) {
+            auto formulaCell = dynamic_cast<const FormulaCell*>(grid.at(r, c).get());
+            if (formulaCell && formulaCell->isDirty()) {
+                formulas.pushBack(make_pair(r, c));
+            }
+        }
+    }
+}
+
+// Searches from the last row up, so a range whose end is still dirty is answered at once
+// Paged and lazily read sheets are collected like collectDirtyFormulas() instead
+bool Spreadsheet::findDirtyFormula(int startRow, int startCol, int endRow, int endCol, pair<int, int>& formula) const {
+    if (pages || rowSource) {
+        DynamicArray<pair<int, int>> formulas;
+        collectDirtyFormulas(startRow, startCol, endRow, endCol, formulas);
+        if (formulas.getSize() == 0) return false;
+        formula = formulas[formulas.getSize() - 1];
+        return true;
+    }
+    startRow = max(startRow, 0);
+    startCol = max(startCol, 0);
+    endRow = min(endRow, totalRows - 1);
+    endCol = min(endCol, totalCols - 1);
+    for (int r = endRow; r >= startRow; --r) {
+        for (int c = endCol; c >= startCol; --c) {
+            auto formulaCell = dynamic_cast<const FormulaCell*>(grid.at(r, c).get());
+            if (formulaCell && formulaCell->isDirty()) {
+                formula = make_pair(r, c);
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+// Raw access for loops over many cells, e.g. when saving
+const Cell* Spreadsheet::peekCell(int row, int col) const {
+    if (row >= 0 && row < totalRows && col >= 0 && col < totalCols) {
+        return cellAt(row, col).get();
+    }
+    return nullptr;
+}
+
+// The used area never shrinks until clear(); cells inside it may have been emptied again
+int Spreadsheet::getUsedRows() const {
+    return min(usedRows, totalRows);
+}
+
+int Spreadsheet::getUsedCols() const {
+    return min(usedCols, totalCols);
+}
+
 //Retrieves a pointer to the cell at the specified row and column
 shared_ptr<Cell> Spreadsheet::getCell(int row, int col) const {
+    // A lazily opened file may have rows that were not indexed yet
+    if (rowSource && row >= totalRows) {
+        rowSource->indexRows(row + 1);
+    }
     //Check if the provided row and column indices are within valid bounds
     if (row >= 0 && row < totalRows && col >= 0 && col < totalCols) {
-        return grid.at(row, col); //Return the cell if it exists
+        return cellAt(row, col); //Return the cell if it exists
     }
     //If out of bounds, return a nullptr indicating no valid cell
     return nullptr;
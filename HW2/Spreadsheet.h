@@ -3,14 +3,26 @@
 
 #include "AnsiTerminal.h"
 #include "Cell.h"
+#include "CellEditObserver.h"
 #include "Custom2DArray.h"
+#include "DependencyGraph.h"
+#include "PagedGrid.h"
+#include "RowSource.h"
+#include "ScreenBuffer.h"
+#include "SheetSnapshot.h"
+#include "FormulaProgram.h"
 #include "FileManager.h"
 #include <string>
+#include <string_view>
 #include <memory>
+#include <functional>
+#include <unordered_map>
+#include <unordered_set>
 
 using namespace std;
 
 class Cell; // Forward declaration to avoid circular dependency
+class FormulaCell;
 
 namespace GTUSpreadsheet {
 
@@ -37,20 +49,182 @@ public:
     // Returns the number of visible columns in the spreadsheet
     int getVisibleCols() const;
 
+    // Sets how many decimals the grid and CSV export show for the decimal values and formula
+    // results of a column (clamped to 0..NumberFormat::MAX_PRECISION)
+    // Only the text changes: formulas keep reading values rounded to NumberFormat::DEFAULT_PRECISION
+    // A change is reported to the edit observer, since a saved file has to show it too
+    void setColumnPrecision(int col, int decimals);
+
+    // Returns the decimals shown for a column (NumberFormat::DEFAULT_PRECISION unless set)
+    int getColumnPrecision(int col) const;
+
     // Parses a cell reference string (e.g., "A1") and extracts row and column indices
     void parseCellReference(const std::string& reference, int& row, int& col) const;
 
     // Recalculates dependencies for the specified cell to ensure formula correctness
+    // In lazy mode the dependent formulas are only marked dirty
     void recalculateDependencies(int row, int col);
 
+    // Returns the cache of compiled formula programs shared by cells with the same relative formula
+    FormulaProgramCache& getProgramCache();
+
+    // Enables or disables lazy evaluation: edits only mark formulas dirty and
+    // values are computed when they are first read (drawGrid, save, or a dependent formula)
+    void setLazyEvaluation(bool enabled);
+
+    // Returns true if formulas are evaluated on demand
+    bool isLazyEvaluation() const;
+
+    // Enables or disables background recalculation (implies lazy evaluation):
+    // dirty formulas are queued and computed in time slices by runRecalcSlice(),
+    // and drawGrid shows stale cells with a pending marker instead of computing them
+    void setBackgroundRecalculation(bool enabled);
+
+    // Returns true if dirty formulas are computed in time slices
+    bool isBackgroundRecalculation() const;
+
+    // Returns true while dirty formulas are waiting in the recalculation queue
+    bool hasPendingRecalc() const;
+
+    // Evaluates queued formulas for at most budgetMs milliseconds, starting with the
+    // cells visible at the given offsets; returns true if a visible cell was updated
+    bool runRecalcSlice(int budgetMs, int rowOffset, int colOffset);
+
+    // Computes every dirty formula now, e.g. before a snapshot
+    // The queued formulas are computed first; only lazy mode without background recalculation
+    // leaves dirty formulas out of the queue, so only then is the used area scanned for them
+    void finishRecalc();
+
+    // Takes a copy-on-write snapshot of the cells, e.g. to save them on a background thread
+    // Pending formulas are computed first, so the snapshot only holds final values; the cells
+    // themselves are shared, so taking it costs one pointer per block of rows (or tile)
+    unique_ptr<SheetSnapshot> takeSnapshot();
+
+    // Destroys a snapshot once it was written; must be called on the thread that edits the sheet
+    void releaseSnapshot(unique_ptr<SheetSnapshot> snapshot);
+
+    // Sets the message shown in the status line (e.g. the result of a save), empty to hide it
+    void setStatusMessage(const string& message);
+
+    // Returns the message shown in the status line
+    const string& getStatusMessage() const;
+
+    // Starts a batch of edits: changes are queued and recalculation is deferred
+    void beginBatch();
+
+    // Ends the batch: adds the queued formulas to the dependency graph and recalculates
+    // each affected formula exactly once
+    void commit();
+
+    // Returns true while a batch is open
+    bool isBatching() const;
+
+    // Returns true if new formulas should not be evaluated immediately (lazy mode or batch)
+    bool isEvaluationDeferred() const;
+
     // Sets the content of a specified cell in the grid
     void setCellContent(int row, int col, const std::string& content);
 
+    // Registers the observer told about every setCellContent (nullptr to detach)
+    // The spreadsheet does not own it; the caller detaches it before destroying it
+    void setEditObserver(CellEditObserver* observer);
+
+    // Stores a cell that was already built (e.g. by makeValueCell on an import thread)
+    void setCell(int row, int col, std::shared_ptr<Cell> cell);
+
+    // Stores a cell whose value is already known (e.g. read from a workbook) without touching
+    // the dependency graph or recalculating; call finishRestore() after the last one
+    void restoreCell(int row, int col, std::shared_ptr<Cell> cell);
+
+    // Builds the dependency graph for the restored cells in one pass
+    void finishRestore();
+
+    // Stores a formula read from a file without evaluating it and links it into the dependency
+    // graph; it is computed when it is first read
+    void restoreFormula(int row, int col, const std::string& formula);
+
+    // Attaches the file the rows come from when a file is opened lazily (nullptr to detach)
+    // Each block of rows is loaded from it the first time one of its cells is accessed
+    // The spreadsheet does not own it; clear() detaches it
+    void setRowSource(RowSource* source);
+
+    // What a piece of entered or loaded text becomes
+    enum class ContentKind { Empty, Integer, Decimal, Formula, Label };
+
+    // Classifies the text in one pass without exceptions or allocations
+    // A number must be the whole text (leading spaces and a '+' sign are allowed); the parsed
+    // value is returned through intValue or doubleValue
+    static ContentKind classifyContent(std::string_view content, long long& intValue, double& doubleValue);
+
+    // Parse the whole text as a 64-bit integer or a decimal with the same rules as classifyContent
+    static bool parseInteger(std::string_view content, long long& value);
+    static bool parseDecimal(std::string_view content, double& value);
+
+    // Returns true if the content is entered as a formula ('@' function or '=' expression)
+    static bool isFormulaText(std::string_view content);
+
+    // Builds the label, integer or double cell for non-formula content
+    // Uses no spreadsheet state, so it may be called from any thread
+    static std::shared_ptr<Cell> makeValueCell(std::string_view content);
+
+    // Appends the given cells and every formula that reads them, directly or through other
+    // formulas, to 'affected' (each position once, the given cells first)
+    void collectAffected(const DynamicArray<std::pair<int, int>>& cells,
+                         DynamicArray<std::pair<int, int>>& affected) const;
+
+    // Switches to out-of-core storage: cells are kept in tiles backed by the page file and at most
+    // about memoryBudgetBytes of tiles stay in memory; the existing cells are moved over
+    // Evicted tiles without formulas are kept column-encoded in memory, up to about
+    // encodedBudgetBytes, before they go to the page file (0 = written right away)
+    // Throws runtime_error if the page file cannot be created
+    void enablePaging(const std::string& pageFileName, std::size_t memoryBudgetBytes, std::size_t encodedBudgetBytes = 0);
+
+    // Returns true if the cells are stored in a PagedGrid
+    bool isPaged() const;
+
+    // Returns the page cache in paged mode (nullptr otherwise), e.g. for its statistics
+    const PagedGrid* getPagedGrid() const;
+
     // Returns a shared pointer to a cell at the specified position
     std::shared_ptr<Cell> getCell(int row, int col) const;
 
-    // Handles user keyboard inputs for navigation and interaction
-    void handleInput(char key, int curRow, int curCol, Utils::FileManager &fileManager);
+    // Calls visit() with the number of every numeric cell of the range, row by row, as the
+    // aggregate functions read them (positions outside the sheet are skipped)
+    // In paged mode the encoded tiles are read without building their cells
+    void scanNumbers(int startRow, int startCol, int endRow, int endCol, const function<void(double)>& visit) const;
+
+    // Appends the positions of the dirty formulas inside the range, row by row (positions outside
+    // the sheet are skipped); in paged mode encoded tiles and tiles without formulas are skipped
+    void collectDirtyFormulas(int startRow, int startCol, int endRow, int endCol,
+                              DynamicArray<std::pair<int, int>>& formulas) const;
+
+    // Returns true if the range holds a dirty formula and sets 'formula' to the position of the
+    // last one in row order
+    bool findDirtyFormula(int startRow, int startCol, int endRow, int endCol, std::pair<int, int>& formula) const;
+
+    // Returns the cell at the position without copying the shared pointer (nullptr if none)
+    // The pointer is valid until the cell is replaced; in paged mode only until the next cell access
+    const Cell* peekCell(int row, int col) const;
+
+    // Bounds of the cells that received content since the last clear(): rows and columns
+    // at or after these were never set, so writers can stop there
+    int getUsedRows() const;
+    int getUsedCols() const;
+
+    // Handles a key typed on the selected cell (the file menu uses the terminal)
+    // Navigation keys are ignored; the caller moves the selection and redraws the grid
+    // Typed characters go to the edit line; the cell is only set when the edit is committed
+    // (Enter, the file menu, or commitEdit() when the selection leaves the cell)
+    void handleInput(AnsiTerminal& terminal, int key, int curRow, int curCol, Utils::FileManager &fileManager);
+
+    // Sets the content of the edited cell from the edit line, if it changed, and ends the edit
+    void commitEdit();
+
+    // Drops the edit line; the cell keeps its content
+    void cancelEdit();
+
+    // Returns true while typed text has not been committed
+    bool isEditing() const;
 
     // Draws the grid on the terminal, highlighting the currently selected cell
     void drawGrid(AnsiTerminal& terminal, int selectedRow, int selectedCol, int rowOffset, int colOffset);
@@ -76,12 +250,124 @@ private:
     int visibleRows;        // Number of rows visible on the terminal
     int visibleCols;        // Number of columns visible on the terminal
     int cellWidth;          // Width of each cell for uniform spacing in the grid
+    static const char PENDING_MARKER = '~'; // Drawn after a stale value waiting for recalculation
+    static const int GRID_START_ROW = 5;    // Screen row of the first grid row; the headers are above it
+    static const int STATUS_WIDTH = 75;     // Width the status lines are padded to
+    bool lazyEvaluation;    // Defer formula evaluation until the value is read
+    int batchDepth;         // Number of open beginBatch() calls
+    bool backgroundRecalculation; // Compute dirty formulas in time slices instead of on draw
+    int usedRows;           // One past the last row that received a cell
+    int usedCols;           // One past the last column that received a cell
+    CellEditObserver* editObserver; // Told about each edit, not owned (nullptr if none)
+    RowSource* rowSource;   // File of a lazily opened sheet, not owned (nullptr if none)
+    int liveSnapshots;      // Snapshots taken and not released yet
+    string statusMessage;   // Shown after the cell type line
+    bool editing;           // Text was typed into a cell and not committed yet
+    int editRow;            // Cell being edited
+    int editCol;
+    string editText;        // Edit line: the cell's content as typed so far
+    DynamicArray<unsigned char> columnPrecision; // Decimals shown per column; columns past the end use the default
+    ScreenBuffer screen;    // Frames drawn by drawGrid, printed as differences from the previous one
+
+    // Text drawn for a cell, fitted and padded to the cell width
+    struct DisplayEntry {
+        weak_ptr<Cell> cell;    // Tells a new cell at the same address from the cached one
+        unsigned version;       // Result version of a formula when the text was made
+        int width;              // Cell width the text was fitted to
+        int precision;          // Decimals of the column when the text was made
+        bool pending;           // Made from a stale result, with the pending marker
+        string text;
+    };
+
+    // Display text of recently drawn cells, so scrolling does not format the same values again
+    // Emptied when it grows past DISPLAY_CACHE_CELLS
+    unordered_map<const Cell*, DisplayEntry> displayCache;
+    static const size_t DISPLAY_CACHE_CELLS = 8192;
+
+    // Formulas stored since the snapshots were taken, which they cannot be reading
+    unordered_set<const Cell*> detachedCells;
+
+    // Blocks of rows already taken from the row source (one flag per RowSource::BLOCK_ROWS rows)
+    mutable DynamicArray<char> loadedBlocks;
 
     // The 2D container storing cells in the spreadsheet
     Dynamic2DVector<std::shared_ptr<Cell>> grid;
 
+    // Out-of-core storage used instead of the grid in paged mode
+    std::unique_ptr<PagedGrid> pages;
+
+    // Reverse index of which formulas read which cells
+    DependencyGraph dependencyGraph;
+
+    // Compiled programs shared by fill-down formulas
+    FormulaProgramCache programCache;
+
+    // Cells changed inside the current batch
+    DynamicArray<std::pair<int, int>> pendingChanges;
+
+    // Dirty formulas waiting for background recalculation; entries before recalcQueueHead are done
+    DynamicArray<std::pair<int, int>> recalcQueue;
+    int recalcQueueHead;
+    // Keys of the positions waiting in the queue, so a formula is queued once
+    unordered_set<long long> queuedCells;
+    // Visible formula (key of its position) -> a dirty input it waits for; while that input is
+    // dirty the formula is not checked again, since the check walks its whole range
+    unordered_map<long long, std::pair<int, int>> waitingInputs;
+    // Queued formulas that were already sent to the back of the queue once to wait for their inputs
+    unordered_set<long long> deferredCells;
+
+    // Adds the formula at (row, col) to the recalculation queue unless it is already waiting
+    void queueRecalc(int row, int col);
+
+    // Returns true if the formula reads a dirty formula that is waiting in the queue, and sets
+    // 'input' to its position
+    bool waitsForQueue(const FormulaCell& formula, std::pair<int, int>& input) const;
+
     // Initializes the grid with empty cells during construction
     void initializeGrid();
+
+    // Returns the text drawn for a cell, from the cache unless the value, cell width or column
+    // precision changed
+    // A pending formula shows its last result with the pending marker; the reference is valid
+    // until the next call
+    const string& displayText(const std::shared_ptr<Cell>& cell, bool pending, int precision);
+
+    // Reads and writes a cell in the grid or, in paged mode, in the page cache
+    const std::shared_ptr<Cell>& cellAt(int row, int col) const;
+    void storeCell(int row, int col, std::shared_ptr<Cell> cell);
+
+    // Loads the block of the row from the row source unless it was already loaded
+    void loadRowBlock(int row) const;
+
+    // Returns the formula at (row, col) before its result is changed in place (nullptr if none)
+    // While a snapshot is alive the formula is first replaced by a copy, unless it is one already
+    FormulaCell* formulaForUpdate(int row, int col);
+
+    // Stores a cell at (row, col), keeps the dependency graph in sync and recalculates dependents
+    void placeCell(int row, int col, std::shared_ptr<Cell> cell);
+
+    // Applies an edited value as an O(1) delta to the aggregate formulas over (row, col)
+    void applyAggregateDeltas(int row, int col, bool hadOld, double oldValue,
+                              bool hasNew, double newValue, DynamicArray<std::pair<int, int>>& updated);
+
+    // Finds the number inside the text for parseInteger and parseDecimal
+    static bool numberText(std::string_view content, std::string_view& number);
+
+    // Rebuilds the dependency graph from all formulas in the grid
+    void rebuildDependencyGraph();
+
+    // Recalculates (or marks dirty in lazy mode) every formula affected by the changed cells
+    void recalculateFrom(const DynamicArray<std::pair<int, int>>& changed);
+
+    // Evaluates the dirty cells below (row, col) that share its program with one column kernel
+    // Stops after maxRows cells; returns the number of cells covered, or 0 if there is no such run
+    int evaluateColumnRun(int row, int col, int maxRows);
+
+    // Rows handed to one column kernel in a background time slice
+    static const int KERNEL_SLICE_ROWS = 4096;
+
+    // Rows handed to one column kernel in paged mode; the run is held in memory while it is computed
+    static const int PAGED_RUN_ROWS = 4096;
 };
 
 } // namespace GTUSpreadsheet
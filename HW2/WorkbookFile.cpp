@@ -0,0 +1,298 @@
+#include "WorkbookFile.h"
+#include "Spreadsheet.h"
+#include "SheetSnapshot.h"
+#include "Cell.h"
+#include "MappedFile.h"
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <unordered_map>
+
+namespace Utils {
+
+namespace {
+const char MAGIC[4] = {'G', 'T', 'U', 'W'};
+const std::size_t WRITE_CHUNK_BYTES = 1 << 20;
+
+// Cells of one column, gathered before writing because the string table comes first
+struct ColumnBlock {
+    DynamicArray<std::int32_t> rows;
+    DynamicArray<std::uint8_t> kinds;
+    DynamicArray<std::uint64_t> payloads;
+};
+
+// A formula shape and the cell it is written at
+struct ProgramEntry {
+    std::int32_t anchorRow;
+    std::int32_t anchorCol;
+    std::uint32_t text;
+};
+}
+
+template <typename T>
+void WorkbookFile::put(std::string& out, T value) {
+    char bytes[sizeof(T)];
+    std::memcpy(bytes, &value, sizeof(T));
+    out.append(bytes, sizeof(T));
+}
+
+template <typename T>
+T WorkbookFile::get(std::string_view data, std::size_t& offset) {
+    if (data.size() < sizeof(T) || offset > data.size() - sizeof(T)) {
+        throw std::runtime_error("Corrupt workbook: unexpected end of file");
+    }
+    T value;
+    std::memcpy(&value, data.data() + offset, sizeof(T));
+    offset += sizeof(T);
+    return value;
+}
+
+// Matches the ".gtuw" extension
+bool WorkbookFile::isWorkbookName(const std::string& fileName) {
+    const std::string extension = ".gtuw";
+    return fileName.size() > extension.size() &&
+           fileName.compare(fileName.size() - extension.size(), extension.size(), extension) == 0;
+}
+
+// Collects the cells column by column, interning labels, formula texts and results,
+// then writes the header, the string table, the programs, the column blocks and the precisions in order
+void WorkbookFile::save(const GTUSpreadsheet::SheetSnapshot& sheet, const std::string& fileName) {
+    int usedRows = sheet.getUsedRows();
+    int usedCols = sheet.getUsedCols();
+
+    DynamicArray<std::string> strings;
+    std::unordered_map<std::string, std::uint32_t> stringIndex;
+    auto intern = [&](const std::string& text) {
+        auto inserted = stringIndex.emplace(text, static_cast<std::uint32_t>(strings.getSize()));
+        if (inserted.second) {
+            strings.pushBack(text);
+        }
+        return inserted.first->second;
+    };
+
+    DynamicArray<ProgramEntry> programs;
+    std::unordered_map<const FormulaProgram*, std::uint32_t> programIndex;
+
+    std::unique_ptr<ColumnBlock[]> columns(new ColumnBlock[usedCols > 0 ? usedCols : 1]);
+    std::string content;
+    for (int c = 0; c < usedCols; ++c) {
+        ColumnBlock& block = columns[c];
+        for (int r = 0; r < usedRows; ++r) {
+            const Cell* cell = sheet.peekCell(r, c);
+            if (!cell) continue;
+
+            std::uint8_t kind;
+            std::uint64_t payload;
+            if (auto formulaCell = dynamic_cast<const FormulaCell*>(cell)) {
+                const FormulaProgram* program = formulaCell->getProgram().get();
+                auto found = programIndex.find(program);
+                if (found == programIndex.end()) {
+                    ProgramEntry entry{r, c, intern(formulaCell->getRawContent())};
+                    found = programIndex.emplace(program, static_cast<std::uint32_t>(programs.getSize())).first;
+                    programs.pushBack(entry);
+                }
+                kind = KIND_FORMULA;
+                payload = found->second | (static_cast<std::uint64_t>(intern(formulaCell->getStoredResult())) << 32);
+            } else if (auto intCell = dynamic_cast<const IntValueCell*>(cell)) {
+                kind = KIND_INT;
+                payload = static_cast<std::uint64_t>(intCell->getValue());
+            } else if (auto doubleCell = dynamic_cast<const DoubleValueCell*>(cell)) {
+                double value = doubleCell->getValue();
+                kind = KIND_DOUBLE;
+                std::memcpy(&payload, &value, sizeof(payload));
+            } else {
+                content.clear();
+                cell->appendContent(content);
+                if (content.empty()) continue; // Placeholder cell
+                kind = KIND_LABEL;
+                payload = intern(content);
+            }
+            block.rows.pushBack(r);
+            block.kinds.pushBack(kind);
+            block.payloads.pushBack(payload);
+        }
+    }
+
+    std::ofstream file(fileName, std::ios::binary);
+    if (!file.is_open()) {
+        throw std::runtime_error("Error: Could not open file for writing.");
+    }
+
+    std::string out;
+    out.append(MAGIC, sizeof(MAGIC));
+    put<std::uint32_t>(out, VERSION);
+    put<std::int32_t>(out, sheet.getTotalRows());
+    put<std::int32_t>(out, sheet.getTotalCols());
+    put<std::uint32_t>(out, strings.getSize());
+    put<std::uint32_t>(out, programs.getSize());
+    put<std::uint32_t>(out, usedCols);
+
+    for (int i = 0; i < strings.getSize(); ++i) {
+        put<std::uint32_t>(out, static_cast<std::uint32_t>(strings[i].size()));
+    }
+    for (int i = 0; i < strings.getSize(); ++i) {
+        out += strings[i];
+        if (out.size() >= WRITE_CHUNK_BYTES) {
+            file.write(out.data(), out.size());
+            out.clear();
+        }
+    }
+
+    for (int i = 0; i < programs.getSize(); ++i) {
+        put<std::int32_t>(out, programs[i].anchorRow);
+        put<std::int32_t>(out, programs[i].anchorCol);
+        put<std::uint32_t>(out, programs[i].text);
+    }
+
+    for (int c = 0; c < usedCols; ++c) {
+        const ColumnBlock& block = columns[c];
+        int count = block.rows.getSize();
+        put<std::uint32_t>(out, count);
+        for (int i = 0; i < count; ++i) put<std::int32_t>(out, block.rows[i]);
+        for (int i = 0; i < count; ++i) put<std::uint8_t>(out, block.kinds[i]);
+        for (int i = 0; i < count; ++i) {
+            put<std::uint64_t>(out, block.payloads[i]);
+            if (out.size() >= WRITE_CHUNK_BYTES) {
+                file.write(out.data(), out.size());
+                out.clear();
+            }
+        }
+    }
+
+    int precisionCols = sheet.getPrecisionColumns();
+    put<std::uint32_t>(out, precisionCols);
+    for (int c = 0; c < precisionCols; ++c) {
+        put<std::uint8_t>(out, static_cast<std::uint8_t>(sheet.getColumnPrecision(c)));
+    }
+    file.write(out.data(), out.size());
+    if (!file) {
+        throw std::runtime_error("Error while writing to file: write failed");
+    }
+    // What is still buffered is only written by close(), so its error must be seen before the rename
+    file.close();
+    if (!file) {
+        throw std::runtime_error("Error while writing to file: close failed");
+    }
+}
+
+// Reads the mapped file front to back; formula shapes are compiled once each, cells are restored
+// with their saved results and the dependency graph is rebuilt from the programs' templates
+void WorkbookFile::load(const std::shared_ptr<GTUSpreadsheet::Spreadsheet>& sheet, const std::string& fileName) {
+    MappedFile file(fileName);
+    std::string_view data = file.contents();
+    std::size_t offset = 0;
+
+    if (data.size() < sizeof(MAGIC) || std::memcmp(data.data(), MAGIC, sizeof(MAGIC)) != 0) {
+        throw std::runtime_error("Not a workbook file: " + fileName);
+    }
+    offset += sizeof(MAGIC);
+    std::uint32_t version = get<std::uint32_t>(data, offset);
+    if (version < 1 || version > VERSION) {
+        throw std::runtime_error("Unsupported workbook version " + std::to_string(version));
+    }
+    std::int32_t rows = get<std::int32_t>(data, offset);
+    std::int32_t cols = get<std::int32_t>(data, offset);
+    std::uint32_t stringCount = get<std::uint32_t>(data, offset);
+    std::uint32_t programCount = get<std::uint32_t>(data, offset);
+    std::uint32_t columnCount = get<std::uint32_t>(data, offset);
+    if (rows < 0 || cols < 0 || columnCount > static_cast<std::uint32_t>(cols) ||
+        stringCount > data.size() || programCount > data.size()) {
+        throw std::runtime_error("Corrupt workbook: bad header");
+    }
+
+    // String table: views into the mapping
+    std::unique_ptr<std::string_view[]> strings(new std::string_view[stringCount]);
+    std::size_t textOffset = offset + static_cast<std::size_t>(stringCount) * sizeof(std::uint32_t);
+    for (std::uint32_t i = 0; i < stringCount; ++i) {
+        std::uint32_t length = get<std::uint32_t>(data, offset);
+        if (textOffset > data.size() || length > data.size() - textOffset) {
+            throw std::runtime_error("Corrupt workbook: bad string table");
+        }
+        strings[i] = data.substr(textOffset, length);
+        textOffset += length;
+    }
+    offset = textOffset;
+
+    auto stringAt = [&](std::uint64_t index) {
+        if (index >= stringCount) {
+            throw std::runtime_error("Corrupt workbook: bad string index");
+        }
+        return std::string(strings[index]);
+    };
+
+    sheet->clear();
+    if (rows > 0 && cols > 0) {
+        sheet->resizeGrid(rows, cols);
+    }
+
+    std::unique_ptr<std::shared_ptr<const FormulaProgram>[]> programs(
+        new std::shared_ptr<const FormulaProgram>[programCount]);
+    for (std::uint32_t i = 0; i < programCount; ++i) {
+        std::int32_t anchorRow = get<std::int32_t>(data, offset);
+        std::int32_t anchorCol = get<std::int32_t>(data, offset);
+        std::uint32_t text = get<std::uint32_t>(data, offset);
+        programs[i] = sheet->getProgramCache().get(stringAt(text), anchorRow, anchorCol);
+    }
+
+    for (std::uint32_t c = 0; c < columnCount; ++c) {
+        std::uint32_t count = get<std::uint32_t>(data, offset);
+        std::size_t rowsOffset = offset;
+        std::size_t kindsOffset = rowsOffset + static_cast<std::size_t>(count) * sizeof(std::int32_t);
+        std::size_t payloadsOffset = kindsOffset + count;
+        std::size_t end = payloadsOffset + static_cast<std::size_t>(count) * sizeof(std::uint64_t);
+        if (count > data.size() || end > data.size()) {
+            throw std::runtime_error("Corrupt workbook: bad column block");
+        }
+
+        for (std::uint32_t i = 0; i < count; ++i) {
+            std::int32_t row = get<std::int32_t>(data, rowsOffset);
+            std::uint8_t kind = get<std::uint8_t>(data, kindsOffset);
+            std::uint64_t payload = get<std::uint64_t>(data, payloadsOffset);
+            if (row < 0 || row >= rows) {
+                throw std::runtime_error("Corrupt workbook: bad row");
+            }
+
+            std::shared_ptr<Cell> cell;
+            switch (kind) {
+                case KIND_INT:
+                    cell = std::make_shared<IntValueCell>(static_cast<long long>(payload));
+                    break;
+                case KIND_DOUBLE: {
+                    double value;
+                    std::memcpy(&value, &payload, sizeof(value));
+                    cell = std::make_shared<DoubleValueCell>(value);
+                    break;
+                }
+                case KIND_LABEL:
+                    cell = std::make_shared<StringValueCell>(stringAt(payload));
+                    break;
+                case KIND_FORMULA: {
+                    std::uint32_t program = static_cast<std::uint32_t>(payload);
+                    if (program >= programCount) {
+                        throw std::runtime_error("Corrupt workbook: bad program index");
+                    }
+                    cell = std::make_shared<FormulaCell>(programs[program], stringAt(payload >> 32),
+                                                         sheet, row, static_cast<int>(c));
+                    break;
+                }
+                default:
+                    throw std::runtime_error("Corrupt workbook: bad cell kind");
+            }
+            sheet->restoreCell(row, static_cast<int>(c), cell);
+        }
+        offset = end;
+    }
+
+    if (version >= 2) {
+        std::uint32_t precisionCols = get<std::uint32_t>(data, offset);
+        if (precisionCols > data.size() - offset) {
+            throw std::runtime_error("Corrupt workbook: bad precision table");
+        }
+        for (std::uint32_t c = 0; c < precisionCols; ++c) {
+            sheet->setColumnPrecision(static_cast<int>(c), get<std::uint8_t>(data, offset));
+        }
+    }
+
+    sheet->finishRestore();
+}
+}
@@ -0,0 +1,57 @@
+#ifndef WORKBOOKFILE_H
+#define WORKBOOKFILE_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+
+namespace GTUSpreadsheet {
+class Spreadsheet;
+class SheetSnapshot;
+}
+
+namespace Utils {
+
+// Native binary workbook (".gtuw")
+// Unlike CSV it keeps the formulas: every distinct formula shape is stored once, together with
+// the result of every formula cell, so a reopened workbook needs neither text parsing nor a recalculation
+//
+// Layout (little-endian):
+//   header   magic "GTUW", version, rows, cols, string count, program count, column count
+//   strings  string count lengths (uint32), then the bytes of all strings back to back
+//   programs per shape: anchor row, anchor col, string index of its formula text at the anchor
+//   columns  per column: cell count, rows (int32), kinds (uint8), payloads (uint64)
+//            Int: the value, Double: the bits of the value, Label: string index,
+//            Formula: program index (low 32 bits) and string index of the result (high 32 bits);
+//                     a number is stored in the shortest digits that read back exactly
+//   precision column count (uint32), then the decimals shown for each of those columns (uint8);
+//             missing in version 1 files, whose columns show the default
+class WorkbookFile {
+public:
+    static const std::uint32_t VERSION = 2;
+
+    // Returns true for file names with the workbook extension
+    static bool isWorkbookName(const std::string& fileName);
+
+    // Writes the used area of a snapshot of the sheet; only reads the snapshot, so it may run on
+    // another thread while the sheet is edited
+    static void save(const GTUSpreadsheet::SheetSnapshot& sheet, const std::string& fileName);
+
+    // Replaces the sheet contents with the workbook; throws std::runtime_error for damaged files
+    static void load(const std::shared_ptr<GTUSpreadsheet::Spreadsheet>& sheet, const std::string& fileName);
+
+private:
+    enum CellKind : std::uint8_t { KIND_INT = 1, KIND_DOUBLE = 2, KIND_LABEL = 3, KIND_FORMULA = 4 };
+
+    // Appends a fixed-width value in file byte order
+    template <typename T>
+    static void put(std::string& out, T value);
+
+    // Reads a fixed-width value at 'offset' and advances it; throws if the file is too short
+    template <typename T>
+    static T get(std::string_view data, std::size_t& offset);
+};
+}
+
+#endif // WORKBOOKFILE_H
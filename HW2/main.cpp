@@ -3,6 +3,7 @@
 #include "FileManager.h"
 #include <memory> 
 #include <iostream>
+#include <chrono>
 
 int main() {
     try {
@@ -13,6 +14,13 @@ int main() {
         if (!sheet) {
             throw std::runtime_error("Failed to create spreadsheet");
         }
+        // Edits only mark formulas dirty; they are recalculated in short time slices
+        // between keystrokes so a large recalculation never freezes the screen
+        sheet->setBackgroundRecalculation(true);
+        const int recalcSliceMs = 8; // Half of a 60 Hz frame
+        const int savePollMs = 50;   // How often a running background save is checked
+        const auto autosaveInterval = std::chrono::seconds(60);
+        auto lastAutosave = std::chrono::steady_clock::now();
 
         // Initialize FileManager with the spreadsheet instance
         Utils::FileManager fileManager(sheet);
@@ -20,19 +28,8 @@ int main() {
         int selectedRow = 0, selectedCol = 0;
         int rowOffset = 0, colOffset = 0;
 
-        // Draw the initial grid
-        sheet->drawGrid(terminal, selectedRow, selectedCol, rowOffset, colOffset);
-
-        char key;
-        while (true) {
-            key = terminal.getSpecialKey();
-
-            if (key == 'q') {
-                terminal.clearScreen();
-                break;
-            }
-
-            // Handle navigation
+        // Moves the selection one cell, growing the sheet when it reaches the edge
+        auto moveSelection = [&](int key) {
             switch (key) {
                 case 'U':
                     if (selectedRow > 0) selectedRow--;
@@ -55,6 +52,71 @@ int main() {
                     if (selectedCol > 0) selectedCol--;
                     break;
             }
+        };
+
+        // Draw the initial grid
+        sheet->drawGrid(terminal, selectedRow, selectedCol, rowOffset, colOffset);
+
+        int key;
+        while (true) {
+            // Use the idle time between keystrokes for pending recalculation
+            if (sheet->hasPendingRecalc() && !terminal.waitForInput(0)) {
+                bool visibleUpdated = sheet->runRecalcSlice(recalcSliceMs, rowOffset, colOffset);
+                if (visibleUpdated || !sheet->hasPendingRecalc()) {
+                    sheet->drawGrid(terminal, selectedRow, selectedCol, rowOffset, colOffset);
+                }
+                continue;
+            }
+            // Index the rest of a lazily opened file in the same idle time
+            if (fileManager.isIndexing() && !terminal.waitForInput(0)) {
+                fileManager.runIndexSlice(recalcSliceMs);
+                continue;
+            }
+            // Show the result of a background save as soon as its write finishes
+            if (fileManager.isSaving()) {
+                if (fileManager.pollSave()) {
+                    sheet->drawGrid(terminal, selectedRow, selectedCol, rowOffset, colOffset);
+                } else if (!terminal.waitForInput(savePollMs)) {
+                    continue;
+                }
+            }
+            // Unsaved edits are autosaved once the interval has passed, even without a keystroke
+            if (fileManager.hasUnsavedEdits() && !fileManager.isSaving()) {
+                auto now = std::chrono::steady_clock::now();
+                auto waitMs = std::chrono::duration_cast<std::chrono::milliseconds>(
+                    lastAutosave + autosaveInterval - now).count();
+                if (waitMs <= 0 || !terminal.waitForInput(static_cast<int>(waitMs))) {
+                    fileManager.autosave();
+                    lastAutosave = std::chrono::steady_clock::now();
+                    sheet->drawGrid(terminal, selectedRow, selectedCol, rowOffset, colOffset);
+                    continue;
+                }
+            }
+
+            key = terminal.getSpecialKey();
+
+            if (key == 'q') {
+                terminal.clearScreen();
+                break;
+            }
+
+            if (AnsiTerminal::isArrowKey(key)) {
+                // Leaving the cell sets it from whatever was typed into it
+                sheet->commitEdit();
+                // Arrow keys that are already queued (e.g. a held key repeating) are applied
+                // together, so they cost a single frame instead of one redraw each
+                while (true) {
+                    moveSelection(key);
+                    if (!terminal.waitForInput(0)) break;
+                    key = terminal.getSpecialKey();
+                    if (!AnsiTerminal::isArrowKey(key)) {
+                        terminal.putBackKey(key);
+                        break;
+                    }
+                }
+            } else {
+                sheet->handleInput(terminal, key, selectedRow, selectedCol, fileManager);
+            }
 
             // Adjust visible area
             if (selectedRow - rowOffset >= sheet->getVisibleRows()) {
@@ -69,8 +131,6 @@ int main() {
                 colOffset = selectedCol;
             }
 
-            // Handle input and redraw
-            sheet->handleInput(key, selectedRow, selectedCol, fileManager);
             sheet->drawGrid(terminal, selectedRow, selectedCol, rowOffset, colOffset);
         }
 